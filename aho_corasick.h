@@ -0,0 +1,274 @@
+/*
+* Library that contain an Aho-Corasick automaton: all the strings (or a subset of them) are
+* compiled into a single DFA, so a payload is scanned once instead of once per string.
+* With a large automaton every transition is a cache miss that depends on the one before, so a single
+* payload cannot hide them: struct ac_lanes advances up to AC_MAX_LANES payloads in lock-step, one
+* byte of each in turn, and prefetches the row of the next transition of every payload, so that the
+* core has the misses of all the lanes in flight at once.
+*
+* Usage:
+*	struct ac_automaton *ac = ac_build(array_of_strings, string_index, n);
+*	ac_match(ac, payload, len, string_count);	// one payload at a time
+*	struct ac_lanes lanes; ac_lanes_init(&lanes, ac, AC_DEFAULT_LANES, string_count);
+*	for every payload: ac_lanes_push(&lanes, payload, len); then ac_lanes_flush(&lanes);
+*/
+#ifndef _AHO_CORASICK_H_
+#define _AHO_CORASICK_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+#define AC_ALPHABET 256
+#define AC_MAX_LANES 16		// payloads scanned together at most
+#define AC_DEFAULT_LANES 4
+
+struct ac_automaton {
+	int state_count;
+	int *next;		// next[state*AC_ALPHABET + byte] is the next state, failures already resolved
+	int *out_start;		// strings ending in state s are out_list[out_start[s]] .. out_list[out_start[s+1]-1]
+	int *out_list;		// number of the string in array_of_strings
+	int *out_len;		// length of that string, used to know where a match starts
+};
+
+/* Function use to get the number of trie states needed by the strings given in sorted order:
+ * every string adds the characters that it does not share with the string before it */
+long ac_trie_states(char **array_of_strings, const int *string_index, int n) {
+	long states = 1; //root
+	const char *previous = "";
+	for (int k = 0; k < n; k++) {
+		const char *s = array_of_strings[string_index[k]];
+		int common = 0;
+		while (s[common] != '\0' && s[common] == previous[common])
+			common++;
+		states += strlen(s) - common;
+		previous = s;
+	}
+	return states;
+}
+
+/* Function use to get the memory taken by an automaton with state_count states */
+long ac_table_bytes(long state_count) {
+	return state_count * AC_ALPHABET * sizeof(int);
+}
+
+/* Function use to build the automaton of a subset of the strings
+* INPUT:
+*	array_of_strings: all the strings
+	string_index: numbers of the strings to put in this automaton
+	n: how many of them
+
+* OUTPUT
+	the automaton, matches are reported with the number the string has in array_of_strings
+*/
+struct ac_automaton* ac_build(char **array_of_strings, const int *string_index, int n) {
+	long max_states = 1;
+	for (int k = 0; k < n; k++)
+		max_states += strlen(array_of_strings[string_index[k]]);
+
+	int *next = malloc(max_states*AC_ALPHABET*sizeof(int));
+	int *fail = malloc(max_states*sizeof(int));
+	int *own_head = malloc(max_states*sizeof(int)); //first string ending exactly in this state, -1 if none
+	int *own_link = malloc((n > 0 ? n : 1)*sizeof(int)); //next string ending in the same state
+	int state_count = 1;
+	memset(next, -1, AC_ALPHABET*sizeof(int));
+	own_head[0] = -1;
+
+	/* Trie of the strings */
+	for (int k = 0; k < n; k++) {
+		const unsigned char *s = (const unsigned char *)array_of_strings[string_index[k]];
+		int state = 0;
+		for (int i = 0; s[i] != '\0'; i++) {
+			if (next[state*AC_ALPHABET + s[i]] == -1) {
+				memset(next + (long)state_count*AC_ALPHABET, -1, AC_ALPHABET*sizeof(int));
+				own_head[state_count] = -1;
+				next[state*AC_ALPHABET + s[i]] = state_count++;
+			}
+			state = next[state*AC_ALPHABET + s[i]];
+		}
+		own_link[k] = own_head[state];
+		own_head[state] = k;
+	}
+
+	/* Breadth first visit: failure links and missing transitions of the DFA */
+	int *queue = malloc(state_count*sizeof(int));
+	int queue_head = 0, queue_tail = 0;
+	fail[0] = 0;
+	for (int c = 0; c < AC_ALPHABET; c++) {
+		int u = next[c];
+		if (u == -1)
+			next[c] = 0;
+		else {
+			fail[u] = 0;
+			queue[queue_tail++] = u;
+		}
+	}
+	while (queue_head < queue_tail) {
+		int s = queue[queue_head++];
+		for (int c = 0; c < AC_ALPHABET; c++) {
+			int u = next[s*AC_ALPHABET + c];
+			if (u == -1)
+				next[s*AC_ALPHABET + c] = next[fail[s]*AC_ALPHABET + c];
+			else {
+				fail[u] = next[fail[s]*AC_ALPHABET + c];
+				queue[queue_tail++] = u;
+			}
+		}
+	}
+
+	/* Output of a state: strings ending there plus the output of its failure state,
+	 * which comes earlier in breadth first order */
+	struct ac_automaton *ac = malloc(sizeof(struct ac_automaton));
+	int *out_count = calloc(state_count, sizeof(int));
+	for (int q = -1; q < queue_tail; q++) {
+		int s = q < 0 ? 0 : queue[q];
+		for (int k = own_head[s]; k != -1; k = own_link[k])
+			out_count[s]++;
+		if (s != 0)
+			out_count[s] += out_count[fail[s]];
+	}
+	ac->out_start = malloc((state_count+1)*sizeof(int));
+	ac->out_start[0] = 0;
+	for (int s = 0; s < state_count; s++)
+		ac->out_start[s+1] = ac->out_start[s] + out_count[s];
+	int outputs = ac->out_start[state_count];
+	ac->out_list = malloc((outputs > 0 ? outputs : 1)*sizeof(int));
+	ac->out_len = malloc((outputs > 0 ? outputs : 1)*sizeof(int));
+	for (int q = -1; q < queue_tail; q++) {
+		int s = q < 0 ? 0 : queue[q];
+		int o = ac->out_start[s];
+		for (int k = own_head[s]; k != -1; k = own_link[k]) {
+			ac->out_list[o] = string_index[k];
+			ac->out_len[o] = strlen(array_of_strings[string_index[k]]);
+			o++;
+		}
+		if (s != 0)
+			for (int f = ac->out_start[fail[s]]; f < ac->out_start[fail[s]+1]; f++) {
+				ac->out_list[o] = ac->out_list[f];
+				ac->out_len[o] = ac->out_len[f];
+				o++;
+			}
+	}
+
+	ac->state_count = state_count;
+	ac->next = realloc(next, (long)state_count*AC_ALPHABET*sizeof(int));
+	free(fail);
+	free(own_head);
+	free(own_link);
+	free(queue);
+	free(out_count);
+	return ac;
+}
+
+/* Function use to count the matches of the automaton strings that start in text[0, own_len)
+* INPUT:
+*	ac: the automaton
+	text: the text, not necessarily NUL terminated
+	scan_len: bytes of text that can be read, own_len plus the overlap with the next chunk
+	own_len: only matches starting before own_len are counted (see chunked_scan.h)
+	string_count: counters indexed by the number of the string in array_of_strings
+*/
+void ac_match_range(const struct ac_automaton *ac, const char *text, int scan_len, int own_len, int *string_count) {
+	const unsigned char *t = (const unsigned char *)text;
+	const int *next = ac->next;
+	int state = 0;
+	for (int i = 0; i < scan_len; i++) {
+		state = next[state*AC_ALPHABET + t[i]];
+		for (int o = ac->out_start[state]; o < ac->out_start[state+1]; o++)
+			if (i + 1 - ac->out_len[o] < own_len) //the match starts inside the own part
+				string_count[ac->out_list[o]]++;
+	}
+}
+
+/* Function use to count every match of the automaton strings in text, like kmp_matcher does for one string */
+void ac_match(const struct ac_automaton *ac, const char *text, int text_len, int *string_count) {
+	ac_match_range(ac, text, text_len, text_len, string_count);
+}
+
+/* Payloads being scanned in lock-step, the counts go to string_count as with ac_match */
+struct ac_lanes {
+	const struct ac_automaton *ac;
+	int *string_count;
+	int lanes;		// payloads advanced together
+	int active;		// lanes [0, active) have a payload
+	const unsigned char *text[AC_MAX_LANES];
+	int len[AC_MAX_LANES], pos[AC_MAX_LANES], state[AC_MAX_LANES];
+};
+
+void ac_lanes_init(struct ac_lanes *l, const struct ac_automaton *ac, int lanes, int *string_count) {
+	l->ac = ac;
+	l->string_count = string_count;
+	l->lanes = lanes < 1 ? 1 : lanes > AC_MAX_LANES ? AC_MAX_LANES : lanes;
+	l->active = 0;
+}
+
+/* Function use to advance every lane by the bytes left to the shortest one, so that the inner loop has
+ * no end test; the lanes that have finished are taken out */
+static void ac_lanes_step(struct ac_lanes *l) {
+	const int *next = l->ac->next;
+	const int *out_start = l->ac->out_start;
+	const int *out_list = l->ac->out_list;
+	int *string_count = l->string_count;
+	int n = l->active;
+	int steps = l->len[0] - l->pos[0];
+	for (int j = 1; j < n; j++)
+		if (l->len[j] - l->pos[j] < steps)
+			steps = l->len[j] - l->pos[j];
+
+	const unsigned char *t[AC_MAX_LANES];
+	int state[AC_MAX_LANES];
+	for (int j = 0; j < n; j++) {
+		t[j] = l->text[j] + l->pos[j];
+		state[j] = l->state[j];
+	}
+	for (int i = 0; i < steps; i++)
+		for (int j = 0; j < n; j++) { //the lanes do not depend on each other, their loads overlap
+			int s = next[state[j]*AC_ALPHABET + t[j][i]];
+			state[j] = s;
+			if (i + 1 < steps)
+				__builtin_prefetch(&next[s*AC_ALPHABET + t[j][i+1]]);
+			for (int o = out_start[s]; o < out_start[s+1]; o++)
+				string_count[out_list[o]]++;
+		}
+
+	for (int j = n - 1; j >= 0; j--) {
+		l->pos[j] += steps;
+		l->state[j] = state[j];
+		if (l->pos[j] == l->len[j]) { //the last lane takes its place
+			l->active--;
+			l->text[j] = l->text[l->active];
+			l->len[j] = l->len[l->active];
+			l->pos[j] = l->pos[l->active];
+			l->state[j] = l->state[l->active];
+		}
+	}
+}
+
+/* Function use to add a payload to the lanes; when all of them are busy they are advanced until at
+ * least one is free, so text must stay valid until ac_lanes_flush */
+void ac_lanes_push(struct ac_lanes *l, const char *text, int text_len) {
+	if (text_len <= 0)
+		return;
+	l->text[l->active] = (const unsigned char *)text;
+	l->len[l->active] = text_len;
+	l->pos[l->active] = 0;
+	l->state[l->active] = 0;
+	if (++l->active == l->lanes)
+		ac_lanes_step(l);
+}
+
+/* Function use to finish the payloads still in the lanes */
+void ac_lanes_flush(struct ac_lanes *l) {
+	while (l->active > 0)
+		ac_lanes_step(l);
+}
+
+/* Function use to release an automaton built by ac_build */
+void ac_free(struct ac_automaton *ac) {
+	free(ac->next);
+	free(ac->out_start);
+	free(ac->out_list);
+	free(ac->out_len);
+	free(ac);
+}
+
+#endif
@@ -0,0 +1,225 @@
+/*
+* Library that contain the read -> decode -> match pipeline of openmp_task: a fixed pool of batches goes
+* round through three queues, a batch is filled by the reader, decoded by a decoder, matched by a
+* matcher and given back to the reader, so no buffer is allocated once the pool has grown to the size
+* of the packets. Every stage has threads of its own: one reader (libpcap reads one packet at a time),
+* the decoders and the matchers; the reader stops only when every batch of the pool is in the other stages.
+* Every thread adds up the time spent working on batches and waiting on its input queue, the report
+* tells which stage the others are waiting for.
+*
+* Usage:
+*	struct pipeline *p = pipeline_create(thread_count, decoders);
+*	thread t: switch (pipeline_stage(p, t)) ...	// pop from the queue before, push to the queue after
+*	pipeline_print(p); pipeline_free(p);
+*/
+#ifndef _BATCH_PIPELINE_H_
+#define _BATCH_PIPELINE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "timer.h"
+
+#define PIPELINE_BATCH_PACKETS 100	// packets of a batch
+#define PIPELINE_BATCHES_PER_THREAD 4	// batches of the pool for every thread of the pipeline
+
+#define PIPELINE_READ 0
+#define PIPELINE_DECODE 1
+#define PIPELINE_MATCH 2
+#define PIPELINE_STAGES 3
+
+/* A batch, the buffers are kept when it goes back to the pool */
+struct batch {
+	int count;			// packets in the batch
+	unsigned char *bytes;		// the packets, one after the other
+	size_t used, capacity;
+	unsigned int offset[PIPELINE_BATCH_PACKETS], caplen[PIPELINE_BATCH_PACKETS];
+	char *payload_bytes;		// the payloads, each one followed by '\0' for kmp_matcher
+	size_t payload_used, payload_capacity;
+	unsigned int payload_offset[PIPELINE_BATCH_PACKETS], payload_len[PIPELINE_BATCH_PACKETS];
+};
+
+struct batch_queue {
+	struct batch **items;		// ring of capacity items, never full: the pool is not larger
+	int head, count, capacity;
+	int closed;			// no more pushes, pop returns NULL once it is empty
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct stage_occupancy {
+	int threads;
+	long long batches;
+	double busy;			// seconds spent on batches, all the threads of the stage
+	double wait;			// seconds spent waiting on the input queue
+};
+
+struct pipeline {
+	struct batch *pool;
+	int pool_size;
+	struct batch_queue queue[PIPELINE_STAGES];	// input of every stage, the input of the reader is the pool
+	int decoders_running;		// the last decoder to finish closes the queue of the matchers
+	struct stage_occupancy stage[PIPELINE_STAGES];
+	pthread_mutex_t lock;		// of decoders_running and of stage
+};
+
+static void batch_queue_init(struct batch_queue *q, int capacity) {
+	memset(q, 0, sizeof(*q));
+	q->items = malloc(capacity * sizeof(struct batch *));
+	q->capacity = capacity;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+}
+
+void batch_queue_push(struct batch_queue *q, struct batch *b) {
+	pthread_mutex_lock(&q->lock);
+	q->items[(q->head + q->count) % q->capacity] = b;
+	q->count++;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void batch_queue_close(struct batch_queue *q) {
+	pthread_mutex_lock(&q->lock);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* Function use to take the next batch of a queue, waiting for it
+* OUTPUT
+	the batch, NULL if the queue is closed and empty; the time spent waiting is added to *wait
+*/
+struct batch *batch_queue_pop(struct batch_queue *q, double *wait) {
+	double start, finish;
+	GET_TIME(start);
+	pthread_mutex_lock(&q->lock);
+	while (q->count == 0 && !q->closed)
+		pthread_cond_wait(&q->cond, &q->lock);
+	struct batch *b = NULL;
+	if (q->count > 0) {
+		b = q->items[q->head];
+		q->head = (q->head + 1) % q->capacity;
+		q->count--;
+	}
+	pthread_mutex_unlock(&q->lock);
+	GET_TIME(finish);
+	*wait += finish - start;
+	return b;
+}
+
+/* Function use to copy a packet at the end of a batch */
+void batch_add_packet(struct batch *b, const unsigned char *data, unsigned int caplen) {
+	if (b->used + caplen > b->capacity) {
+		b->capacity = (b->used + caplen) * 2;
+		b->bytes = realloc(b->bytes, b->capacity);
+	}
+	memcpy(b->bytes + b->used, data, caplen);
+	b->offset[b->count] = b->used;
+	b->caplen[b->count] = caplen;
+	b->used += caplen;
+	b->count++;
+}
+
+/* Function use to store the payload of packet k of a batch, NULL for a packet without one (it gets " ") */
+void batch_set_payload(struct batch *b, int k, const char *payload, unsigned int len) {
+	if (payload == NULL) {
+		payload = " ";
+		len = 1;
+	}
+	if (b->payload_used + len + 1 > b->payload_capacity) {
+		b->payload_capacity = (b->payload_used + len + 1) * 2;
+		b->payload_bytes = realloc(b->payload_bytes, b->payload_capacity);
+	}
+	memcpy(b->payload_bytes + b->payload_used, payload, len);
+	b->payload_bytes[b->payload_used + len] = '\0';
+	b->payload_offset[k] = b->payload_used;
+	b->payload_len[k] = len;
+	b->payload_used += len + 1;
+}
+
+/* Function use to create the pipeline for thread_count threads: one reader, decoders decoders (0 for one
+ * every five threads) and the others matchers; with less than 3 threads every stage gets one anyway
+* OUTPUT
+	the pipeline, with every batch of the pool in the input queue of the reader
+*/
+struct pipeline *pipeline_create(int thread_count, int decoders) {
+	struct pipeline *p = calloc(1, sizeof(struct pipeline));
+	if (decoders <= 0)
+		decoders = (thread_count - 1) / 5 > 1 ? (thread_count - 1) / 5 : 1;
+	if (decoders > thread_count - 2)
+		decoders = thread_count > 2 ? thread_count - 2 : 1;
+	p->stage[PIPELINE_READ].threads = 1;
+	p->stage[PIPELINE_DECODE].threads = decoders;
+	p->stage[PIPELINE_MATCH].threads = thread_count - 1 - decoders > 0 ? thread_count - 1 - decoders : 1;
+	p->decoders_running = decoders;
+	p->pool_size = PIPELINE_BATCHES_PER_THREAD * (1 + decoders + p->stage[PIPELINE_MATCH].threads);
+	p->pool = calloc(p->pool_size, sizeof(struct batch));
+	for (int s = 0; s < PIPELINE_STAGES; s++)
+		batch_queue_init(&p->queue[s], p->pool_size);
+	for (int k = 0; k < p->pool_size; k++)
+		batch_queue_push(&p->queue[PIPELINE_READ], &p->pool[k]);
+	pthread_mutex_init(&p->lock, NULL);
+	return p;
+}
+
+/* Function use to know the number of threads of the pipeline, at least one per stage */
+int pipeline_threads(struct pipeline *p) {
+	return p->stage[PIPELINE_READ].threads + p->stage[PIPELINE_DECODE].threads + p->stage[PIPELINE_MATCH].threads;
+}
+
+/* Function use to know the stage of a thread of the pipeline: 0 reads, then the decoders, then the matchers */
+int pipeline_stage(struct pipeline *p, int thread) {
+	if (thread == 0)
+		return PIPELINE_READ;
+	return thread <= p->stage[PIPELINE_DECODE].threads ? PIPELINE_DECODE : PIPELINE_MATCH;
+}
+
+/* Function use by a decoder that has found its input queue closed: the last one closes the matchers' one */
+void pipeline_decoder_done(struct pipeline *p) {
+	pthread_mutex_lock(&p->lock);
+	int last = --p->decoders_running == 0;
+	pthread_mutex_unlock(&p->lock);
+	if (last)
+		batch_queue_close(&p->queue[PIPELINE_MATCH]);
+}
+
+/* Function use to add the work of a thread to its stage, once at the end */
+void pipeline_account(struct pipeline *p, int stage, long long batches, double busy, double wait) {
+	pthread_mutex_lock(&p->lock);
+	p->stage[stage].batches += batches;
+	p->stage[stage].busy += busy;
+	p->stage[stage].wait += wait;
+	pthread_mutex_unlock(&p->lock);
+}
+
+/* Function use to print, for every stage, how much of the time of its threads went on batches and how
+ * much waiting for them; elapsed is the wall time of the pipeline */
+void pipeline_print(struct pipeline *p, double elapsed) {
+	const char *names[PIPELINE_STAGES] = {"read", "decode", "match"};
+	printf("Pipeline: %d batches of %d packets\n", p->pool_size, PIPELINE_BATCH_PACKETS);
+	printf("Stage\tthreads\tbatches\tbusy\twaiting for input\n");
+	for (int s = 0; s < PIPELINE_STAGES; s++) {
+		double total = elapsed * p->stage[s].threads;
+		printf("%s\t%d\t%lld\t%.1f%%\t%.1f%%\n", names[s], p->stage[s].threads, p->stage[s].batches,
+			total > 0 ? 100 * p->stage[s].busy / total : 0, total > 0 ? 100 * p->stage[s].wait / total : 0);
+	}
+}
+
+void pipeline_free(struct pipeline *p) {
+	for (int k = 0; k < p->pool_size; k++) {
+		free(p->pool[k].bytes);
+		free(p->pool[k].payload_bytes);
+	}
+	for (int s = 0; s < PIPELINE_STAGES; s++) {
+		free(p->queue[s].items);
+		pthread_mutex_destroy(&p->queue[s].lock);
+		pthread_cond_destroy(&p->queue[s].cond);
+	}
+	pthread_mutex_destroy(&p->lock);
+	free(p->pool);
+	free(p);
+}
+
+#endif
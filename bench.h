@@ -0,0 +1,23 @@
+/*
+* Library that contain the machine readable line every binary prints at the end of a run,
+* parsed by benchmark.c to compare the variants with each other
+*/
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdio.h>
+
+/* Function use to print the benchmark line of a run
+* INPUT:
+*	variant: name of the binary (and of its options, if they change the algorithm)
+	ranks, threads: MPI ranks and threads per rank, 1 when not used
+	packets, bytes: packets read from the capture and their captured bytes
+	seconds: always the same span, measured with GET_TIME (monotonic clock) from just before
+	pcap_open_offline to the final string_count, so I/O is included for every variant
+*/
+void print_bench_line(const char *variant, int ranks, int threads, long long packets, long long bytes, double seconds) {
+	printf("BENCH variant=%s ranks=%d threads=%d packets=%lld bytes=%lld seconds=%.9f\n",
+		variant, ranks, threads, packets, bytes, seconds);
+}
+
+#endif
@@ -0,0 +1,317 @@
+/* 	Compilation: gcc -g -Wall benchmark.c -o benchmark
+	Usage: ./benchmark [-r repeats] [-w warmups] [-t thread_list] [-R hybrid_ranks] [-s strings.txt]
+		[-m mpi_launcher] [-o results.csv/results.json] [-c] [-T] [file.pcap ...]
+	Example: ./benchmark -r 5 -w 1 -t 1,2,4,8 -o results.json
+	-c: cold cache, the capture is dropped from the page cache (posix_fadvise DONTNEED) before every run,
+	so that the read paths of serial (pcap_next_ex, mmap, io_uring) are compared reading from the device
+	-T: count the dTLB misses (loads and stores, user space) of every run with perf_event_open, inherited
+	by the processes the run starts; the mean of the repeats gets a column of its own, so that the
+	variants with huge pages can be compared with those without (needs perf_event_paranoid <= 2)
+	Runs every variant compiled in the current directory over the captures (default: the bundled ones),
+	for every thread/rank count of thread_list, and reads the BENCH line each binary prints (bench.h):
+	same span for all of them, I/O included, measured with the monotonic clock.
+	Captures whose name starts with "tcp" are run in tcp mode, the others in udp mode.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define MAX_REPEATS 100
+#define MAX_THREAD_COUNTS 32
+
+/* How the parallelism of a sweep point is given to a variant */
+#define SERIAL 0	// run once per capture, no threads
+#define THREADS 1	// thread_number argument
+#define RANKS 2		// mpiexec -n
+#define HYBRID 3	// hybrid_ranks ranks x (threads / hybrid_ranks) threads
+
+struct variant {
+	const char *binary;
+	const char *options; // appended after the packet type
+	int parallelism;
+	int min_parallelism; // sweep points below this are skipped
+};
+
+static const struct variant variants[] = {
+	{"serial", "", SERIAL, 1},
+	{"serial", "reader=mmap", SERIAL, 1},
+	{"serial", "reader=uring", SERIAL, 1},
+	{"openmp_task", "", THREADS, 1},
+	{"openmp_data", "guided", THREADS, 1},
+	{"openmp_data", "steal", THREADS, 1},
+	{"openmp_data", "engine=ac", THREADS, 1},
+	{"openmp_data", "dedup=on", THREADS, 1},
+	{"openmp_data", "window", THREADS, 1},
+	{"openmp_data", "engine=ac numa=compact", THREADS, 1},
+	{"openmp_data", "engine=ac numa=scatter", THREADS, 1},
+	{"openmp_data", "engine=ac numa=socket", THREADS, 1},
+	{"openmp_data", "engine=ac huge", THREADS, 1},
+	{"openmp_data", "engine=ac interleave", THREADS, 1},
+	{"openmp_task", "dedup=on", THREADS, 1},
+	{"openmp_task", "pipeline", THREADS, 3}, // a reader, a decoder and a matcher at least
+	{"openmp_task", "engine=ac", THREADS, 1},
+	{"openmp_task", "engine=ac interleave", THREADS, 1},
+	{"mpi_dumping", "bytes", RANKS, 1},
+	{"mpi_dumping", "dynamic", RANKS, 2}, // rank 0 only hands out work
+	{"mpi_openmp_hybrid", "data", HYBRID, 2},
+	{"mpi_openmp_hybrid", "task", HYBRID, 2},
+};
+
+static const char *default_captures[] = {"udp.pcap", "tcp.pcap", "udp_1000.pcap", "big_udp.pcap", "very_big_udp.pcap"};
+
+/* Result of a single run, parsed from the BENCH line */
+struct run {
+	char variant[64];
+	int ranks, threads;
+	long long packets, bytes;
+	double seconds;
+};
+
+/* Function use to run a command and parse its BENCH line
+* OUTPUT
+	1 if the line has been found, 0 otherwise (the binary failed)
+*/
+int run_once(const char *command, struct run *r) {
+	FILE *p = popen(command, "r");
+	if (p == NULL)
+		return 0;
+	char line[1024];
+	int found = 0;
+	while (fgets(line, sizeof(line), p) != NULL)
+		if (sscanf(line, "BENCH variant=%63s ranks=%d threads=%d packets=%lld bytes=%lld seconds=%lf",
+			r->variant, &r->ranks, &r->threads, &r->packets, &r->bytes, &r->seconds) == 6)
+			found = 1;
+	pclose(p);
+	return found;
+}
+
+/* Function use to drop the pages of a capture from the page cache, the next run reads it from the device */
+void drop_page_cache(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	fdatasync(fd); //dirty pages are not dropped
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+/* Function use to open a disabled counter of the dTLB misses of this process and of every process started
+ * after it is enabled (inherit), op is PERF_COUNT_HW_CACHE_OP_READ or _WRITE
+* OUTPUT
+	the counter, -1 if the CPU or the kernel do not count them
+*/
+int tlb_counter_open(int op) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | (op << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Function use to run a command with the TLB counters on: the counts of the processes it starts are
+ * added to ours when they exit, so they are all in when pclose returns. RESET does not clear what the
+ * children have added, the difference of two reads is taken instead */
+int run_counted(const char *command, struct run *r, const int *tlb, long long *misses) {
+	long long before[2] = {0, 0}, after;
+	for (int c = 0; c < 2; c++)
+		if (tlb[c] >= 0) {
+			if (read(tlb[c], &before[c], sizeof(before[c])) != sizeof(before[c]))
+				before[c] = 0;
+			ioctl(tlb[c], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	int ok = run_once(command, r);
+	*misses = 0;
+	for (int c = 0; c < 2; c++) {
+		if (tlb[c] < 0)
+			continue;
+		ioctl(tlb[c], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(tlb[c], &after, sizeof(after)) == sizeof(after))
+			*misses += after - before[c];
+	}
+	return ok;
+}
+
+int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+	int repeats = 5, warmups = 1, hybrid_ranks = 2;
+	int thread_counts[MAX_THREAD_COUNTS] = {1, 2, 4};
+	int thread_count_length = 3;
+	const char *strings_file_path = "strings.txt";
+	const char *output_path = NULL;
+	const char *launcher = NULL;
+	int cold = 0; //drop the capture from the page cache before every run
+	int count_tlb = 0; //dTLB misses of every run
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:w:t:R:s:m:o:cT")) != -1) {
+		switch (opt) {
+		case 'r': repeats = atoi(optarg); break;
+		case 'w': warmups = atoi(optarg); break;
+		case 'R': hybrid_ranks = atoi(optarg); break;
+		case 's': strings_file_path = optarg; break;
+		case 'm': launcher = optarg; break;
+		case 'o': output_path = optarg; break;
+		case 'c': cold = 1; break;
+		case 'T': count_tlb = 1; break;
+		case 't': {
+			thread_count_length = 0;
+			for (char *tok = strtok(optarg, ","); tok != NULL && thread_count_length < MAX_THREAD_COUNTS; tok = strtok(NULL, ","))
+				thread_counts[thread_count_length++] = atoi(tok);
+			break;
+		}
+		default:
+			printf("USAGE: ./benchmark [-r repeats] [-w warmups] [-t thread_list] [-R hybrid_ranks] [-s strings.txt] [-m mpi_launcher] [-o results.csv/results.json] [-c] [-T] [file.pcap ...]\n");
+			exit(1);
+		}
+	}
+	if (repeats < 1 || repeats > MAX_REPEATS || hybrid_ranks < 1) {
+		printf("repeats must be between 1 and %d, hybrid_ranks at least 1\n", MAX_REPEATS);
+		exit(1);
+	}
+
+	const char **captures = default_captures;
+	int capture_count = sizeof(default_captures)/sizeof(default_captures[0]);
+	if (optind < argc) {
+		captures = (const char **)(argv + optind);
+		capture_count = argc - optind;
+	}
+
+	/* Open MPI refuses to run as root and to oversubscribe unless told so */
+	char default_launcher[128] = "mpiexec --oversubscribe";
+	if (getuid() == 0)
+		strcat(default_launcher, " --allow-run-as-root");
+	if (launcher == NULL)
+		launcher = default_launcher;
+
+	int tlb[2] = {-1, -1}; //load and store misses, the CPU can count only one of them
+	if (count_tlb) {
+		tlb[0] = tlb_counter_open(PERF_COUNT_HW_CACHE_OP_READ);
+		tlb[1] = tlb_counter_open(PERF_COUNT_HW_CACHE_OP_WRITE);
+		if (tlb[0] < 0 && tlb[1] < 0) {
+			perror("dTLB misses cannot be counted here, perf_event_open");
+			count_tlb = 0;
+		}
+	}
+
+	FILE *out = NULL;
+	int json = 0;
+	if (output_path != NULL) {
+		out = fopen(output_path, "w");
+		if (out == NULL) {
+			perror("error opening output file: ");
+			exit(1);
+		}
+		json = strlen(output_path) > 5 && strcmp(output_path + strlen(output_path) - 5, ".json") == 0;
+		if (json)
+			fprintf(out, "[\n");
+		else
+			fprintf(out, "capture,variant,ranks,threads,packets,bytes,repeats,min_s,median_s,mean_s,gbit_per_s,packets_per_s%s\n", count_tlb ? ",dtlb_misses" : "");
+	}
+	int results = 0;
+
+	if (cold)
+		printf("Cold cache: every capture is dropped from the page cache before every run\n");
+	printf("%-18s %-34s %5s %7s %10s %10s %10s %12s%s\n", "capture", "variant", "ranks", "threads", "min (s)", "median (s)", "Gbit/s", "packets/s",
+		count_tlb ? "  dTLB misses" : "");
+
+	for (int f = 0; f < capture_count; f++) {
+		const char *type = strncmp(captures[f], "tcp", 3) == 0 ? "tcp" : "udp";
+		for (unsigned int v = 0; v < sizeof(variants)/sizeof(variants[0]); v++) {
+			if (access(variants[v].binary, X_OK) != 0) //not compiled, nothing to compare
+				continue;
+			for (int t = 0; t < thread_count_length; t++) {
+				int n = thread_counts[t];
+				if (variants[v].parallelism == SERIAL && t > 0)
+					break;
+				if (n < variants[v].min_parallelism)
+					continue;
+				if (variants[v].parallelism == HYBRID && (n < hybrid_ranks || n % hybrid_ranks != 0))
+					continue;
+
+				char command[2048];
+				switch (variants[v].parallelism) {
+				case SERIAL:
+					snprintf(command, sizeof(command), "./%s %s %s %s %s", variants[v].binary, captures[f], strings_file_path, type, variants[v].options);
+					break;
+				case THREADS:
+					snprintf(command, sizeof(command), "./%s %s %s %d %s %s", variants[v].binary, captures[f], strings_file_path, n, type, variants[v].options);
+					break;
+				case RANKS:
+					snprintf(command, sizeof(command), "%s -n %d ./%s %s %s %s %s", launcher, n, variants[v].binary, captures[f], strings_file_path, type, variants[v].options);
+					break;
+				default:
+					snprintf(command, sizeof(command), "%s -n %d ./%s %s %s %d %s %s", launcher, hybrid_ranks, variants[v].binary, captures[f], strings_file_path, n/hybrid_ranks, type, variants[v].options);
+				}
+
+				struct run r;
+				int ok = 1;
+				for (int w = 0; w < warmups && ok; w++) { //warm up page cache, CPU frequency and allocator
+					if (cold)
+						drop_page_cache(captures[f]);
+					ok = run_once(command, &r);
+				}
+				double seconds[MAX_REPEATS];
+				long long tlb_misses = 0; //all the repeats
+				for (int i = 0; i < repeats && ok; i++) {
+					if (cold)
+						drop_page_cache(captures[f]);
+					long long misses = 0;
+					ok = count_tlb ? run_counted(command, &r, tlb, &misses) : run_once(command, &r);
+					seconds[i] = r.seconds;
+					tlb_misses += misses;
+				}
+				if (!ok) {
+					fprintf(stderr, "failed: %s\n", command);
+					continue;
+				}
+
+				qsort(seconds, repeats, sizeof(double), compare_double);
+				double sum = 0;
+				for (int i = 0; i < repeats; i++)
+					sum += seconds[i];
+				double median = repeats % 2 ? seconds[repeats/2] : (seconds[repeats/2-1] + seconds[repeats/2]) / 2;
+				double gbit = median > 0 ? r.bytes * 8 / median / 1e9 : 0;
+				double pps = median > 0 ? r.packets / median : 0;
+
+				printf("%-18s %-34s %5d %7d %10.6f %10.6f %10.4f %12.0f", captures[f], r.variant, r.ranks, r.threads, seconds[0], median, gbit, pps);
+				if (count_tlb)
+					printf(" %13lld", tlb_misses / repeats);
+				printf("\n");
+				fflush(stdout);
+				if (out != NULL && json)
+					fprintf(out, "%s  {\"capture\": \"%s\", \"variant\": \"%s\", \"ranks\": %d, \"threads\": %d, \"packets\": %lld, \"bytes\": %lld, "
+						"\"repeats\": %d, \"min_s\": %.9f, \"median_s\": %.9f, \"mean_s\": %.9f, \"gbit_per_s\": %.6f, \"packets_per_s\": %.1f%s",
+						results > 0 ? ",\n" : "", captures[f], r.variant, r.ranks, r.threads, r.packets, r.bytes,
+						repeats, seconds[0], median, sum/repeats, gbit, pps, count_tlb ? ", \"dtlb_misses\": " : "}");
+				else if (out != NULL)
+					fprintf(out, "%s,%s,%d,%d,%lld,%lld,%d,%.9f,%.9f,%.9f,%.6f,%.1f%s", captures[f], r.variant, r.ranks, r.threads,
+						r.packets, r.bytes, repeats, seconds[0], median, sum/repeats, gbit, pps, count_tlb ? "," : "\n");
+				if (out != NULL && count_tlb)
+					fprintf(out, json ? "%lld}" : "%lld\n", tlb_misses / repeats);
+				results++;
+			}
+		}
+	}
+
+	if (out != NULL) {
+		if (json)
+			fprintf(out, "\n]\n");
+		fclose(out);
+	}
+	return 0;
+}
@@ -0,0 +1,66 @@
+#!/bin/bash
+# Compare processes-only, threads-only and hybrid MPI+OpenMP layouts at the same core count
+#	Usage: ./benchmark_hybrid.sh <file.pcap> <strings.txt> cores sockets [repeats] [tcp/udp]
+#	Example: ./benchmark_hybrid.sh big_udp.pcap strings.txt 16 2 5 udp
+#	Needs these binaries already compiled in the current directory:
+#	mpi_dumping, openmp_data, openmp_task and mpi_openmp_hybrid (see the Compilation line of each .c file)
+
+if [ $# -lt 4 ]; then
+	echo "USAGE: ./benchmark_hybrid.sh <file.pcap> <strings.txt> cores sockets [repeats] [tcp/udp]"
+	exit 1
+fi
+
+pcap_file=$1
+strings_file=$2
+cores=$3
+sockets=$4
+repeats=${5:-5}
+type=${6:-udp}
+
+if [ $((cores % sockets)) -ne 0 ]; then
+	echo "cores must be a multiple of sockets"
+	exit 1
+fi
+threads_per_rank=$((cores / sockets))
+
+# Open MPI refuses to run as root and to oversubscribe unless told so
+MPIRUN="mpiexec --oversubscribe"
+if [ "$(id -u)" -eq 0 ]; then
+	MPIRUN="$MPIRUN --allow-run-as-root"
+fi
+
+# run <label> <command...>: run a layout $repeats times and print best and mean time. The time is the
+# seconds= field of the BENCH line (bench.h), the same span (reading included) in every binary: their
+# "Elapsed time" lines do not agree on whether reading and distributing the capture are counted
+run() {
+	label=$1
+	shift
+	times=""
+	for ((r = 0; r < repeats; r++)); do
+		t=$("$@" | grep "^BENCH " | sed -n 's/.* seconds=\([0-9.]*\).*/\1/p')
+		if [ -z "$t" ]; then
+			printf "%-40s failed (see the error above)\n" "$label"
+			return
+		fi
+		times="$times $t"
+	done
+	echo "$times" | awk -v label="$label" '{
+		best = $1; sum = 0
+		for (i = 1; i <= NF; i++) { sum += $i; if ($i < best) best = $i }
+		printf "%-40s best %f s   mean %f s\n", label, best, sum / NF
+	}'
+}
+
+echo "$pcap_file, $cores cores, $sockets sockets, $repeats repeats"
+run "processes only ($cores ranks x 1 thread)" \
+	$MPIRUN -n "$cores" --bind-to core ./mpi_dumping "$pcap_file" "$strings_file" "$type"
+run "threads only (openmp_data, $cores threads)" \
+	env OMP_PROC_BIND=close OMP_PLACES=cores ./openmp_data "$pcap_file" "$strings_file" "$cores" "$type"
+run "threads only (openmp_task, $cores threads)" \
+	env OMP_PROC_BIND=close OMP_PLACES=cores ./openmp_task "$pcap_file" "$strings_file" "$cores" "$type"
+run "hybrid data ($sockets ranks x $threads_per_rank threads)" \
+	$MPIRUN -n "$sockets" --map-by socket --bind-to socket -x OMP_PROC_BIND=close -x OMP_PLACES=cores \
+	./mpi_openmp_hybrid "$pcap_file" "$strings_file" "$threads_per_rank" "$type" data
+run "hybrid task ($sockets ranks x $threads_per_rank threads)" \
+	$MPIRUN -n "$sockets" --map-by socket --bind-to socket -x OMP_PROC_BIND=close -x OMP_PLACES=cores \
+	./mpi_openmp_hybrid "$pcap_file" "$strings_file" "$threads_per_rank" "$type" task
@@ -0,0 +1,439 @@
+/*
+* Library that contain the read paths of offline captures, all with the pcap_next_ex interface:
+*	READER_PCAP	libpcap (pcap_next_ex), gzip-compressed captures too (gz_capture.h)
+*	READER_MMAP	the file is mapped and the records are parsed in place, no copy; the pages are
+*			faulted in synchronously by the parser as it gets to them
+*	READER_URING	io_uring: URING_BUFFERS reads of URING_BUFFER_BYTES are kept in flight into a ring of
+*			registered buffers, the records are parsed out of the completed buffers in file order
+*			while the reads of the next ones are already queued; a record that spans two buffers is
+*			put together in a separate buffer
+* READER_HUGE_PAGES or'ed to the kind asks for transparent huge pages on the mapping of READER_MMAP (the
+* kernel gives them to page cache mappings only with CONFIG_READ_ONLY_THP_FOR_FS, otherwise it is ignored).
+* mmap and io_uring parse classic pcap files themselves (both byte orders, micro and nanosecond
+* timestamps); a capture they cannot parse (pcapng, gzip) is read with libpcap instead.
+* io_uring is used through the raw system calls, liburing is not needed.
+*
+* Usage:
+*	struct capture_reader *r = reader_open(path, reader_kind("uring"), errbuf);
+*	while (reader_next(r, &header, &data) >= 0) ...
+*	reader_close(r);
+*/
+#ifndef _CAPTURE_READER_H_
+#define _CAPTURE_READER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <pcap.h>
+#include "gz_capture.h"
+
+#define READER_PCAP 0
+#define READER_MMAP 1
+#define READER_URING 2
+#define READER_HUGE_PAGES 0x100	// flag, see above
+
+#define URING_BUFFERS 8			// reads in flight
+#define URING_BUFFER_BYTES (1 << 20)
+#define READER_MAX_CAPLEN 262144	// larger records are taken as a corrupted file, as libpcap does
+
+/* Raw io_uring: the rings mapped from the kernel */
+struct uring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+};
+
+struct uring_buffer {
+	char *data;
+	long long offset;	// of the file
+	int want;		// bytes asked for
+	int filled;		// bytes read so far
+	int done;		// the read has completed (filled < want only at the end of the file or on an error)
+	int error;		// -errno of a failed read, 0 otherwise
+};
+
+struct capture_reader {
+	int kind;
+	pcap_t *pcap;			// READER_PCAP
+	int fd;
+	int swapped, nanoseconds;
+	struct pcap_pkthdr header;
+	long long size;			// of the file
+	long long offset;		// next record (mmap), first byte not asked for yet (io_uring)
+	unsigned char *map;		// READER_MMAP
+	struct uring ring;		// READER_URING
+	int registered;			// the buffers are registered, reads are READ_FIXED
+	struct uring_buffer buffer[URING_BUFFERS];
+	long long current;		// buffer being parsed, in file order (buffer current % URING_BUFFERS)
+	int pos;			// next record in it
+	int started;			// the first reads have been submitted
+	char *stitch;			// a record that spans two buffers
+};
+
+/* Function use to get the reader of a name: pcap, mmap or uring; -1 if unknown */
+int reader_kind(const char *name) {
+	if (strcmp(name, "pcap") == 0)
+		return READER_PCAP;
+	if (strcmp(name, "mmap") == 0)
+		return READER_MMAP;
+	if (strcmp(name, "uring") == 0)
+		return READER_URING;
+	return -1;
+}
+
+const char *reader_name(int kind) {
+	return kind == READER_MMAP ? "mmap" : kind == READER_URING ? "uring" : "pcap";
+}
+
+/* Function use to set up an io_uring of entries entries
+* OUTPUT
+	0, -errno if the kernel does not let us
+*/
+int uring_setup(struct uring *u, unsigned entries) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd < 0)
+		return -errno;
+	u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) //one mapping for both rings
+		u->sq_size = u->cq_size = u->sq_size > u->cq_size ? u->sq_size : u->cq_size;
+	u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	u->cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP) ? u->sq_ptr :
+		mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sq_ptr == MAP_FAILED || u->cq_ptr == MAP_FAILED || u->sqes == MAP_FAILED) {
+		close(u->fd);
+		return -ENOMEM;
+	}
+	char *sq = u->sq_ptr, *cq = u->cq_ptr;
+	u->sq_head = (unsigned *)(sq + p.sq_off.head);
+	u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)(sq + p.sq_off.array);
+	u->cq_head = (unsigned *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+void uring_free(struct uring *u) {
+	munmap(u->sqes, u->sqes_size);
+	if (u->cq_ptr != u->sq_ptr)
+		munmap(u->cq_ptr, u->cq_size);
+	munmap(u->sq_ptr, u->sq_size);
+	close(u->fd);
+}
+
+/* Function use to queue the read of the missing bytes of buffer b (it is not submitted yet) */
+static void uring_queue_read(struct capture_reader *r, int b) {
+	struct uring *u = &r->ring;
+	struct uring_buffer *buf = &r->buffer[b];
+	unsigned tail = *u->sq_tail;
+	unsigned index = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = r->registered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = r->fd;
+	sqe->addr = (unsigned long long)(buf->data + buf->filled);
+	sqe->len = buf->want - buf->filled;
+	sqe->off = buf->offset + buf->filled;
+	sqe->buf_index = b;
+	sqe->user_data = b;
+	u->sq_array[index] = index;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Function use to give buffer b the next URING_BUFFER_BYTES of the file and queue its read */
+static void uring_refill(struct capture_reader *r, int b) {
+	struct uring_buffer *buf = &r->buffer[b];
+	buf->offset = r->offset;
+	buf->want = r->size - r->offset < URING_BUFFER_BYTES ? r->size - r->offset : URING_BUFFER_BYTES;
+	buf->filled = 0;
+	buf->error = 0;
+	buf->done = buf->want == 0; //past the end of the file, nothing to read
+	r->offset += buf->want;
+	if (!buf->done)
+		uring_queue_read(r, b);
+}
+
+/* Function use to submit the queued reads and, if wait, to wait for at least one completion; every
+ * completion is applied to its buffer, a short read is queued again for the rest and a failed one
+ * marks its buffer done with the error
+* OUTPUT
+	0, -errno if io_uring_enter fails
+*/
+static int uring_reap(struct capture_reader *r, int wait) {
+	struct uring *u = &r->ring;
+	unsigned submit = *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (submit > 0 || wait) {
+		int ret = syscall(__NR_io_uring_enter, u->fd, submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (ret < 0 && errno != EINTR)
+			return -errno;
+	}
+	unsigned head = *u->cq_head;
+	while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+		struct uring_buffer *buf = &r->buffer[cqe->user_data];
+		if (cqe->res < 0) { //nothing is in flight for the buffer any more
+			buf->error = cqe->res;
+			buf->done = 1;
+		}
+		else {
+			buf->filled += cqe->res;
+			if (cqe->res == 0 || buf->filled == buf->want) //the end of the file or all of it
+				buf->done = 1;
+			else //short read, network file systems do that
+				uring_queue_read(r, cqe->user_data);
+		}
+		head++;
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Function use to wait until the buffer being parsed has been read
+* OUTPUT
+	its bytes, 0 past the end of the file, -1 on a read error
+*/
+static int uring_wait_current(struct capture_reader *r) {
+	struct uring_buffer *buf = &r->buffer[r->current % URING_BUFFERS];
+	while (!buf->done) {
+		int error = uring_reap(r, 1);
+		if (error < 0) {
+			fprintf(stderr, "error reading the capture with io_uring: %s\n", strerror(-error));
+			return -1;
+		}
+	}
+	if (buf->error < 0) {
+		fprintf(stderr, "error reading the capture with io_uring: %s\n", strerror(-buf->error));
+		return -1;
+	}
+	return buf->filled;
+}
+
+/* Function use to copy n bytes of the stream from the current position, moving to the next buffers
+ * (and giving the ones left behind new reads) when needed
+* OUTPUT
+	1, 0 if the file ends first, -1 on a read error
+*/
+static int uring_copy(struct capture_reader *r, char *out, int n) {
+	while (n > 0) {
+		int filled = uring_wait_current(r);
+		if (filled <= 0)
+			return filled;
+		int k = filled - r->pos < n ? filled - r->pos : n;
+		memcpy(out, r->buffer[r->current % URING_BUFFERS].data + r->pos, k);
+		out += k;
+		n -= k;
+		r->pos += k;
+		if (r->pos == filled) { //done with this buffer, it reads the next part of the file
+			uring_refill(r, r->current % URING_BUFFERS);
+			r->current++;
+			r->pos = 0;
+		}
+	}
+	return 1;
+}
+
+/* Function use to read the global header of a classic pcap file
+* OUTPUT
+	1 if the file can be parsed by mmap and io_uring, 0 otherwise
+*/
+static int reader_global_header(struct capture_reader *r) {
+	unsigned int global[6];
+	if (pread(r->fd, global, sizeof(global), 0) != sizeof(global))
+		return 0;
+	r->swapped = global[0] == 0xd4c3b2a1 || global[0] == 0x4d3cb2a1;
+	r->nanoseconds = global[0] == 0xa1b23c4d || global[0] == 0x4d3cb2a1;
+	return global[0] == 0xa1b2c3d4 || global[0] == 0xa1b23c4d || r->swapped;
+}
+
+/* Function use to fill the header of the record from its 16 bytes
+* OUTPUT
+	1, 0 if the record is corrupted
+*/
+static int reader_record_header(struct capture_reader *r, const unsigned int *record) {
+	unsigned int v[4];
+	for (int k = 0; k < 4; k++)
+		v[k] = r->swapped ? __builtin_bswap32(record[k]) : record[k];
+	r->header.ts.tv_sec = v[0];
+	r->header.ts.tv_usec = r->nanoseconds ? v[1] / 1000 : v[1];
+	r->header.caplen = v[2];
+	r->header.len = v[3];
+	return v[2] <= READER_MAX_CAPLEN;
+}
+
+/* Function use to open a capture with the given read path
+* OUTPUT
+	the reader, NULL with the reason in errbuf
+*/
+struct capture_reader *reader_open(const char *path, int kind, char *errbuf) {
+	int huge = kind & READER_HUGE_PAGES;
+	kind &= ~READER_HUGE_PAGES;
+	struct capture_reader *r = calloc(1, sizeof(struct capture_reader));
+	r->kind = kind;
+	r->fd = -1;
+	if (kind != READER_PCAP) {
+		struct stat st;
+		r->fd = open(path, O_RDONLY);
+		if (r->fd < 0 || fstat(r->fd, &st) != 0) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+			if (r->fd >= 0)
+				close(r->fd);
+			free(r);
+			return NULL;
+		}
+		r->size = st.st_size;
+		r->offset = 24;
+		if (!reader_global_header(r)) { //pcapng or compressed: libpcap knows what to do
+			close(r->fd);
+			r->fd = -1;
+			r->kind = kind = READER_PCAP;
+		}
+	}
+	if (kind == READER_MMAP) {
+		r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+		if (r->map == MAP_FAILED) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: mmap: %s", path, strerror(errno));
+			close(r->fd);
+			free(r);
+			return NULL;
+		}
+		madvise(r->map, r->size, MADV_SEQUENTIAL);
+		if (huge)
+			madvise(r->map, r->size, MADV_HUGEPAGE);
+	}
+	else if (kind == READER_URING) {
+		int error = uring_setup(&r->ring, URING_BUFFERS * 2);
+		if (error < 0) {
+			snprintf(errbuf, PCAP_ERRBUF_SIZE, "io_uring not available: %s", strerror(-error));
+			close(r->fd);
+			free(r);
+			return NULL;
+		}
+		struct iovec iov[URING_BUFFERS];
+		for (int b = 0; b < URING_BUFFERS; b++) {
+			r->buffer[b].data = aligned_alloc(4096, URING_BUFFER_BYTES);
+			iov[b].iov_base = r->buffer[b].data;
+			iov[b].iov_len = URING_BUFFER_BYTES;
+		}
+		// registered buffers are pinned once instead of at every read; RLIMIT_MEMLOCK can forbid it
+		r->registered = syscall(__NR_io_uring_register, r->ring.fd, IORING_REGISTER_BUFFERS, iov, URING_BUFFERS) == 0;
+		r->stitch = malloc(READER_MAX_CAPLEN);
+	}
+	else {
+		r->pcap = capture_open_offline(path, errbuf);
+		if (r->pcap == NULL) {
+			free(r);
+			return NULL;
+		}
+	}
+	return r;
+}
+
+/* Function use to start reading from offset instead of from the first record, before the first reader_next */
+void reader_seek(struct capture_reader *r, long long offset) {
+	if (r->kind == READER_PCAP)
+		fseek(pcap_file(r->pcap), offset, SEEK_SET);
+	else
+		r->offset = offset;
+}
+
+/* Function use to get the next record, as pcap_next_ex: data stays valid until the next call
+* OUTPUT
+	1 with a record, -2 at the end of the file, -1 on a truncated record or a read error
+*/
+int reader_next(struct capture_reader *r, struct pcap_pkthdr **header, const unsigned char **data) {
+	if (r->kind == READER_PCAP)
+		return pcap_next_ex(r->pcap, header, data);
+
+	if (r->kind == READER_MMAP) {
+		if (r->offset == r->size)
+			return -2;
+		if (r->offset + 16 > r->size || !reader_record_header(r, (const unsigned int *)(r->map + r->offset)) ||
+				r->offset + 16 + r->header.caplen > r->size)
+			return -1;
+		*header = &r->header;
+		*data = r->map + r->offset + 16;
+		r->offset += 16 + r->header.caplen;
+		return 1;
+	}
+
+	if (!r->started) { //all the buffers get a read
+		for (int b = 0; b < URING_BUFFERS; b++)
+			uring_refill(r, b);
+		r->started = 1;
+	}
+	int filled = uring_wait_current(r);
+	if (filled == URING_BUFFER_BYTES && r->pos == filled) {
+		//the previous record ended the buffer: now that its data is not in use the buffer reads the next part of the file
+		uring_refill(r, r->current % URING_BUFFERS);
+		r->current++;
+		r->pos = 0;
+		filled = uring_wait_current(r);
+	}
+	if (filled < 0)
+		return -1;
+	if (r->pos == filled) //a last buffer shorter than the others, or no buffer at all past the end
+		return -2;
+	struct uring_buffer *buf = &r->buffer[r->current % URING_BUFFERS];
+	unsigned int record[4];
+	if (r->pos + 16 <= filled) { //the usual case: header and data in the buffer, no copy
+		memcpy(record, buf->data + r->pos, 16);
+		if (!reader_record_header(r, record))
+			return -1;
+		if (r->pos + 16 + (int)r->header.caplen <= filled) {
+			*header = &r->header;
+			*data = (const unsigned char *)buf->data + r->pos + 16;
+			r->pos += 16 + r->header.caplen;
+			return 1;
+		}
+	}
+	// the record spans two buffers
+	if (uring_copy(r, (char *)record, 16) <= 0 || !reader_record_header(r, record))
+		return -1;
+	if (uring_copy(r, r->stitch, r->header.caplen) <= 0)
+		return -1;
+	*header = &r->header;
+	*data = (const unsigned char *)r->stitch;
+	return 1;
+}
+
+void reader_close(struct capture_reader *r) {
+	if (r->kind == READER_PCAP)
+		pcap_close(r->pcap);
+	else if (r->kind == READER_MMAP) {
+		munmap(r->map, r->size);
+		close(r->fd);
+	}
+	else {
+		if (r->started) //the kernel must not write into the buffers after they are freed
+			for (int b = 0; b < URING_BUFFERS; b++)
+				while (!r->buffer[b].done && uring_reap(r, 1) == 0)
+					;
+		uring_free(&r->ring);
+		for (int b = 0; b < URING_BUFFERS; b++)
+			free(r->buffer[b].data);
+		free(r->stitch);
+		close(r->fd);
+	}
+	free(r);
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+* Library that contain the functions used to scan a single big buffer with many threads:
+* the buffer is cut into chunks that overlap by max_pattern_len-1 bytes and a match is
+* counted only by the chunk where it starts, so matches in the overlap are never counted twice
+*/
+#ifndef _CHUNKED_SCAN_H_
+#define _CHUNKED_SCAN_H_
+
+#include <string.h>
+
+/* Default size of a chunk: big enough to make the overlap negligible, small enough to spread a 64KB payload */
+#define DEFAULT_CHUNK_BYTES 16384
+
+/* Function use to count the occurrences of pattern that start in text[0, own_len)
+* INPUT:
+*	text: the text, not necessarily NUL terminated
+	scan_len: bytes of text that can be read, own_len plus the overlap with the next chunk
+	pattern, pattern_len, prefix_array: the pattern and its kmp_prefix array
+	own_len: only matches starting before own_len belong to this chunk
+
+* OUTPUT
+	number of occurrences, overlapping ones included as kmp_matcher does
+*/
+int kmp_matcher_range(const char *text, int scan_len, const char *pattern, int pattern_len, const int *prefix_array, int own_len) {
+	if (scan_len < pattern_len) //no point trying to match things
+		return 0;
+	int i = 0;
+	int j = 0;
+	int occurrences = 0;
+	while (i < scan_len) {
+		if (pattern[j] == text[i]) {
+			j++;
+			i++;
+		}
+		if (j == pattern_len) { //we have a match, starting at i - pattern_len
+			if (i - pattern_len < own_len)
+				occurrences++;
+			else //every later match starts later too
+				return occurrences;
+			j = prefix_array[j-1]; //look for next match
+		}
+		else if (i < scan_len && pattern[j] != text[i]) {
+			if (j != 0)
+				j = prefix_array[j-1];
+			else
+				i++;
+		}
+	}
+	return occurrences;
+}
+
+/* Function use to get the number of chunks a buffer of text_len bytes is cut into */
+int chunk_count(int text_len, int chunk_bytes) {
+	return (text_len + chunk_bytes - 1) / chunk_bytes;
+}
+
+/* Function use to get where chunk c of a text_len bytes buffer starts, how many bytes it owns
+ * and how many it has to read, the own bytes plus max_pattern_len-1 bytes of the next chunk */
+void chunk_bounds(int text_len, int c, int chunk_bytes, int max_pattern_len, int *start, int *own_len, int *scan_len) {
+	*start = c * chunk_bytes;
+	*own_len = text_len - *start < chunk_bytes ? text_len - *start : chunk_bytes;
+	*scan_len = *own_len + max_pattern_len - 1;
+	if (*start + *scan_len > text_len)
+		*scan_len = text_len - *start;
+}
+
+/* Function use to count the matches of every string into string_count for the chunk number c of text
+* INPUT:
+*	text, text_len: the whole buffer
+	c: chunk to scan, from 0 to chunk_count(text_len, chunk_bytes)-1
+	chunk_bytes: size of a chunk without the overlap
+	array_of_strings, prefix_array, array_of_strings_length: the patterns and their KMP prefix arrays
+	max_pattern_len: length of the longest string, the chunk reads max_pattern_len-1 bytes past its end
+	string_count: counters of the caller, usually private to its thread
+*/
+void match_chunk(const char *text, int text_len, int c, int chunk_bytes, char **array_of_strings, int **prefix_array, int array_of_strings_length, int max_pattern_len, int *string_count) {
+	int start, own_len, scan_len;
+	chunk_bounds(text_len, c, chunk_bytes, max_pattern_len, &start, &own_len, &scan_len);
+	for (int i = 0; i < array_of_strings_length; i++)
+		string_count[i] += kmp_matcher_range(text + start, scan_len, array_of_strings[i], strlen(array_of_strings[i]), prefix_array[i], own_len);
+}
+
+/* Function use to get the length of the longest string, the overlap between chunks is one byte less */
+int max_string_length(char **array_of_strings, int array_of_strings_length) {
+	int max = 1;
+	for (int i = 0; i < array_of_strings_length; i++)
+		if ((int)strlen(array_of_strings[i]) > max)
+			max = strlen(array_of_strings[i]);
+	return max;
+}
+
+#endif
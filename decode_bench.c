@@ -0,0 +1,147 @@
+/* 	Compilation: gcc -g -Wall -O2 decode_bench.c -o decode_bench -lpcap -lz
+	Usage: ./decode_bench <file.pcap> [tcp/udp] [repeats=<n>]
+	Times the decoding of the headers alone, without reading and without matching: the packets of the
+	captures are loaded in memory first, then every repeat decodes all of them once with
+	dump_UDP_packet/dump_TCP_packet (packet_dumping.h), once with them and flow_hash (the fields of the
+	descriptor table that they do not give) and once with decode_batch (packet_decode.h), DECODE_BATCH
+	packets at a time. The best repeat of each is printed in ns and Mpackets per second, with the number
+	of packets on which the decoders give a different payload (it must be 0).
+	<file.pcap> can also be a directory, a glob pattern or @list, or gzip-compressed (input_files.h)
+ */
+
+#define _GNU_SOURCE //fopencookie, see gz_capture.h
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pcap.h>
+#include <netinet/ip.h>
+#include <netinet/if_ether.h>
+#include "timer.h"
+#include "packet_dumping.h"
+#include "packet_decode.h"
+#include "input_files.h"
+
+#define UDP 0
+#define TCP 1
+
+#define DEFAULT_REPEATS 10
+
+int main(int argc, char *argv[]) {
+	char errbuf[PCAP_ERRBUF_SIZE];
+	struct pcap_pkthdr *header;
+	const unsigned char *packet;
+	int packet_type = UDP; //default udp
+	int repeats = DEFAULT_REPEATS;
+
+	if (argc < 2) {
+		printf("USAGE: ./decode_bench <file.pcap> [tcp/udp] [repeats=<n>]\n");
+		exit(1);
+	}
+	for (int a = 2; a < argc; a++) {
+		if (strcmp(argv[a], "udp") == 0)
+			packet_type = UDP;
+		else if (strcmp(argv[a], "tcp") == 0)
+			packet_type = TCP;
+		else if (strncmp(argv[a], "repeats=", 8) == 0 && atoi(argv[a] + 8) > 0)
+			repeats = atoi(argv[a] + 8);
+		else {
+			printf("USAGE ./decode_bench <file.pcap> [tcp/udp] [repeats=<n>]\n");
+			exit(1);
+		}
+	}
+
+	/* All the packets in memory, so that only the decoding is timed */
+	struct input_files files;
+	if (input_files_expand(argv[1], &files) == 0)
+		exit(1);
+	struct input_stream *in = input_stream_open(&files, READER_PCAP, errbuf);
+	if (in == NULL) {
+		fprintf(stderr, "error reading pcap file: %s\n", errbuf);
+		exit(1);
+	}
+	int packet_count = 0, capacity = 1024;
+	struct packet_record *records = malloc(capacity*sizeof(struct packet_record));
+	while (input_next_ex(in, &header, &packet) >= 0) {
+		if (packet_count == capacity) {
+			capacity *= 2;
+			records = realloc(records, capacity*sizeof(struct packet_record));
+		}
+		records[packet_count].data = malloc(header->caplen);
+		memcpy(records[packet_count].data, packet, header->caplen);
+		records[packet_count].len = header->caplen;
+		packet_count++;
+	}
+	input_stream_close(in);
+	input_files_free(&files);
+	if (packet_count == 0) {
+		printf("no packets in %s\n", argv[1]);
+		exit(1);
+	}
+
+	char **payloads = malloc(packet_count*sizeof(char *)); //what dump_*_packet returns, to compare
+	unsigned int *lengths = malloc(packet_count*sizeof(unsigned int));
+	struct packet_descriptors descriptors = {0};
+	descriptors_reserve(&descriptors, packet_count);
+	int protocol = packet_type == UDP ? IPPROTO_UDP : IPPROTO_TCP;
+	unsigned int *flows = malloc(packet_count*sizeof(unsigned int));
+	double best_scalar = 0, best_flow = 0, best_batch = 0;
+
+	for (int r = 0; r < repeats; r++) {
+		double start, finish;
+		GET_TIME(start);
+		for (int k = 0; k < packet_count; k++) {
+			lengths[k] = 0;
+			if (packet_type == UDP)
+				payloads[k] = dump_UDP_packet((char *)records[k].data, &lengths[k], records[k].len);
+			else
+				payloads[k] = dump_TCP_packet((char *)records[k].data, &lengths[k], records[k].len);
+		}
+		GET_TIME(finish);
+		if (r == 0 || finish - start < best_scalar)
+			best_scalar = finish - start;
+
+		GET_TIME(start);
+		for (int k = 0; k < packet_count; k++) {
+			lengths[k] = 0;
+			if (packet_type == UDP)
+				payloads[k] = dump_UDP_packet((char *)records[k].data, &lengths[k], records[k].len);
+			else
+				payloads[k] = dump_TCP_packet((char *)records[k].data, &lengths[k], records[k].len);
+			flows[k] = flow_hash(records[k].data, records[k].len);
+		}
+		GET_TIME(finish);
+		if (r == 0 || finish - start < best_flow)
+			best_flow = finish - start;
+
+		GET_TIME(start);
+		for (int first = 0; first < packet_count; first += DECODE_BATCH)
+			decode_batch(&descriptors, first, records + first, packet_count - first < DECODE_BATCH ? packet_count - first : DECODE_BATCH);
+		GET_TIME(finish);
+		if (r == 0 || finish - start < best_batch)
+			best_batch = finish - start;
+	}
+
+	int different = 0; //the two decoders must give the same payloads
+	for (int k = 0; k < packet_count; k++) {
+		unsigned int len = 0;
+		char *payload = descriptor_payload(&descriptors, k, records[k].data, protocol, &len);
+		if (payload != payloads[k] || (payload != NULL && len != lengths[k]))
+			different++;
+	}
+
+	printf("Packets = %d, best of %d repeats\n", packet_count, repeats);
+	printf("Decoder\tns/packet\tMpackets/s\n");
+	printf("%s\t%.2f\t%.1f\n", packet_type == UDP ? "dump_UDP_packet" : "dump_TCP_packet", 1e9 * best_scalar / packet_count, packet_count / best_scalar / 1e6);
+	printf("%s + flow_hash\t%.2f\t%.1f\n", packet_type == UDP ? "dump_UDP_packet" : "dump_TCP_packet", 1e9 * best_flow / packet_count, packet_count / best_flow / 1e6);
+	printf("decode_batch\t%.2f\t%.1f\n", 1e9 * best_batch / packet_count, packet_count / best_batch / 1e6);
+	printf("Different payloads = %d\n", different);
+
+	for (int k = 0; k < packet_count; k++)
+		free(records[k].data);
+	free(records);
+	free(payloads);
+	free(lengths);
+	free(flows);
+	descriptors_free(&descriptors);
+	return different > 0;
+}
@@ -0,0 +1,39 @@
+/*
+* Library that contain the hash of the flow of a packet (addresses, protocol and ports), the same
+* for both directions of the flow
+*/
+#ifndef _FLOW_HASH_H_
+#define _FLOW_HASH_H_
+
+#include <netinet/ip.h>
+#include <netinet/if_ether.h>
+
+/* Function use to get the hash of a flow from its fields, already taken out of the packet (packet_decode.h) */
+static inline unsigned int flow_hash_fields(unsigned int a, unsigned int b, unsigned int sport, unsigned int dport, unsigned int protocol) {
+	unsigned int ports = sport < dport ? sport << 16 | dport : dport << 16 | sport;
+	unsigned long long h = (a < b ? (unsigned long long)a << 32 | b : (unsigned long long)b << 32 | a);
+	h ^= (unsigned long long)ports * 0x9e3779b97f4a7c15ULL ^ protocol;
+	h ^= h >> 33; //murmur3 finalizer
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb93fe53a8749ULL;
+	h ^= h >> 33;
+	return (unsigned int)h;
+}
+
+/* Function use to get the hash of the flow of an ethernet packet, 0 if it is too short to have an IP header */
+unsigned int flow_hash(const unsigned char *packet, unsigned int caplen) {
+	if (caplen < sizeof(struct ether_header) + sizeof(struct ip))
+		return 0;
+	const struct ip *ip = (const struct ip *)(packet + sizeof(struct ether_header));
+	unsigned int ip_header_length = ip->ip_hl * 4;
+	unsigned int sport = 0, dport = 0;
+	if (caplen >= sizeof(struct ether_header) + ip_header_length + 4) { //tcp and udp start with the two ports
+		const unsigned char *l4 = packet + sizeof(struct ether_header) + ip_header_length;
+		sport = l4[0] << 8 | l4[1];
+		dport = l4[2] << 8 | l4[3];
+	}
+	return flow_hash_fields(ip->ip_src.s_addr, ip->ip_dst.s_addr, sport, dport, ip->ip_p);
+}
+
+#endif
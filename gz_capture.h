@@ -0,0 +1,306 @@
+/*
+* Library that contain the reading of gzip-compressed captures (.pcap.gz) without decompressing them to
+* disk: the decompressed bytes are produced by a pipeline stage of their own, one or more threads that
+* fill a bounded ring of GZ_SLOTS blocks, and libpcap reads them in order through a FILE opened with
+* fopencookie, so the matching goes on while the next blocks are decompressed.
+* A BGZF file (bgzip, or any multi-member gzip whose members carry the BC extra field with their size)
+* can be split into members without decompressing it: the members are handed out in order to
+* gz_threads() workers and decompressed in parallel. Any other gzip file (multi-member ones too) is
+* decompressed by a single thread with gzread.
+*
+* fopencookie is a GNU extension: _GNU_SOURCE has to be defined before the first include of the program.
+*
+* Usage:
+*	pcap_t *pcap = capture_open_offline(path, errbuf);	// a plain or a gzip-compressed capture
+*/
+#ifndef _GZ_CAPTURE_H_
+#define _GZ_CAPTURE_H_
+
+#ifndef _GNU_SOURCE
+#error "gz_capture.h needs _GNU_SOURCE defined before the first include (fopencookie)"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <pcap.h>
+
+#define GZ_SLOTS 64			// decompressed blocks that can wait for the reader
+#define GZ_BLOCK (256 << 10)		// size of a block when the file is decompressed by a single thread
+#define GZ_MAX_THREADS 8
+#define BGZF_HEADER 18			// gzip header with the BC extra field, the member size is in the last 2 bytes
+
+struct gz_slot {
+	char *data;
+	size_t len, capacity;
+	long long block;	// block held by the slot, -1 if free, -2 while a worker fills it
+};
+
+struct gz_reader {
+	int fd;				// the compressed file
+	int bgzf;			// 1: parallel BGZF members, 0: a single gzread thread
+	gzFile gz;			// the single thread stream
+	struct gz_slot slot[GZ_SLOTS];	// block k goes to slot k % GZ_SLOTS
+	long long next_block;		// first block no worker has taken yet
+	long long next_offset;		// BGZF: offset of the member of next_block
+	long long last_block;		// number of good blocks of the file, -1 until the end (or an error) is found
+	long long read_block;		// block the reader is reading
+	size_t read_pos;		// bytes of read_block already read
+	int error, stop;
+	int threads;
+	pthread_t worker[GZ_MAX_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/* Function use to know how many threads decompress a BGZF file: the cores but one, the reader needs one */
+int gz_threads() {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cores > GZ_MAX_THREADS + 1)
+		return GZ_MAX_THREADS;
+	return cores > 2 ? cores - 1 : 1;
+}
+
+/* Function use to read the size of the BGZF member at offset
+* OUTPUT
+	size of the member in bytes, 0 at the end of the file, -1 if it is not a BGZF member
+*/
+long gz_bgzf_member_size(int fd, long long offset) {
+	unsigned char h[BGZF_HEADER];
+	ssize_t n = pread(fd, h, BGZF_HEADER, offset);
+	if (n == 0)
+		return 0;
+	if (n != BGZF_HEADER || h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 || !(h[3] & 4) ||
+			h[10] != 6 || h[11] != 0 || h[12] != 'B' || h[13] != 'C' || h[14] != 2 || h[15] != 0)
+		return -1;
+	return (h[16] | h[17] << 8) + 1;
+}
+
+/* Function use to wait, with the lock held, for the slot of the next block to be free and take that block
+* OUTPUT
+	the block, -1 if the reader has stopped or the end of the file has been found
+*/
+static long long gz_take_block(struct gz_reader *r) {
+	while (!r->stop && r->last_block < 0 && r->slot[r->next_block % GZ_SLOTS].block != -1)
+		pthread_cond_wait(&r->cond, &r->lock);
+	if (r->stop || r->last_block >= 0)
+		return -1;
+	r->slot[r->next_block % GZ_SLOTS].block = -2;
+	return r->next_block;
+}
+
+/* Function use to publish a decompressed block (block >= 0), or that the file ends (or is corrupted) at
+ * block end (end >= 0) */
+static void gz_publish(struct gz_reader *r, long long block, long long end, int error) {
+	pthread_mutex_lock(&r->lock);
+	if (block >= 0)
+		r->slot[block % GZ_SLOTS].block = block;
+	if (end >= 0) {
+		r->slot[end % GZ_SLOTS].block = -1;
+		if (r->last_block < 0 || end < r->last_block)
+			r->last_block = end;
+	}
+	if (error)
+		r->error = 1;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* Body of a BGZF worker: take the next member, decompress it into its slot, repeat */
+void *gz_bgzf_worker(void *arg) {
+	struct gz_reader *r = arg;
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	inflateInit2(&z, 15 + 16); //gzip wrapper
+	unsigned char *in = NULL;
+	size_t in_capacity = 0;
+	while (1) {
+		pthread_mutex_lock(&r->lock);
+		long long block = gz_take_block(r);
+		long size = 0;
+		if (block >= 0)
+			size = gz_bgzf_member_size(r->fd, r->next_offset);
+		if (block < 0) { //end of the file found by another worker, or stop
+			pthread_mutex_unlock(&r->lock);
+			break;
+		}
+		if (size <= 0) { //end of the file, or not BGZF past this point
+			pthread_mutex_unlock(&r->lock);
+			gz_publish(r, -1, block, size < 0);
+			break;
+		}
+		long long offset = r->next_offset;
+		r->next_offset += size;
+		r->next_block++;
+		struct gz_slot *s = &r->slot[block % GZ_SLOTS];
+		pthread_mutex_unlock(&r->lock);
+
+		if ((size_t)size > in_capacity) {
+			in_capacity = size;
+			in = realloc(in, in_capacity);
+		}
+		unsigned int isize = 0;
+		int ok = pread(r->fd, in, size, offset) == size;
+		if (ok)
+			memcpy(&isize, in + size - 4, 4); //uncompressed size, little endian
+		if (ok && (s->data == NULL || isize > s->capacity)) { //inflate wants somewhere to write even for an empty member
+			s->capacity = isize > 0 ? isize : 1;
+			s->data = realloc(s->data, s->capacity);
+		}
+		inflateReset(&z);
+		z.next_in = in;
+		z.avail_in = size;
+		z.next_out = (unsigned char *)s->data;
+		z.avail_out = isize;
+		ok = ok && inflate(&z, Z_FINISH) == Z_STREAM_END && z.avail_out == 0;
+		s->len = isize;
+		if (!ok) {
+			gz_publish(r, -1, block, 1);
+			break;
+		}
+		gz_publish(r, block, -1, 0);
+	}
+	inflateEnd(&z);
+	free(in);
+	return NULL;
+}
+
+/* Body of the single decompressor: gzread blocks of GZ_BLOCK bytes, one after the other */
+void *gz_stream_worker(void *arg) {
+	struct gz_reader *r = arg;
+	while (1) {
+		pthread_mutex_lock(&r->lock);
+		long long block = gz_take_block(r);
+		pthread_mutex_unlock(&r->lock);
+		if (block < 0)
+			break;
+		struct gz_slot *s = &r->slot[block % GZ_SLOTS];
+		if (s->capacity < GZ_BLOCK) {
+			s->capacity = GZ_BLOCK;
+			s->data = realloc(s->data, s->capacity);
+		}
+		int n = gzread(r->gz, s->data, GZ_BLOCK);
+		if (n <= 0) {
+			gz_publish(r, -1, block, n < 0);
+			break;
+		}
+		s->len = n;
+		pthread_mutex_lock(&r->lock);
+		r->next_block++;
+		pthread_mutex_unlock(&r->lock);
+		gz_publish(r, block, -1, 0);
+	}
+	return NULL;
+}
+
+/* Read function of the cookie: copy from the slots in block order, freeing every slot once it is read */
+ssize_t gz_cookie_read(void *cookie, char *buffer, size_t size) {
+	struct gz_reader *r = cookie;
+	size_t done = 0;
+	pthread_mutex_lock(&r->lock);
+	while (done < size) {
+		struct gz_slot *s = &r->slot[r->read_block % GZ_SLOTS];
+		while (s->block != r->read_block && (r->last_block < 0 || r->read_block < r->last_block))
+			pthread_cond_wait(&r->cond, &r->lock);
+		if (s->block != r->read_block) //end of the file, or of its good part
+			break;
+		pthread_mutex_unlock(&r->lock); //the slot is ours until we free it
+		size_t n = s->len - r->read_pos < size - done ? s->len - r->read_pos : size - done;
+		memcpy(buffer + done, s->data + r->read_pos, n);
+		done += n;
+		r->read_pos += n;
+		pthread_mutex_lock(&r->lock);
+		if (r->read_pos == s->len) {
+			s->block = -1;
+			r->read_block++;
+			r->read_pos = 0;
+			pthread_cond_broadcast(&r->cond);
+		}
+	}
+	int error = r->error && done == 0;
+	pthread_mutex_unlock(&r->lock);
+	if (error)
+		fprintf(stderr, "error decompressing the capture: corrupted gzip data\n");
+	return error ? -1 : (ssize_t)done;
+}
+
+int gz_cookie_close(void *cookie) {
+	struct gz_reader *r = cookie;
+	pthread_mutex_lock(&r->lock);
+	r->stop = 1;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	for (int t = 0; t < r->threads; t++)
+		pthread_join(r->worker[t], NULL);
+	for (int k = 0; k < GZ_SLOTS; k++)
+		free(r->slot[k].data);
+	if (r->gz != NULL)
+		gzclose(r->gz); //closes fd too
+	else
+		close(r->fd);
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+	free(r);
+	return 0;
+}
+
+/* Function use to open a gzip-compressed file as a FILE of its decompressed bytes, the decompressor
+ * threads start right away
+* OUTPUT
+	the FILE, NULL if the file cannot be opened
+*/
+FILE *gz_fopen(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct gz_reader *r = calloc(1, sizeof(struct gz_reader));
+	r->fd = fd;
+	r->last_block = -1;
+	for (int k = 0; k < GZ_SLOTS; k++)
+		r->slot[k].block = -1;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	r->bgzf = gz_bgzf_member_size(fd, 0) > 0;
+	if (!r->bgzf) {
+		r->gz = gzdopen(fd, "rb");
+		gzbuffer(r->gz, GZ_BLOCK);
+	}
+	r->threads = r->bgzf ? gz_threads() : 1;
+	for (int t = 0; t < r->threads; t++)
+		if (pthread_create(&r->worker[t], NULL, r->bgzf ? gz_bgzf_worker : gz_stream_worker, r) != 0) {
+			perror("error starting the decompressor: ");
+			exit(1);
+		}
+	cookie_io_functions_t io = {gz_cookie_read, NULL, NULL, gz_cookie_close};
+	return fopencookie(r, "r", io);
+}
+
+/* Function use to open a capture for reading, gzip-compressed or not (it looks at the first two bytes)
+* OUTPUT
+	the pcap handle, NULL with the reason in errbuf
+*/
+pcap_t *capture_open_offline(const char *path, char *errbuf) {
+	unsigned char magic[2] = {0, 0};
+	FILE *f = fopen(path, "rb");
+	if (f != NULL) {
+		if (fread(magic, 1, 2, f) != 2)
+			magic[0] = 0;
+		fclose(f);
+	}
+	if (magic[0] != 0x1f || magic[1] != 0x8b)
+		return pcap_open_offline(path, errbuf);
+	FILE *gz = gz_fopen(path);
+	if (gz == NULL) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: cannot open", path);
+		return NULL;
+	}
+	pcap_t *pcap = pcap_fopen_offline(gz, errbuf);
+	if (pcap == NULL)
+		fclose(gz);
+	return pcap;
+}
+
+#endif
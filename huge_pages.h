@@ -0,0 +1,165 @@
+/*
+* Library that contain the huge page backed memory of the scans: the packet and payload arenas and the
+* transition tables of the automata are the memory the matchers walk through at random, with 4 KB pages
+* they miss the dTLB all the time. huge_alloc asks for 2 MB pages in this order:
+*	MAP_HUGETLB	pages reserved by the administrator (vm.nr_hugepages)
+*	THP		an aligned anonymous mapping with madvise(MADV_HUGEPAGE), the kernel backs it with
+*			transparent huge pages when it can (transparent_hugepage/enabled at madvise or always)
+*	4 KB pages	the same mapping when THP is disabled, nothing else changes
+* huge_advise asks for THP on memory that is mapped already (the mmap of the capture, numa arenas).
+* The report tells how many bytes got each kind and how much of the memory of the process is really
+* in huge pages (AnonHugePages/FilePmdMapped of /proc/self/smaps_rollup).
+*
+* Usage:
+*	struct huge_arena arena = {0}; char *p = huge_arena_alloc(&arena, len); huge_arena_reset(&arena);
+*	huge_move(&ac->next, ac_table_bytes(ac->state_count));	// a malloc'ed table into huge pages
+*	huge_print(); ... huge_free(ac->next);
+*/
+#ifndef _HUGE_PAGES_H_
+#define _HUGE_PAGES_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE_BYTES (2UL << 20)
+#define HUGE_ARENA_BLOCK (8UL << 20)	// bytes the arenas ask at a time, 4 huge pages
+
+#define HUGE_TLB 0		// MAP_HUGETLB
+#define HUGE_THP 1		// madvise(MADV_HUGEPAGE)
+#define HUGE_SMALL 2	// neither, 4 KB pages
+
+struct huge_region {
+	char *addr;
+	size_t bytes;
+};
+
+static struct huge_region *huge_regions;	// every mapping of huge_alloc, for huge_free
+static int huge_region_count, huge_region_capacity;
+static size_t huge_bytes[3];			// bytes given out of each kind
+static pthread_mutex_t huge_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t huge_round(size_t bytes) {
+	return (bytes + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+}
+
+/* Function use to ask for transparent huge pages on the 2 MB aligned part of memory that is mapped already
+* OUTPUT
+	1 if the kernel took the advice
+*/
+int huge_advise(void *addr, size_t bytes) {
+	unsigned long start = ((unsigned long)addr + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+	unsigned long end = ((unsigned long)addr + bytes) & ~(HUGE_PAGE_BYTES - 1);
+	int ok = end > start && madvise((void *)start, end - start, MADV_HUGEPAGE) == 0;
+	pthread_mutex_lock(&huge_lock);
+	huge_bytes[ok ? HUGE_THP : HUGE_SMALL] += bytes;
+	pthread_mutex_unlock(&huge_lock);
+	return ok;
+}
+
+/* Function use to get bytes of memory in huge pages if the system gives them, in 4 KB pages otherwise
+* OUTPUT
+	the memory, 2 MB aligned and zeroed; exit if there is no memory at all
+*/
+void *huge_alloc(size_t bytes) {
+	size_t size = huge_round(bytes > 0 ? bytes : 1);
+	int kind = HUGE_TLB;
+	char *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (m == MAP_FAILED) { //no reserved pages: one page more, to cut an aligned mapping out of it
+		kind = HUGE_THP;
+		char *raw = mmap(NULL, size + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == MAP_FAILED) {
+			perror("huge_alloc: mmap");
+			exit(1);
+		}
+		m = (char *)(((unsigned long)raw + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1));
+		if (m > raw)
+			munmap(raw, m - raw);
+		munmap(m + size, raw + HUGE_PAGE_BYTES - m);
+		if (madvise(m, size, MADV_HUGEPAGE) != 0)
+			kind = HUGE_SMALL;
+	}
+	pthread_mutex_lock(&huge_lock);
+	if (huge_region_count == huge_region_capacity) {
+		huge_region_capacity = huge_region_capacity ? huge_region_capacity * 2 : 64;
+		huge_regions = realloc(huge_regions, huge_region_capacity * sizeof(struct huge_region));
+	}
+	huge_regions[huge_region_count].addr = m;
+	huge_regions[huge_region_count++].bytes = size;
+	huge_bytes[kind] += size;
+	pthread_mutex_unlock(&huge_lock);
+	return m;
+}
+
+/* Function use to give back memory of huge_alloc, NULL is ignored */
+void huge_free(void *addr) {
+	if (addr == NULL)
+		return;
+	pthread_mutex_lock(&huge_lock);
+	for (int k = 0; k < huge_region_count; k++)
+		if (huge_regions[k].addr == addr) {
+			munmap(addr, huge_regions[k].bytes);
+			huge_regions[k] = huge_regions[--huge_region_count];
+			break;
+		}
+	pthread_mutex_unlock(&huge_lock);
+}
+
+/* Function use to move a table of bytes bytes allocated with malloc into huge_alloc memory */
+void huge_move(void *table, size_t bytes) {
+	void **t = table;
+	void *copy = huge_alloc(bytes);
+	memcpy(copy, *t, bytes);
+	free(*t);
+	*t = copy;
+}
+
+/* Bump allocator of huge_alloc blocks, freed all at once */
+struct huge_arena {
+	char **blocks;
+	int count, capacity;
+	size_t used, size;	// of the last block
+};
+
+char *huge_arena_alloc(struct huge_arena *a, size_t len) {
+	if (a->count == 0 || a->used + len > a->size) {
+		if (a->count == a->capacity) {
+			a->capacity = a->capacity ? a->capacity * 2 : 16;
+			a->blocks = realloc(a->blocks, a->capacity * sizeof(char *));
+		}
+		a->size = len > HUGE_ARENA_BLOCK ? huge_round(len) : HUGE_ARENA_BLOCK;
+		a->blocks[a->count++] = huge_alloc(a->size);
+		a->used = 0;
+	}
+	char *m = a->blocks[a->count - 1] + a->used;
+	a->used += (len + 15) & ~(size_t)15;
+	return m;
+}
+
+void huge_arena_reset(struct huge_arena *a) {
+	for (int k = 0; k < a->count; k++)
+		huge_free(a->blocks[k]);
+	free(a->blocks);
+	memset(a, 0, sizeof(*a));
+}
+
+/* Function use to print how the memory asked for huge pages has been backed */
+void huge_print(void) {
+	unsigned long long anon = 0, file = 0, value;
+	char name[64];
+	FILE *f = fopen("/proc/self/smaps_rollup", "r");
+	while (f != NULL && fscanf(f, "%63s", name) == 1) {
+		if (strcmp(name, "AnonHugePages:") == 0 && fscanf(f, "%llu", &value) == 1)
+			anon = value;
+		else if (strcmp(name, "FilePmdMapped:") == 0 && fscanf(f, "%llu", &value) == 1)
+			file = value;
+	}
+	if (f != NULL)
+		fclose(f);
+	printf("Huge pages: %.1f MB MAP_HUGETLB, %.1f MB THP advised, %.1f MB fell back to 4 KB pages; in huge pages now: %.1f MB anonymous, %.1f MB of files\n",
+		huge_bytes[HUGE_TLB] / 1048576.0, huge_bytes[HUGE_THP] / 1048576.0, huge_bytes[HUGE_SMALL] / 1048576.0, anon / 1024.0, file / 1024.0);
+}
+
+#endif
@@ -0,0 +1,180 @@
+/*
+* Library that contain the sidecar state of incremental scans: captures that tcpdump keeps appending
+* to are scanned again and again with the same strings, so after a scan <file.pcap>.state records
+* which file it was (device, inode and a hash of its first processed bytes), which strings and packet type
+* (hash of them), the offset right after the last record read whole, and the counts so far.
+* The next scan checks all of it, seeks to the offset and reads only the records appended since,
+* the totals it prints are the saved counts plus the new ones.
+* Only the classic pcap format is supported, a pcapng file is always scanned from the start.
+*
+* Usage:
+*	struct scan_state state;
+*	if (state_load(filepath, pattern_set_hash(strings, n, packet_type), n, &state))
+*		fseek(pcap_file(pcap), state.offset, SEEK_SET);	// state.counts has the totals so far
+*	... state.offset += PCAP_RECORD_HEADER + header->caplen for every record read ...
+*	state_save(filepath, &state);
+*/
+#ifndef _INCREMENTAL_STATE_H_
+#define _INCREMENTAL_STATE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define STATE_VERSION 1
+#define STATE_HEAD_BYTES 4096		// bytes hashed to recognise the file, a rotated capture has other first packets
+#define PCAP_GLOBAL_HEADER 24
+#define PCAP_RECORD_HEADER 16
+
+struct scan_state {
+	unsigned long long dev, ino;	// identity of the file
+	unsigned long long head_hash;	// hash of its first head_len bytes
+	long head_len;			// bytes hashed, at most STATE_HEAD_BYTES and never past offset
+	unsigned long long pattern_hash;	// hash of the strings and of the packet type
+	long offset;			// first byte not processed yet
+	long long packets;		// records processed so far
+	int strings_count;
+	long long *counts;		// per string totals so far
+};
+
+/* Function use to hash n bytes, FNV-1a */
+unsigned long long state_hash(const void *data, size_t n, unsigned long long h) {
+	const unsigned char *p = data;
+	for (size_t i = 0; i < n; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+#define STATE_HASH_SEED 0xcbf29ce484222325ULL
+
+/* Function use to hash the strings, in order, and the packet type: a change of any of them needs a full scan */
+unsigned long long pattern_set_hash(char **array_of_strings, int array_of_strings_length, int packet_type) {
+	unsigned long long h = state_hash(&packet_type, sizeof(packet_type), STATE_HASH_SEED);
+	for (int i = 0; i < array_of_strings_length; i++)
+		h = state_hash(array_of_strings[i], strlen(array_of_strings[i]) + 1, h); //the NUL separates the strings
+	return h;
+}
+
+/* Function use to fill the identity of the file (device, inode) and check that it is a classic pcap file
+* OUTPUT
+	size of the file, -1 if it cannot be read or it is not a classic pcap file
+*/
+long state_identity(const char *pcap_path, struct scan_state *s) {
+	struct stat st;
+	FILE *f = fopen(pcap_path, "rb");
+	if (f == NULL || fstat(fileno(f), &st) != 0) {
+		if (f != NULL)
+			fclose(f);
+		return -1;
+	}
+	unsigned int magic = 0;
+	size_t n = fread(&magic, 1, 4, f);
+	fclose(f);
+	if (n != 4 || st.st_size < PCAP_GLOBAL_HEADER || (magic != 0xa1b2c3d4 && magic != 0xd4c3b2a1 && magic != 0xa1b23c4d && magic != 0x4d3cb2a1))
+		return -1;
+	s->dev = st.st_dev;
+	s->ino = st.st_ino;
+	return st.st_size;
+}
+
+/* Function use to hash the first len bytes of the file, 0 if it is shorter */
+unsigned long long state_head_hash(const char *pcap_path, long len) {
+	unsigned char head[STATE_HEAD_BYTES];
+	FILE *f = fopen(pcap_path, "rb");
+	if (f == NULL)
+		return 0;
+	size_t n = fread(head, 1, len, f);
+	fclose(f);
+	return n == (size_t)len ? state_hash(head, len, STATE_HASH_SEED) : 0;
+}
+
+/* Function use to read <pcap_path>.state and check that the scan can go on from it
+* INPUT:
+*	pcap_path: the capture
+	pattern_hash: pattern_set_hash of this run
+	strings_count: number of strings of this run
+	s: filled with the saved state when it can be used, with a fresh one (offset after the global header,
+		zero counts) otherwise; in both cases ready to be updated and given to state_save
+* OUTPUT
+	1 if the scan can resume from s->offset, 0 if it has to start from the beginning
+*/
+int state_load(const char *pcap_path, unsigned long long pattern_hash, int strings_count, struct scan_state *s) {
+	memset(s, 0, sizeof(*s));
+	s->pattern_hash = pattern_hash;
+	s->strings_count = strings_count;
+	s->counts = calloc(strings_count, sizeof(long long));
+	s->offset = PCAP_GLOBAL_HEADER;
+	long size = state_identity(pcap_path, s);
+	if (size < 0) {
+		printf("Incremental scan: %s is not a classic pcap file, scanning all of it\n", pcap_path);
+		s->offset = -1;
+		return 0;
+	}
+
+	char state_path[4096];
+	snprintf(state_path, sizeof(state_path), "%s.state", pcap_path);
+	FILE *f = fopen(state_path, "r");
+	if (f == NULL) //first scan of this file
+		return 0;
+	int version, saved_strings;
+	struct scan_state saved;
+	const char *reason = NULL;
+	if (fscanf(f, "pcap_string_matching_state %d %llu %llu %llx %ld %llx %ld %lld %d", &version, &saved.dev, &saved.ino,
+			&saved.head_hash, &saved.head_len, &saved.pattern_hash, &saved.offset, &saved.packets, &saved_strings) != 9
+			|| version != STATE_VERSION || saved.head_len < 0 || saved.head_len > STATE_HEAD_BYTES)
+		reason = "state file not readable";
+	else if (saved.dev != s->dev || saved.ino != s->ino || saved.head_hash != state_head_hash(pcap_path, saved.head_len))
+		reason = "the capture is not the same file";
+	else if (saved.pattern_hash != pattern_hash || saved_strings != strings_count)
+		reason = "strings or packet type changed";
+	else if (saved.offset > size || saved.offset < PCAP_GLOBAL_HEADER)
+		reason = "the capture is shorter than the saved offset";
+	for (int i = 0; reason == NULL && i < strings_count; i++)
+		if (fscanf(f, "%lld", &s->counts[i]) != 1)
+			reason = "state file truncated";
+	fclose(f);
+	if (reason != NULL) {
+		printf("Incremental scan: %s, scanning all of it\n", reason);
+		memset(s->counts, 0, strings_count*sizeof(long long));
+		return 0;
+	}
+	s->offset = saved.offset;
+	s->packets = saved.packets;
+	printf("Incremental scan: resuming at byte %ld, %lld packets already counted\n", s->offset, s->packets);
+	return 1;
+}
+
+/* Function use to write the state next to the capture, through a temporary file so that a crash
+ * never leaves half a state behind */
+int state_save(const char *pcap_path, struct scan_state *s) {
+	if (s->offset < 0) //not a classic pcap file, nothing to resume from
+		return 0;
+	s->head_len = s->offset < STATE_HEAD_BYTES ? s->offset : STATE_HEAD_BYTES; //only bytes already processed, they do not change
+	s->head_hash = state_head_hash(pcap_path, s->head_len);
+	char state_path[4096], tmp_path[4200];
+	snprintf(state_path, sizeof(state_path), "%s.state", pcap_path);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", state_path);
+	FILE *f = fopen(tmp_path, "w");
+	if (f == NULL) {
+		perror("error writing the incremental state: ");
+		return 0;
+	}
+	fprintf(f, "pcap_string_matching_state %d %llu %llu %llx %ld %llx %ld %lld %d\n", STATE_VERSION, s->dev, s->ino,
+		s->head_hash, s->head_len, s->pattern_hash, s->offset, s->packets, s->strings_count);
+	for (int i = 0; i < s->strings_count; i++)
+		fprintf(f, "%lld\n", s->counts[i]);
+	if (fclose(f) != 0 || rename(tmp_path, state_path) != 0) {
+		perror("error writing the incremental state: ");
+		return 0;
+	}
+	return 1;
+}
+
+void state_free(struct scan_state *s) {
+	free(s->counts);
+}
+
+#endif
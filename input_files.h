@@ -0,0 +1,386 @@
+/*
+* Library that contain the multi-file input of the offline tools: the capture argument can be a single
+* file, a directory (every capture in it, in name order, the .idx/.state sidecars left out), a glob
+* pattern ("/captures/2024-05-01-1*.pcap", quoted so that the shell does not expand it) or @list, a text
+* file with one capture path per line.
+* The files are read as one stream of packets, so the packets of several files are matched at the same
+* time by the workers and the counts of all of them end up in one report. The stream parses the records
+* with one thread, a file after the other: while a file is read a helper thread opens the next one and
+* reads it ahead into the page cache (up to INPUT_READAHEAD_BYTES), so only the open and the first reads
+* of a file are overlapped with the parsing and matching of the previous one. The tools that keep all the
+* packets in memory load a list with input_load_files instead: every file is parsed by its own thread
+* into its own block (an omp for schedule(dynamic) over the files, as openmp_buffer loads its files) and
+* the blocks are then walked in the order of the list, so the files are parsed at the same time.
+* A file that cannot be opened is reported and left out, the others are read anyway; the stream fails
+* only when none of them can be opened.
+* Every file is read with the read path chosen by the tool (capture_reader.h); gzip-compressed captures
+* are read as they are (gz_capture.h), so the stream needs _GNU_SOURCE.
+*
+* Usage:
+*	struct input_files files; input_files_expand(argv[1], &files);
+*	struct input_stream *in = input_stream_open(&files, READER_PCAP, errbuf);
+*	while (input_next_ex(in, &header, &data) >= 0) ...	// as pcap_next_ex, over all the files
+*	input_stream_close(in); input_files_free(&files);
+*	struct input_capture *loaded = input_load_files(&files, READER_PCAP, thread_count);	// or all at once
+*	struct input_cursor c = {loaded, files.count};
+*	while (input_loaded_next(&c, &header, &data) >= 0) ...	// the same packets, in the same order
+*	input_captures_free(loaded, files.count);
+* input_load_files needs -fopenmp, without it the files are loaded one after the other.
+* Define INPUT_FILES_NO_STREAM before including it to get only the list of files, without libpcap.
+*/
+#ifndef _INPUT_FILES_H_
+#define _INPUT_FILES_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <glob.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define INPUT_READAHEAD_BYTES (256LL << 20)	// bytes of the next file read ahead, a larger file is read on demand after them
+#define INPUT_READAHEAD_BLOCK (1 << 20)
+
+struct input_files {
+	char **paths;
+	int count;
+};
+
+static void input_files_add(struct input_files *in, const char *path, int *capacity) {
+	if (in->count == *capacity) {
+		*capacity = *capacity ? *capacity * 2 : 16;
+		in->paths = realloc(in->paths, *capacity * sizeof(char *));
+	}
+	in->paths[in->count++] = strdup(path);
+}
+
+/* Function use to know if a directory entry is one of the sidecar files the tools write next to a capture */
+static int input_is_sidecar(const char *name) {
+	const char *suffix[] = {".idx", ".state", ".tmp", ".csv"};
+	size_t len = strlen(name);
+	if (name[0] == '.')
+		return 1;
+	for (int k = 0; k < 4; k++)
+		if (len > strlen(suffix[k]) && strcmp(name + len - strlen(suffix[k]), suffix[k]) == 0)
+			return 1;
+	return 0;
+}
+
+/* Function use to get the captures named by the capture argument
+* INPUT:
+*	spec: a file, a directory, a glob pattern or @list
+	in: filled with the paths, to be freed with input_files_free
+* OUTPUT
+	number of captures, 0 (with a message) if there are none
+*/
+int input_files_expand(const char *spec, struct input_files *in) {
+	int capacity = 0;
+	struct stat st;
+	memset(in, 0, sizeof(*in));
+	if (spec[0] == '@') { //list file
+		FILE *f = fopen(spec + 1, "r");
+		if (f == NULL) {
+			perror("error opening the list of captures: ");
+			return 0;
+		}
+		char line[4096];
+		while (fgets(line, sizeof(line), f) != NULL) {
+			line[strcspn(line, "\r\n")] = '\0';
+			if (line[0] != '\0' && line[0] != '#')
+				input_files_add(in, line, &capacity);
+		}
+		fclose(f);
+	}
+	else if (stat(spec, &st) == 0 && S_ISDIR(st.st_mode)) {
+		struct dirent **names;
+		int n = scandir(spec, &names, NULL, alphasort);
+		if (n < 0) {
+			perror("error reading the directory of captures: ");
+			return 0;
+		}
+		char path[4096];
+		for (int k = 0; k < n; k++) {
+			snprintf(path, sizeof(path), "%s/%s", spec, names[k]->d_name);
+			if (!input_is_sidecar(names[k]->d_name) && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+				input_files_add(in, path, &capacity);
+			free(names[k]);
+		}
+		free(names);
+	}
+	else if (access(spec, F_OK) != 0 && strpbrk(spec, "*?[") != NULL) { //glob pattern, sorted by glob
+		glob_t g;
+		if (glob(spec, 0, NULL, &g) == 0) {
+			for (size_t k = 0; k < g.gl_pathc; k++)
+				input_files_add(in, g.gl_pathv[k], &capacity);
+			globfree(&g);
+		}
+	}
+	else //a single capture, errors are reported when it is opened
+		input_files_add(in, spec, &capacity);
+
+	if (in->count == 0)
+		fprintf(stderr, "error: no captures in %s\n", spec);
+	return in->count;
+}
+
+void input_files_free(struct input_files *in) {
+	for (int k = 0; k < in->count; k++)
+		free(in->paths[k]);
+	free(in->paths);
+}
+
+#ifndef INPUT_FILES_NO_STREAM
+#include <pcap.h>
+#include "capture_reader.h"
+#include "huge_pages.h"
+
+struct input_stream {
+	struct input_files *files;
+	int reader;		// read path, READER_PCAP/MMAP/URING
+	struct capture_reader *pcap;	// file being read, NULL after its end
+	int current;		// index of that file
+	struct capture_reader **opened;	// files opened ahead by the helper, NULL if they could not be opened
+	int ready;		// files [0, ready) have been opened
+	int stop;
+	pthread_t helper;
+	int helper_started;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/* Function use to read the first INPUT_READAHEAD_BYTES of a file, so that they are in the page cache when
+ * the file is parsed */
+void input_readahead(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	posix_fadvise(fd, 0, INPUT_READAHEAD_BYTES, POSIX_FADV_WILLNEED);
+	char *block = malloc(INPUT_READAHEAD_BLOCK);
+	long long done = 0;
+	ssize_t n;
+	while (done < INPUT_READAHEAD_BYTES && (n = read(fd, block, INPUT_READAHEAD_BLOCK)) > 0)
+		done += n;
+	free(block);
+	close(fd);
+}
+
+/* Body of the helper thread: it opens every file when the stream gets to the one before it */
+void *input_helper_main(void *arg) {
+	struct input_stream *s = arg;
+	char errbuf[PCAP_ERRBUF_SIZE];
+	for (int k = s->ready; k < s->files->count; k++) { //the file after the first one opened, only the helper changes ready
+		pthread_mutex_lock(&s->lock);
+		while (!s->stop && k > s->current + 1)
+			pthread_cond_wait(&s->cond, &s->lock);
+		int stop = s->stop;
+		pthread_mutex_unlock(&s->lock);
+		if (stop)
+			break;
+
+		struct capture_reader *p = reader_open(s->files->paths[k], s->reader, errbuf);
+		if (p == NULL)
+			fprintf(stderr, "error reading pcap file %s: %s, skipping it\n", s->files->paths[k], errbuf);
+		else
+			input_readahead(s->files->paths[k]);
+
+		pthread_mutex_lock(&s->lock);
+		s->opened[k] = p;
+		s->ready = k + 1;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+	}
+	return NULL;
+}
+
+/* Function use to open the stream of packets of the captures, the first one that can be opened is
+ * opened right away, the ones before it are reported and left out
+* OUTPUT
+	the stream, NULL (with the reason in errbuf) if no capture can be opened
+*/
+struct input_stream *input_stream_open(struct input_files *files, int reader, char *errbuf) {
+	struct capture_reader *first = NULL;
+	int k = 0;
+	for (; k < files->count && first == NULL; k++) {
+		first = reader_open(files->paths[k], reader, errbuf);
+		if (first == NULL && files->count > 1)
+			fprintf(stderr, "error reading pcap file %s: %s, skipping it\n", files->paths[k], errbuf);
+	}
+	if (first == NULL)
+		return NULL;
+	struct input_stream *s = calloc(1, sizeof(struct input_stream));
+	s->files = files;
+	s->reader = reader;
+	s->pcap = first;
+	s->current = k - 1;
+	s->opened = calloc(files->count, sizeof(struct capture_reader *));
+	s->ready = k;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	if (s->current + 1 < files->count) {
+		if (pthread_create(&s->helper, NULL, input_helper_main, s) != 0) {
+			perror("error starting the input helper: ");
+			exit(1);
+		}
+		s->helper_started = 1;
+	}
+	return s;
+}
+
+/* Function use to get the next packet of the stream, as pcap_next_ex does for one file
+* OUTPUT
+	1 with a packet, -2 after the last packet of the last file
+*/
+int input_next_ex(struct input_stream *s, struct pcap_pkthdr **header, const unsigned char **data) {
+	while (1) {
+		if (s->pcap != NULL) {
+			if (reader_next(s->pcap, header, data) >= 0)
+				return 1;
+			reader_close(s->pcap); //end of this file, or a truncated last record
+			s->pcap = NULL;
+		}
+		if (s->current + 1 >= s->files->count)
+			return -2;
+		pthread_mutex_lock(&s->lock);
+		s->current++;
+		pthread_cond_broadcast(&s->cond); //the helper can open the file after this one
+		while (s->ready <= s->current)
+			pthread_cond_wait(&s->cond, &s->lock);
+		s->pcap = s->opened[s->current];
+		pthread_mutex_unlock(&s->lock);
+	}
+}
+
+void input_stream_close(struct input_stream *s) {
+	if (s->helper_started) {
+		pthread_mutex_lock(&s->lock);
+		s->stop = 1;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+		pthread_join(s->helper, NULL);
+		for (int k = s->current + 1; k < s->ready; k++) //opened ahead and never read
+			if (s->opened[k] != NULL)
+				reader_close(s->opened[k]);
+	}
+	if (s->pcap != NULL)
+		reader_close(s->pcap);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+	free(s->opened);
+	free(s);
+}
+
+/* The packets of a capture loaded in memory by input_load_files: only the captured length of every
+ * packet is kept, its bytes follow the ones of the packet before it */
+struct input_capture {
+	unsigned char *bytes;	// the captured bytes of all the packets, one after the other
+	size_t used;
+	unsigned int *len;	// captured length of every packet
+	int count;
+};
+
+/* Function use to load a capture in memory, its packets one after the other in one block
+* INPUT:
+*	reader: read path, READER_HUGE_PAGES asks for transparent huge pages on the block too
+* OUTPUT
+	0, -1 (with a message) if the file cannot be opened; a truncated last record ends the file, as in the stream
+*/
+int input_load_capture(const char *path, int reader, struct input_capture *c) {
+	char errbuf[PCAP_ERRBUF_SIZE];
+	struct pcap_pkthdr *header;
+	const unsigned char *data;
+	struct stat st;
+	memset(c, 0, sizeof(*c));
+	struct capture_reader *r = reader_open(path, reader, errbuf);
+	if (r == NULL) {
+		fprintf(stderr, "error reading pcap file %s: %s, skipping it\n", path, errbuf);
+		return -1;
+	}
+	size_t capacity = stat(path, &st) == 0 && st.st_size > 0 ? st.st_size : 1 << 20; //the records of an uncompressed capture fit in it
+	int slots = 1024;
+	c->bytes = malloc(capacity);
+	c->len = malloc(slots*sizeof(unsigned int));
+	if (reader & READER_HUGE_PAGES)
+		huge_advise(c->bytes, capacity);
+	while (reader_next(r, &header, &data) >= 0) {
+		if (c->used + header->caplen > capacity) { //a gzip-compressed capture
+			size_t grown = (capacity + header->caplen)*2;
+			c->bytes = realloc(c->bytes, grown);
+			if (reader & READER_HUGE_PAGES) //the part before keeps its advice through realloc
+				huge_advise(c->bytes + capacity, grown - capacity);
+			capacity = grown;
+		}
+		if (c->count == slots) {
+			slots *= 2;
+			c->len = realloc(c->len, slots*sizeof(unsigned int));
+		}
+		memcpy(c->bytes + c->used, data, header->caplen);
+		c->used += header->caplen;
+		c->len[c->count++] = header->caplen;
+	}
+	reader_close(r);
+	return 0;
+}
+
+/* Function use to load every capture of the list in memory, a file per thread; schedule(dynamic) because
+ * the files can have very different sizes
+* OUTPUT
+	the captures in the order of the list, a file that cannot be opened has no packets; NULL if none can be opened
+*/
+struct input_capture *input_load_files(struct input_files *files, int reader, int thread_count) {
+	struct input_capture *captures = calloc(files->count, sizeof(struct input_capture));
+	int loaded = 0;
+#ifdef _OPENMP
+	#pragma omp parallel for num_threads(thread_count) schedule(dynamic) reduction(+:loaded)
+#endif
+	for (int f = 0; f < files->count; f++)
+		loaded += input_load_capture(files->paths[f], reader, &captures[f]) == 0;
+	if (loaded == 0) {
+		free(captures);
+		return NULL;
+	}
+	return captures;
+}
+
+void input_captures_free(struct input_capture *captures, int count) {
+	for (int f = 0; f < count; f++) {
+		free(captures[f].bytes);
+		free(captures[f].len);
+	}
+	free(captures);
+}
+
+/* Position in the captures loaded by input_load_files, {captures, count} to start from the first packet */
+struct input_cursor {
+	struct input_capture *captures;
+	int count;
+	int file;		// capture and packet the next call returns
+	int packet;
+	size_t offset;		// where its bytes start
+	struct pcap_pkthdr header;
+};
+
+/* Function use to get the next loaded packet, as input_next_ex: the header has only caplen and len
+* OUTPUT
+	1 with a packet, -2 after the last packet of the last file
+*/
+int input_loaded_next(struct input_cursor *c, struct pcap_pkthdr **header, const unsigned char **data) {
+	while (c->file < c->count && c->packet == c->captures[c->file].count) {
+		c->file++;
+		c->packet = 0;
+		c->offset = 0;
+	}
+	if (c->file == c->count)
+		return -2;
+	struct input_capture *capture = &c->captures[c->file];
+	c->header.caplen = c->header.len = capture->len[c->packet++];
+	*header = &c->header;
+	*data = capture->bytes + c->offset;
+	c->offset += c->header.caplen;
+	return 1;
+}
+
+#endif
+#endif
@@ -0,0 +1,136 @@
+/*
+* Library that contain the latency histograms of the live sniffer: one log-linear (HDR style) histogram
+* per worker thread, written only by its owner and merged on demand by whoever wants the percentiles.
+* Values are nanoseconds: below 2^LAT_SUB_BITS they are exact, above every power of two is cut into
+* 2^(LAT_SUB_BITS-1) buckets, so the error of a percentile is at most 1/2^(LAT_SUB_BITS-1) (~6%).
+*
+* Usage:
+*	struct latency_hist *hist = latency_hist_alloc(threads);
+*	latency_record(&hist[omp_get_thread_num()], ns);		// from the owner thread only
+*	latency_print(hist, threads, NULL, "total");		// from any thread, any time
+*/
+#ifndef _LATENCY_HIST_H_
+#define _LATENCY_HIST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define LAT_SUB_BITS 5
+#define LAT_HALF (1 << (LAT_SUB_BITS - 1))
+#define LAT_MAX_BITS 40	// 2^40 ns is about 18 minutes, longer latencies are clamped
+#define LAT_BUCKETS ((LAT_MAX_BITS - LAT_SUB_BITS + 2) * LAT_HALF)
+
+/* Histogram of a worker, padded so that two workers never write the same cache line */
+struct latency_hist {
+	long long counts[LAT_BUCKETS];
+	long long total;
+	long long max;
+	char pad[64];
+};
+
+/* Function use to get the bucket of a value in nanoseconds */
+static inline int latency_bucket(long long ns) {
+	if (ns < 0)
+		ns = 0;
+	if (ns >= (1LL << LAT_MAX_BITS))
+		ns = (1LL << LAT_MAX_BITS) - 1;
+	if (ns < (1 << LAT_SUB_BITS))
+		return ns;
+	int msb = 63 - __builtin_clzll(ns);
+	int e = msb - LAT_SUB_BITS + 1;
+	return e * LAT_HALF + (int)(ns >> e);
+}
+
+/* Function use to get the highest value in nanoseconds that falls into bucket b */
+static inline long long latency_bucket_value(int b) {
+	if (b < (1 << LAT_SUB_BITS))
+		return b;
+	int e = b / LAT_HALF - 1;
+	long long m = b - e * LAT_HALF;
+	return ((m + 1) << e) - 1;
+}
+
+struct latency_hist *latency_hist_alloc(int threads) {
+	return calloc(threads, sizeof(struct latency_hist));
+}
+
+/* Function use to record a latency, only the thread that owns h may call it.
+ * Relaxed atomic stores are enough since there is one writer, and they cost like normal stores */
+static inline void latency_record(struct latency_hist *h, long long ns) {
+	int b = latency_bucket(ns);
+	__atomic_store_n(&h->counts[b], h->counts[b] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->total, h->total + 1, __ATOMIC_RELAXED);
+	if (ns > h->max)
+		__atomic_store_n(&h->max, ns, __ATOMIC_RELAXED);
+}
+
+/* Function use to get the nanoseconds between a capture timestamp and now (both wall clock) */
+static inline long long latency_since(const struct timeval *ts) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (now.tv_sec - ts->tv_sec) * 1000000000LL + now.tv_nsec - ts->tv_usec * 1000LL;
+}
+
+/* Function use to merge the histograms of every worker into out, the workers can keep recording */
+void latency_merge(struct latency_hist *hist, int threads, struct latency_hist *out) {
+	memset(out, 0, sizeof(*out));
+	for (int t = 0; t < threads; t++) {
+		for (int b = 0; b < LAT_BUCKETS; b++) {
+			long long c = __atomic_load_n(&hist[t].counts[b], __ATOMIC_RELAXED);
+			out->counts[b] += c;
+			out->total += c; // sum of the buckets, consistent with them even while workers record
+		}
+		long long m = __atomic_load_n(&hist[t].max, __ATOMIC_RELAXED);
+		if (m > out->max)
+			out->max = m;
+	}
+}
+
+/* Function use to get the value under which there is the fraction q of the recorded latencies */
+long long latency_percentile(const struct latency_hist *h, double q) {
+	if (h->total == 0)
+		return 0;
+	long long rank = (long long)(q * h->total + 0.5);
+	if (rank < 1)
+		rank = 1;
+	long long seen = 0;
+	for (int b = 0; b < LAT_BUCKETS; b++) {
+		seen += h->counts[b];
+		if (seen >= rank)
+			return latency_bucket_value(b) < h->max ? latency_bucket_value(b) : h->max;
+	}
+	return h->max;
+}
+
+/* Function use to print p50, p99, p99.9 and max of the merged histograms of every worker
+* INPUT:
+*	hist, threads: the histograms of the workers
+	since: NULL for everything recorded so far, otherwise the merge of the previous call, the numbers
+		are then only about the packets counted in between and since is updated for the next call
+	label: what the numbers refer to, printed in front of them
+*/
+void latency_print(struct latency_hist *hist, int threads, struct latency_hist *since, const char *label) {
+	struct latency_hist merged, delta;
+	latency_merge(hist, threads, &merged);
+	delta = merged;
+	if (since != NULL) {
+		delta.total = 0;
+		delta.max = 0;
+		for (int b = 0; b < LAT_BUCKETS; b++) {
+			delta.counts[b] = merged.counts[b] - since->counts[b];
+			delta.total += delta.counts[b];
+			if (delta.counts[b] > 0) //the max of the interval is only known to the bucket
+				delta.max = latency_bucket_value(b) < merged.max ? latency_bucket_value(b) : merged.max;
+		}
+		*since = merged;
+	}
+	printf("Latency capture->count (%s): packets=%lld p50=%.3f ms p99=%.3f ms p99.9=%.3f ms max=%.3f ms\n", label,
+		delta.total, latency_percentile(&delta, 0.50) / 1e6, latency_percentile(&delta, 0.99) / 1e6,
+		latency_percentile(&delta, 0.999) / 1e6, delta.max / 1e6);
+	fflush(stdout);
+}
+
+#endif
@@ -1,7 +1,14 @@
-/*	Compilation: gcc -g -Wall -fopenmp live_openmp_task.c -o live_openmp_task -lpcap
-	USAGE: sudo ./live_openmp_task interface <string.txt> thread_count [udp/tcp]
+/*	Compilation: gcc -g -Wall -fopenmp -pthread live_openmp_task.c -o live_openmp_task -lpcap
+	USAGE: sudo ./live_openmp_task interface <string.txt> thread_count [udp/tcp] [latency=<seconds>] [windows=on/off/<file.csv>] [shed=auto/off/<rate>]
 	interface example -> wlo1
 	For select an interface run "tcpdump -D" and choose one option
+	latency: every that many seconds (default 10, 0 only at the end) print p50/p99/p99.9 of the time from
+	capture (header.ts) to the moment the matches of the packet are counted (latency_hist.h)
+	windows: on (default) prints the counts of every second and of every minute of capture while sniffing,
+	<file.csv> appends them to the file as second,width,string,count instead, off disables them (window_counts.h)
+	shed: auto (default) samples whole flows when the workers fall behind and goes back to every packet when
+	they catch up, <rate> samples that fraction of the flows from the start, off never samples (load_shedding.h);
+	kernel drops are reported in every case and the counts of sampled runs are also given scaled by 1/rate
 */
 
 #include <signal.h>
@@ -12,10 +19,18 @@
 #include <netinet/ip.h>
 #include <netinet/if_ether.h>
 #include "packet_dumping.h"
+#include "latency_hist.h"
+#include "window_counts.h"
+#include "load_shedding.h"
+#include "timer.h"
+#include <omp.h>
 
 #define UDP 0
 #define TCP 1
 
+#define LIVE_READ_TIMEOUT_MS 100 // pcap_next gives up after this long, so a quiet link does not block reports and ctrl+c
+#define DEFAULT_LATENCY_REPORT_SECONDS 10
+
 static int signalFlag = 0;
 
 void signalHandler(int val);
@@ -33,25 +48,50 @@ int main(int argc, char *argv[]) {
 	struct bpf_program filter;	//The compiled filter expression
 	bpf_u_int32 mask;		//The netmask of our sniffing device
 	bpf_u_int32 net; 		//The IP of our sniffing device
+	double report_seconds = DEFAULT_LATENCY_REPORT_SECONDS; //period of the latency report
+	int windows = 1; //time-windowed counts on/off
+	char *windows_path = NULL; //CSV file of the windows, NULL for stdout
+	int shed_mode = SHED_AUTO; //what to do when the workers fall behind
+	double shed_rate = 1.0; //fraction of the flows kept with a fixed rate
 	
-	if(argc==5 || argc==4) {
+	if(argc>=4) {
 		interface = argv[1];
 		strings_file_path = argv[2];
 		thread_count = atoi(argv[3]);
-		if(argc == 5) { //get packet type from command-line
+		if(argc >= 5) { //get packet type from command-line
 			if(strcmp(argv[4], "udp") == 0)
 				packet_type=UDP;
 			else if (strcmp(argv[4], "tcp") == 0)
 				packet_type=TCP;
 			else {
-				printf("USAGE ./live_openmp_task interface <string.txt> thread_count [udp/tcp]\n");
+				printf("USAGE ./live_openmp_task interface <string.txt> thread_count [udp/tcp] [latency=<seconds>] [windows=on/off/<file.csv>] [shed=auto/off/<rate>]\n");
+				exit(1);
+			}
+		}
+		for (int a = 5; a < argc; a++) { //options, in any order
+			if (strncmp(argv[a], "latency=", 8) == 0)
+				report_seconds = atof(argv[a] + 8);
+			else if (strcmp(argv[a], "windows=off") == 0)
+				windows = 0;
+			else if (strncmp(argv[a], "windows=", 8) == 0 && strcmp(argv[a], "windows=on") != 0)
+				windows_path = argv[a] + 8;
+			else if (strcmp(argv[a], "shed=auto") == 0)
+				shed_mode = SHED_AUTO;
+			else if (strcmp(argv[a], "shed=off") == 0)
+				shed_mode = SHED_OFF;
+			else if (strncmp(argv[a], "shed=", 5) == 0 && atof(argv[a] + 5) > 0 && atof(argv[a] + 5) <= 1) {
+				shed_mode = SHED_FIXED;
+				shed_rate = atof(argv[a] + 5);
+			}
+			else if (strcmp(argv[a], "windows=on") != 0) {
+				printf("USAGE ./live_openmp_task interface <string.txt> thread_count [udp/tcp] [latency=<seconds>] [windows=on/off/<file.csv>] [shed=auto/off/<rate>]\n");
 				exit(1);
 			}
 		}
 	
 	}
 	else {
-		printf("USAGE ./live_openmp_task interface <string.txt> thread_count [udp/tcp]\n");
+		printf("USAGE ./live_openmp_task interface <string.txt> thread_count [udp/tcp] [latency=<seconds>] [windows=on/off/<file.csv>] [shed=auto/off/<rate>]\n");
 				exit(1);
 	}
 	
@@ -68,21 +108,16 @@ int main(int argc, char *argv[]) {
 	}
 	char str[100]; //buffer when we save the strings in the file
 	
-	while( fscanf(fp, "%s", str) != EOF ) //we read all the file word by word
+	while(fscanf(fp, "%99s", str) != EOF) //we read all the file word by word
 	{
-
-		array_of_strings[count] = malloc(strlen(str)); //we have to allocate memory for storing this string
-		if (count < array_of_strings_length) {
-			strcpy(array_of_strings[count], str); //copy string into array
-			count++;
-		}
-		else { //count == array_of_strings_length
+		if (count == array_of_strings_length) {
 			//it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
 			array_of_strings = (char **)realloc(array_of_strings, (array_of_strings_length*2)*sizeof(char *));
-			strcpy(array_of_strings[count], str); //copy string into array
-			count++;
 			array_of_strings_length *= 2;
 		}
+		array_of_strings[count] = malloc(strlen(str)+1); //we have to allocate memory for storing this string
+		strcpy(array_of_strings[count], str); //copy string into array
+		count++; //actual number of strings have grown by 1
 	}
 	fclose(fp);
 	
@@ -109,7 +144,7 @@ int main(int argc, char *argv[]) {
 	
 	//now initialize sniffer session
 	pcap_t * live_handle = 
-		pcap_open_live(interface, BUFSIZ, 1, 0, errbuf);
+		pcap_open_live(interface, BUFSIZ, 1, LIVE_READ_TIMEOUT_MS, errbuf);
 	if (live_handle == NULL) { //errors check
 		 fprintf(stderr, "Couldn't open device %s: %s\n", interface, errbuf);
 		 return(2);
@@ -141,19 +176,38 @@ int main(int argc, char *argv[]) {
 	const u_char *packet;							// The actual packet
 	int array_of_payload_length = 10; 					// keeps track of the size of the array of packets
 	char *array_of_payloads[array_of_payload_length];  			// array containing captured packets
+	struct timeval array_of_ts[array_of_payload_length];			// capture time of every packet of the array
+	double array_of_weights[array_of_payload_length];			// 1/sampling rate when every packet has been captured
 	int packet_count=0;							// actual number of packet into array
-	int total_count=0;							// increased when packet_count is reinitialize to 0
+	int total_count=0;							// packets of the batches given to the tasks
+	long long batch_second = 0;						// capture second of the first packet of the array
 	int *string_count = calloc(array_of_strings_length, sizeof(int)); 	// using calloc because we want to initialize every member to 0
+	double *string_estimate = calloc(array_of_strings_length, sizeof(double)); // string_count scaled by the sampling rates
 	char* payload;
 	unsigned int packet_len;
 	char * data_copy; //copy of data object
 	int *private_string_count; //used into every task
+	struct latency_hist *latency = latency_hist_alloc(thread_count); //one histogram per worker
+	struct latency_hist latency_last; //merge of the previous periodic report
+	memset(&latency_last, 0, sizeof(latency_last));
+	char latency_label[64];
+	snprintf(latency_label, sizeof(latency_label), "last %g s", report_seconds);
+	double next_report;
+	GET_TIME(next_report);
+	next_report += report_seconds;
+	struct window_ring *window_rings = window_rings_alloc(thread_count, array_of_strings_length); //one ring of seconds per worker
+	struct window_reporter *reporter = NULL;
+	if (windows)
+		reporter = window_reporter_start(window_rings, thread_count, array_of_strings, array_of_strings_length, windows_path);
+	struct shed_state shed;
+	shed_init(&shed, shed_mode, shed_rate, thread_count);
+	double next_shed_check = next_report - report_seconds + SHED_CHECK_SECONDS;
 	
 	printf("\nWork in progress...\nPress ctrl+c to stop sniffing procedure\n");
-	printf("You can stop the procedure only if at least one %s packet has been read\n", type);
 	
 	//Initialize items for execute the procedure until ctrl+C pressed
 	struct sigaction action;
+	memset(&action, 0, sizeof(action));
 	action.sa_handler = signalHandler;
 	sigaction(SIGINT, &action, NULL);
 	
@@ -165,67 +219,130 @@ int main(int argc, char *argv[]) {
 			
 				packet = pcap_next(live_handle, &header);
 				
-				if(packet_count<array_of_payload_length) {	//if there is space, add payload into array
+				if(packet != NULL && !shed_keep(&shed, flow_hash(packet, header.caplen)))
+					packet = NULL; // its flow is not sampled, as if it had never arrived
+				
+				if(packet != NULL) {	//NULL when the read timeout expires without packets
+					if (packet_count == 0) { //first packet of a new batch, its second waits for the batch
+						batch_second = header.ts.tv_sec;
+						window_batch_begin(reporter, batch_second);
+					}
 
-					data_copy = malloc(header.len); //allocate memory to copy packet data
-					memcpy(data_copy, packet, header.len); //copy packet data
+					data_copy = malloc(header.caplen); //allocate memory to copy packet data
+					memcpy(data_copy, packet, header.caplen); //copy packet data
 					if(packet_type == UDP) //udp
-						payload = dump_UDP_packet(data_copy, &packet_len, header.len); //getting the payload
+						payload = dump_UDP_packet(data_copy, &packet_len, header.caplen); //getting the payload
 					else //tcp
-						payload = dump_TCP_packet(data_copy, &packet_len, header.len); //getting the payload
+						payload = dump_TCP_packet(data_copy, &packet_len, header.caplen); //getting the payload
 								
 					if(payload != NULL) { //we store it in array of payloads
 					
-						array_of_payloads[packet_count] = malloc(packet_len); //we have to allocate memory for storing this payload
-						strcpy(array_of_payloads[packet_count], payload); //copy payload into array
+						array_of_payloads[packet_count] = malloc(packet_len+1); //we have to allocate memory for storing this payload
+						memcpy(array_of_payloads[packet_count], payload, packet_len); //copy payload into array
+						array_of_payloads[packet_count][packet_len] = '\0'; // kmp_matcher wants a string
 					}
 					else { // If the packet is not valid we save a " " message into array of payloads
-						array_of_payloads[packet_count] = malloc(1);
+						array_of_payloads[packet_count] = malloc(2);
 						strcpy(array_of_payloads[packet_count], " ");
 					}
+					free(data_copy);
+					array_of_ts[packet_count] = header.ts;
+					array_of_weights[packet_count] = 1.0 / shed.rate;
 					packet_count++;
 					
 				}
-				else {	// create new task to submit to a thread
+				// create new task to submit to a thread when the batch is full, or when its first second is over:
+				// on a quiet link a batch would otherwise keep its packets out of the windows
+				if(packet_count == array_of_payload_length || (packet_count > 0 && time(NULL) > batch_second)) {
 				
-					#pragma omp task firstprivate(array_of_payloads, packet_count) private(private_string_count) shared(string_count, array_of_strings_length, array_of_strings)
+					#pragma omp atomic
+					shed.in_flight++;
+					#pragma omp task firstprivate(array_of_payloads, array_of_ts, array_of_weights, packet_count, batch_second) private(private_string_count) shared(string_count, string_estimate, array_of_strings_length, array_of_strings, latency, window_rings, shed, reporter)
 					{
 						// Using calloc because we want to initialize every member to 0
 				 		private_string_count = calloc(array_of_strings_length, sizeof(int)); 
+						double *private_string_estimate = calloc(array_of_strings_length, sizeof(double));
+						struct window_ring *my_ring = &window_rings[omp_get_thread_num()];
 				 		
 						for (int k = 0; k < packet_count; k++) { //for every packets 
-							for (int i =0 ; i < array_of_strings_length; i++) //for every string
-								private_string_count[i] += kmp_matcher(array_of_payloads[k],array_of_strings[i], prefix_array[i]);
+							for (int i =0 ; i < array_of_strings_length; i++) { //for every string
+								int matches = kmp_matcher(array_of_payloads[k],array_of_strings[i], prefix_array[i]);
+								private_string_count[i] += matches;
+								private_string_estimate[i] += matches * array_of_weights[k];
+								if (matches != 0) //into the second the packet has been captured
+									window_add(my_ring, array_of_ts[k].tv_sec, i, matches);
+							}
 						}
 						
 						// Merge private string count into shared string count array
 						#pragma omp critical
 						{
-						for (int i = 0; i < array_of_strings_length; i++)
+						for (int i = 0; i < array_of_strings_length; i++) {
 							string_count[i]+=private_string_count[i];
+							string_estimate[i]+=private_string_estimate[i];
+						}
 						}
 					 	free(private_string_count);
+						free(private_string_estimate);
+						window_batch_end(reporter, batch_second); //its seconds can be reported
+
+						// The matches of these packets are counted now
+						struct latency_hist *my_latency = &latency[omp_get_thread_num()];
+						for (int k = 0; k < packet_count; k++) {
+							latency_record(my_latency, latency_since(&array_of_ts[k]));
+							free(array_of_payloads[k]);
+						}
+						#pragma omp atomic
+						shed.in_flight--;
 						
 					} //close task
 					
+					total_count += packet_count;
 					packet_count=0;
-					total_count++;			
 				}	
+
+				double now;
+				GET_TIME(now);
+				if (report_seconds > 0 && now >= next_report) { //the workers keep recording meanwhile
+					latency_print(latency, thread_count, &latency_last, latency_label);
+					shed_print(&shed, live_handle);
+					next_report = now + report_seconds;
+				}
+				if (shed_mode != SHED_OFF && now >= next_shed_check) {
+					shed_check(&shed, live_handle);
+					next_shed_check = now + SHED_CHECK_SECONDS;
+				}
 			
 			}
 		} //close omp single
 	} //close omp parallel
 	
+	printf("\n");
+	shed_print(&shed, live_handle); //what the kernel dropped and the sampling left out
 	pcap_close(live_handle);	//close sniffing session
 	
 	//add data not used in the last cycle
 	if (packet_count!=0)
-		for (int k = 0; k < packet_count; k++) //for every packets 
-			for (int i =0 ; i < array_of_strings_length; i++) //for every string
-				string_count[i] += kmp_matcher(array_of_payloads[k],array_of_strings[i], prefix_array[i]);
+		for (int k = 0; k < packet_count; k++) { //for every packets 
+			for (int i =0 ; i < array_of_strings_length; i++) { //for every string
+				int matches = kmp_matcher(array_of_payloads[k],array_of_strings[i], prefix_array[i]);
+				string_count[i] += matches;
+				string_estimate[i] += matches * array_of_weights[k];
+				if (matches != 0)
+					window_add(&window_rings[0], array_of_ts[k].tv_sec, i, matches);
+			}
+			latency_record(&latency[0], latency_since(&array_of_ts[k])); //the workers are done, thread 0 owns it again
+			free(array_of_payloads[k]);
+		}
+	if (packet_count != 0)
+		window_batch_end(reporter, batch_second);
 	
+	if (reporter != NULL)
+		window_reporter_stop(reporter);
+	window_rings_free(window_rings, thread_count);
+
 	//calculate total count
-	total_count = (total_count*array_of_payload_length) + packet_count;
+	total_count += packet_count;
 	printf("\n\n%d packet sniffed\n\n", total_count);
 	
 	// Now we print the output
@@ -239,6 +356,13 @@ int main(int argc, char *argv[]) {
 	}
 	if (check==0)
 		printf("Oops! We have not found any matches\n");
+	if (shed.sampled_packets > 0) { //some flows have been left out, these are the best guess of the real counts
+		printf("Estimated counts over all the traffic (sampled flows scaled by 1/rate):\n");
+		for (int i = 0; i < array_of_strings_length; i++)
+			if (string_estimate[i] != 0)
+				printf("%s: ~%.0f times\n", array_of_strings[i], string_estimate[i]);
+	}
+	latency_print(latency, thread_count, NULL, "total");
 		
 			
 	/* We have to free previously allocated memory */
@@ -251,9 +375,9 @@ int main(int argc, char *argv[]) {
 		free(array_of_strings[i]);
 	} free(array_of_strings);
 	
-	free(array_of_payloads);
-	
+	free(latency);
 	free(string_count);
+	free(string_estimate);
 
 	return 0;
 	 
@@ -0,0 +1,72 @@
+/*
+* Library that contain the functions used to split packets between MPI ranks
+* and to report how busy every rank has been
+*/
+#ifndef _LOAD_BALANCE_H_
+#define _LOAD_BALANCE_H_
+
+#define SPLIT_COUNT 0	// same number of packets for every rank (old behaviour)
+#define SPLIT_BYTES 1	// same number of payload bytes for every rank
+#define SPLIT_DYNAMIC 2	// rank 0 hands out chunks of packets on request
+
+/* Fixed cost of a packet, in bytes, added to its payload length:
+ * it accounts for the dump and the per-pattern call overhead of empty payloads */
+#define PACKET_OVERHEAD_BYTES 64
+
+/* Bytes of payload that rank 0 sends with every chunk in SPLIT_DYNAMIC mode */
+#define DYNAMIC_CHUNK_BYTES (256*1024)
+
+/* Function use to split packets between ranks so that every rank gets the same amount of bytes
+* INPUT:
+*	weight: weight (payload bytes) of every packet
+	num_packets: number of packets
+	comm_sz: number of ranks
+	local_size: array of comm_sz elements filled with the number of packets of every rank
+	displ: array of comm_sz elements filled with the index of the first packet of every rank
+
+* Ranges are contiguous and keep the packet order: rank r ends at the first packet where the
+* cumulative weight reaches (r+1)/comm_sz of the total, so a single jumbo packet cannot be split
+* but it is not stacked on top of an even share anymore.
+*/
+void byte_weighted_split(const unsigned int *weight, int num_packets, int comm_sz, int *local_size, int *displ) {
+	unsigned long long total = 0;
+	for (int i = 0; i < num_packets; i++)
+		total += weight[i];
+
+	unsigned long long cumulative = 0;
+	int k = 0; //next packet to assign
+	for (int r = 0; r < comm_sz; r++) {
+		unsigned long long target = total * (r+1) / comm_sz; //cumulative weight where rank r stops
+		displ[r] = k;
+		while (k < num_packets && (r == comm_sz-1 || cumulative + weight[k]/2 < target)) {
+			cumulative += weight[k];
+			k++;
+		}
+		local_size[r] = k - displ[r];
+	}
+}
+
+/* Function use to print the busy time of every rank, gathered on rank 0
+* INPUT:
+*	busy: busy time (seconds) of every rank
+	bytes: payload bytes processed by every rank
+	comm_sz: number of ranks
+	first_worker: ranks before this one only hand out work (SPLIT_DYNAMIC) and are left out of the imbalance
+*/
+void print_rank_busy_time(const double *busy, const unsigned long long *bytes, int comm_sz, int first_worker) {
+	double max = 0, sum = 0;
+	printf("Rank\tbusy time (s)\tpayload bytes\n");
+	for (int r = 0; r < comm_sz; r++) {
+		printf("%d\t%f\t%llu%s\n", r, busy[r], bytes[r], r < first_worker ? "\t(master)" : "");
+		if (r < first_worker)
+			continue;
+		sum += busy[r];
+		if (busy[r] > max)
+			max = busy[r];
+	}
+	// 1.0 means perfect balance, comm_sz means that one rank did all the work
+	if (sum > 0)
+		printf("Imbalance (max/mean busy time) = %f\n", max / (sum / (comm_sz - first_worker)));
+}
+
+#endif
@@ -0,0 +1,115 @@
+/*
+* Library that contain the overload handling of the live sniffer: drop accounting through pcap_stats,
+* backlog detection through the batches handed to the workers and not matched yet, and flow-consistent
+* sampling when the backlog lasts. A flow (addresses, protocol and ports, both directions) is kept when
+* its hash falls under the sampling rate, so a kept flow is seen whole and halving the rate only drops
+* flows that were kept before. The counts of a kept packet are scaled by 1/rate to estimate the totals.
+*
+* Usage:
+*	struct shed_state shed; shed_init(&shed, SHED_AUTO, 1.0, threads);
+*	if (shed_keep(&shed, flow_hash(packet, caplen))) ... weight = 1/shed.rate
+*	shed_check(&shed, handle);	// now and then, from the reader
+*/
+#ifndef _LOAD_SHEDDING_H_
+#define _LOAD_SHEDDING_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <pcap.h>
+#include <netinet/ip.h>
+#include <netinet/if_ether.h>
+#include "flow_hash.h"
+
+#define SHED_OFF 0		// never sample, the kernel drops what we cannot read
+#define SHED_AUTO 1		// sample only while the backlog lasts
+#define SHED_FIXED 2	// sample at a fixed rate from the start
+
+#define SHED_SCALE 65536			// resolution of the sampling rate on the flow hash
+#define SHED_MIN_RATE (1.0/64)		// never keep less than this fraction of the flows
+#define SHED_BACKLOG_PER_THREAD 4	// batches per worker waiting to be matched before we call it backlog
+#define SHED_SUSTAINED 3			// consecutive checks with (or without) backlog before the rate changes
+#define SHED_CHECK_SECONDS 0.5		// how often the reader calls shed_check
+
+struct shed_state {
+	int mode;
+	double rate;			// fraction of the flows kept
+	int backlog_limit;		// in flight batches above this are backlog
+	int in_flight;			// batches handed to the workers and not matched yet, updated with omp atomic
+	int backlog_checks;		// > 0 consecutive checks with backlog, < 0 without
+	long long shed_packets;		// packets left out by the sampling
+	long long sampled_packets;	// packets captured while the rate was below 1
+	struct pcap_stat last;	// kernel counters at the previous check
+};
+
+void shed_init(struct shed_state *s, int mode, double rate, int threads) {
+	memset(s, 0, sizeof(*s));
+	s->mode = mode;
+	s->rate = mode == SHED_FIXED ? rate : 1.0;
+	s->backlog_limit = SHED_BACKLOG_PER_THREAD * threads;
+}
+
+/* Function use to know if a packet of the flow with hash h is kept at the current rate */
+static inline int shed_keep(struct shed_state *s, unsigned int h) {
+	if (s->rate >= 1.0)
+		return 1;
+	s->sampled_packets++;
+	if ((h % SHED_SCALE) < s->rate * SHED_SCALE)
+		return 1;
+	s->shed_packets++;
+	return 0;
+}
+
+/* Function use to look at the backlog and at the kernel drops since the previous check and, in auto
+ * mode, halve the rate when the overload lasts or double it back when it is over. Reader thread only.
+* OUTPUT
+	packets the kernel dropped since the previous check
+*/
+unsigned int shed_check(struct shed_state *s, pcap_t *handle) {
+	struct pcap_stat now;
+	unsigned int dropped = 0;
+	if (pcap_stats(handle, &now) == 0) {
+		dropped = (now.ps_drop - s->last.ps_drop) + (now.ps_ifdrop - s->last.ps_ifdrop);
+		s->last = now;
+	}
+	int in_flight;
+	#pragma omp atomic read
+	in_flight = s->in_flight;
+
+	int backlog = in_flight > s->backlog_limit || dropped > 0;
+	if (backlog)
+		s->backlog_checks = s->backlog_checks > 0 ? s->backlog_checks + 1 : 1;
+	else
+		s->backlog_checks = s->backlog_checks < 0 ? s->backlog_checks - 1 : -1;
+
+	if (s->mode == SHED_AUTO) {
+		if (s->backlog_checks >= SHED_SUSTAINED && s->rate > SHED_MIN_RATE) {
+			s->rate = s->rate / 2 > SHED_MIN_RATE ? s->rate / 2 : SHED_MIN_RATE;
+			s->backlog_checks = 0;
+			printf("Overload (%d batches waiting, %u dropped by the kernel): keeping %.2f%% of the flows\n", in_flight, dropped, s->rate * 100);
+			fflush(stdout);
+		}
+		else if (s->backlog_checks <= -SHED_SUSTAINED && s->rate < 1.0) {
+			s->rate = s->rate * 2 < 1.0 ? s->rate * 2 : 1.0;
+			s->backlog_checks = 0;
+			printf("Backlog cleared: keeping %.2f%% of the flows\n", s->rate * 100);
+			fflush(stdout);
+		}
+	}
+	return dropped;
+}
+
+/* Function use to print what has been lost and where: dropped by the kernel or left out by the sampling */
+void shed_print(struct shed_state *s, pcap_t *handle) {
+	struct pcap_stat now;
+	if (pcap_stats(handle, &now) == 0)
+		printf("Kernel: %u packets received, %u dropped (%.2f%%), %u dropped by the interface\n", now.ps_recv, now.ps_drop,
+			now.ps_recv > 0 ? 100.0 * now.ps_drop / now.ps_recv : 0, now.ps_ifdrop);
+	else
+		printf("Kernel drop counters not available: %s\n", pcap_geterr(handle));
+	if (s->sampled_packets > 0)
+		printf("Sampling: %lld packets left out of %lld captured while sampling, current rate %.2f%%\n",
+			s->shed_packets, s->sampled_packets, s->rate * 100);
+	fflush(stdout);
+}
+
+#endif
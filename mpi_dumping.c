@@ -1,5 +1,17 @@
-/* Compilation: mpicc -Wall mpi_dumping.c -o mpi_dumping -lpcap */
+/* Compilation: mpicc -Wall -pthread -fopenmp mpi_dumping.c -o mpi_dumping -lpcap -lz
+   (add -DSTAGE_PROFILE, and -DSTAGE_PERF for hardware counters, to get the per-stage profile of every rank, stage_profile.h)
+   Usage: mpiexec -n <ranks> ./mpi_dumping <file.pcap> <strings.txt> [tcp/udp] [count/bytes/dynamic] [index]
+   count: same number of packets per rank, bytes (default): same number of payload bytes per rank,
+   dynamic: rank 0 hands out chunks of DYNAMIC_CHUNK_BYTES to the other ranks as they ask for work
+   index: rank 0 builds (or extends) <file.pcap>.idx and splits the records of the selected protocol by
+   captured bytes, every rank reads its own records with pread instead of receiving them (pcap_index.h)
+   <file.pcap> can also be a directory, a glob pattern or @list: rank 0 loads every capture with its own
+   thread (OMP_NUM_THREADS of them) and the counts are printed together (input_files.h); index needs a
+   single capture
+   <file.pcap> can also be gzip-compressed, a BGZF one is decompressed by several threads (gz_capture.h)
+ */
 
+#define _GNU_SOURCE //fopencookie, see gz_capture.h
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +20,13 @@
 #include <netinet/ip.h>
 #include <netinet/if_ether.h>
 #include "packet_dumping.h"
+#include "timer.h"
+#include "bench.h"
+#include "load_balance.h"
+#include "stage_profile.h"
+#include "pcap_index.h"
+#include "input_files.h"
+#include <omp.h>
 
 // PCAP packet struct
 typedef struct {
@@ -20,10 +39,20 @@ typedef struct {
 #define UDP 0
 #define TCP 1
 
+/* Message tags of the SPLIT_DYNAMIC master/worker protocol */
+#define TAG_REQUEST 1	// worker -> master: give me work
+#define TAG_CHUNK 2	// master -> worker: {number of packets, bytes of data}, 0 packets means stop;
+			// with the index {number of packets, first entry} and nothing else is sent
+#define TAG_LENS 3	// master -> worker: length of every packet of the chunk
+#define TAG_DATA 4	// master -> worker: packets of the chunk, one after the other
+
 /*Knuth-Morris-Pratt String Matching Algorithm's functions.*/
 int kmp_matcher (char text[], char pattern[], int *prefix_array);
 int* kmp_prefix (char pattern[]);
 
+unsigned int match_packet(char *data, unsigned int len, int packet_type, char **array_of_strings, int **prefix_array, int array_of_strings_length, int *string_count);
+unsigned long long match_index_range(struct pcap_index *idx, struct pcap_index_entry *entries, int n, char *buffer, int packet_type, char **array_of_strings, int **prefix_array, int array_of_strings_length, int *string_count);
+
 int main (int argc, char *argv[]){
 	int my_rank, comm_sz;
 	MPI_Init(NULL, NULL);
@@ -46,25 +75,37 @@ int main (int argc, char *argv[]){
 	
 	char *strings_file_path; //for storing path of file <strings.txt>
 
-	/* Getting packet type from input */
-	int packet_type;
-	if (argc == 4) {
+	/* Getting packet type and split policy from input */
+	int packet_type = UDP; //default udp
+	int split = SPLIT_BYTES; //default byte weighted split
+	int use_index = 0; //every rank reads its packets through the record index
+	if (argc >= 3 && argc <= 6) {
 		strings_file_path = argv[2];
-		if (strcmp(argv[3], "udp") == 0) {
-			packet_type = UDP;
-		}
-		else if (strcmp(argv[3], "tcp") == 0) {
-			packet_type = TCP;
-		}
-		else {
-			printf("USAGE ./serial <file.pcap> <strings.txt> [tcp/udp]\n");
-			exit(1);
+		for (int i = 3; i < argc; i++) {
+			if (strcmp(argv[i], "udp") == 0)
+				packet_type = UDP;
+			else if (strcmp(argv[i], "tcp") == 0)
+				packet_type = TCP;
+			else if (strcmp(argv[i], "count") == 0)
+				split = SPLIT_COUNT;
+			else if (strcmp(argv[i], "bytes") == 0)
+				split = SPLIT_BYTES;
+			else if (strcmp(argv[i], "dynamic") == 0)
+				split = SPLIT_DYNAMIC;
+			else if (strcmp(argv[i], "index") == 0)
+				use_index = 1;
+			else {
+				printf("USAGE ./mpi_dumping <file.pcap> <strings.txt> [tcp/udp] [count/bytes/dynamic] [index]\n");
+				exit(1);
+			}
 		}
 	}
 	else {
-		printf("USAGE: ./serial <file.pcap> <strings.txt> [tcp/udp]\n");
+		printf("USAGE: ./mpi_dumping <file.pcap> <strings.txt> [tcp/udp] [count/bytes/dynamic] [index]\n");
 		exit(1);
 	}
+	if (split == SPLIT_DYNAMIC && comm_sz == 1) //nobody to hand work out to
+		split = SPLIT_BYTES;
 	
 	/* Reading strings for the string matching from txt file */
 	char **array_of_strings = malloc(sizeof(char *)); // for storing the patterns for string matching
@@ -79,20 +120,16 @@ int main (int argc, char *argv[]){
 	}
 	char str[100]; //buffer for saving the strings once pulled out by fscanf
 	
-	while(fscanf(fp, "%s", str) != EOF) //we read all the file word by word
+	while(fscanf(fp, "%99s", str) != EOF) //we read all the file word by word
 	{
-		array_of_strings[count] = malloc(strlen(str)); //we have to allocate memory for this string
-		if (count < array_of_strings_length) {
-			strcpy(array_of_strings[count], str); //copy string into array
-			count++; //actual number of strings have grown by 1
-		}
-		else { //count == array_of_strings_length
+		if (count == array_of_strings_length) {
 			//it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
 			array_of_strings = (char **)realloc(array_of_strings, (array_of_strings_length*2)*sizeof(char *));
-			strcpy(array_of_strings[count], str); //copy string into array
-			count++; //actual number of strings have grown by 1
-			array_of_strings_length *= 2; 
+			array_of_strings_length *= 2;
 		}
+		array_of_strings[count] = malloc(strlen(str)+1); //we have to allocate memory for this string
+		strcpy(array_of_strings[count], str); //copy string into array
+		count++; //actual number of strings have grown by 1
 	}
 	fclose(fp);
 	
@@ -103,31 +140,86 @@ int main (int argc, char *argv[]){
 	
 	
 	int num_packets, flag = 0; //flag is for errors
+	long long total_bytes = 0; //captured bytes, for the benchmark line of rank 0
+	double bench_start = 0, bench_finish;
 	Packet *a = NULL; //pointer (array) for MPI_Scatterv, it must be common between all processes
-	if (my_rank == 0){ //rank 0 is in charge of gathering all Packets
+	unsigned int *weight = NULL; //payload bytes of every packet, only rank 0 knows them
+	struct pcap_index *idx = NULL;
+	struct pcap_index_entry *selected = NULL; //records of the selected protocol, in capture order
+	if (my_rank == 0 && use_index) { //rank 0 builds or extends the index, the other ranks open it after the broadcast
+		GET_TIME(bench_start); //the span of the benchmark line starts here, see bench.h
+		idx = pcap_index_open(argv[1]);
+		if (idx == NULL)
+			flag = -1;
+		else {
+			num_packets = pcap_index_select(idx, packet_type == UDP ? IPPROTO_UDP : IPPROTO_TCP, &selected);
+			total_bytes = idx->total_bytes;
+			/* Payloads are not known without reading the packets, the captured bytes are the weight */
+			weight = malloc((num_packets ? num_packets : 1)*sizeof(unsigned int));
+			for (int k = 0; k < num_packets; k++)
+				weight[k] = selected[k].caplen + PACKET_OVERHEAD_BYTES;
+		}
+	}
+	else if (my_rank == 0){ //rank 0 is in charge of gathering all Packets
 		char errbuff[PCAP_ERRBUF_SIZE];
 		struct pcap_pkthdr *header;
-		pcap_t *pcap = pcap_open_offline(argv[1], errbuff);
-		if (pcap == NULL) {	//check error in pcap file opening
-			fprintf(stderr, "error reading pcap file: %s\n", errbuff);
+		GET_TIME(bench_start); //the span of the benchmark line starts here, see bench.h
+		struct input_files files;
+		struct input_stream *pcap = NULL;
+		struct input_cursor loaded = {NULL, 0}; //a list of captures is loaded a file per thread, see input_load_files
+		if (input_files_expand(argv[1], &files) > 1)
+			loaded = (struct input_cursor){input_load_files(&files, READER_PCAP, omp_get_max_threads()), files.count};
+		else if (files.count > 0)
+			pcap = input_stream_open(&files, READER_PCAP, errbuff);
+		if (pcap == NULL && loaded.captures == NULL) {	//check error in pcap file opening
+			if (files.count == 1)
+				fprintf(stderr, "error reading pcap file: %s\n", errbuff);
 			flag = -1;
 		}
 		else {
 			a = malloc(sizeof(Packet));
+			weight = malloc(sizeof(unsigned int));
 			int size_a = 1; //keeps track of array's size
 			num_packets = 0;  //actual number of packets in array a
 			const unsigned char *data;
 			int i;
-			while ((i = pcap_next_ex(pcap, &header, &data)) >= 0) {
-				memcpy(a[num_packets].data, data, header->len); //we store the packet in the array of packets
-				a[num_packets].len = header->len; //we store the len of this packet inside the proper field in the structure
+			while (1) {
+				STAGE_BEGIN(STAGE_READ);
+				i = pcap != NULL ? input_next_ex(pcap, &header, &data) : input_loaded_next(&loaded, &header, &data);
+				STAGE_END(STAGE_READ);
+				if (i < 0) //end of the pcap file
+					break;
+				if (header->caplen > sizeof(a[num_packets].data)) //bigger than the snaplen of a pcap file, cut as a capture would
+					header->caplen = sizeof(a[num_packets].data);
+				STAGE_BEGIN(STAGE_COPY);
+				memcpy(a[num_packets].data, data, header->caplen); //we store the packet in the array of packets
+				STAGE_END(STAGE_COPY);
+				a[num_packets].len = header->caplen; //we store the len of this packet inside the proper field in the structure
+				total_bytes += header->caplen;
+
+				/* The weight of a packet is the length of the payload the ranks are going to scan */
+				unsigned int payload_length = 0;
+				char *payload;
+				STAGE_BEGIN(STAGE_DECODE);
+				if (packet_type == UDP)
+					payload = dump_UDP_packet(a[num_packets].data, &payload_length, a[num_packets].len);
+				else
+					payload = dump_TCP_packet(a[num_packets].data, &payload_length, a[num_packets].len);
+				STAGE_END(STAGE_DECODE);
+				weight[num_packets] = (payload != NULL ? payload_length : 0) + PACKET_OVERHEAD_BYTES;
+
 				num_packets++; //actual number of packets has grown by 1
 				if (num_packets == size_a) {
 					a = realloc(a, (size_a*2)*sizeof(Packet)); //it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
+					weight = realloc(weight, (size_a*2)*sizeof(unsigned int));
 					size_a *= 2;
 				}
 			}
-			pcap_close(pcap);
+			if (pcap != NULL)
+				input_stream_close(pcap);
+			else
+				input_captures_free(loaded.captures, loaded.count);
+			input_files_free(&files);
 			if (!(size_a == num_packets))
 				a = realloc(a, num_packets*sizeof(Packet)); //we reallocate memory to get even
 		}
@@ -140,85 +232,296 @@ int main (int argc, char *argv[]){
 		MPI_Finalize();
 		return 0;
 	}
+	char *index_buffer = NULL; //a packet read through the index
+	if (use_index) {
+		if (my_rank != 0) {
+			idx = pcap_index_open(argv[1]);
+			if (idx == NULL)
+				MPI_Abort(MPI_COMM_WORLD, 1);
+			pcap_index_select(idx, packet_type == UDP ? IPPROTO_UDP : IPPROTO_TCP, &selected);
+		}
+		unsigned int max_caplen = 1;
+		for (int k = 0; k < num_packets; k++)
+			if (selected[k].caplen > max_caplen)
+				max_caplen = selected[k].caplen;
+		index_buffer = malloc(max_caplen);
+	}
 	
 	
-	int *local_size = malloc(comm_sz*sizeof(int)); //array that stores the number of packets that each process must have
-	int *displ = malloc(comm_sz*sizeof(int)); //array of displacement for Scatterv
+	int *local_string_count = calloc(array_of_strings_length, sizeof(int));
+	int *global_string_count = calloc(array_of_strings_length, sizeof(int));
+	int **prefix_array = malloc(array_of_strings_length*sizeof(int*));
+	for (int i = 0; i < array_of_strings_length; i++) {
+		prefix_array[i] = kmp_prefix(array_of_strings[i]);
+	}
+
+	double local_busy = 0; //time spent dumping and matching, without waiting for work
+	unsigned long long local_bytes = 0; //payload bytes scanned by this rank
+	double local_start, local_finish, local_elapsed, elapsed;
+
+	if (split != SPLIT_DYNAMIC) {
+		int *local_size = malloc(comm_sz*sizeof(int)); //array that stores the number of packets that each process must have
+		int *displ = malloc(comm_sz*sizeof(int)); //array of displacement for Scatterv
+
+		if (my_rank == 0) {
+			if (split == SPLIT_BYTES)
+				byte_weighted_split(weight, num_packets, comm_sz, local_size, displ);
+			else {
+				for (int i = 0; i < comm_sz; i++) {
+					local_size[i] = num_packets/comm_sz;
+				} local_size[0] += num_packets%comm_sz;
+
+				int offset = 0;
+				for (int i = 0; i < comm_sz; i++) {
+					displ[i] = offset;
+					offset += local_size[i];
+				}
+			}
+		}
+		MPI_Bcast(local_size, comm_sz, MPI_INT, 0, MPI_COMM_WORLD);
+		MPI_Bcast(displ, comm_sz, MPI_INT, 0, MPI_COMM_WORLD);
 
+		Packet *local_packets = NULL;
+		if (!use_index) { //with the index every rank reads its own share
+			local_packets = malloc(local_size[my_rank]*sizeof(Packet)); //every process allocates the memory needed for storing its share of Packets
+			STAGE_BEGIN(STAGE_DISTRIBUTE);
+			MPI_Scatterv(a, local_size, displ, MPI_Packet, local_packets, local_size[my_rank], MPI_Packet, 0, MPI_COMM_WORLD);
+			STAGE_END(STAGE_DISTRIBUTE);
+		}
 
-	for (int i = 0; i < comm_sz; i++) {
-		local_size[i] = num_packets/comm_sz;
-	} local_size[0] += num_packets%comm_sz;
+		/*Start Performance Evaluation */
+		MPI_Barrier(MPI_COMM_WORLD);
+		local_start = MPI_Wtime();
 
-	int offset = 0;
-	for (int i = 0; i < comm_sz; i++) {
-		displ[i] = offset;
-		offset += local_size[i];
+		/* Every Process now has its share of packets, it's time to dump the payloads and match them! */
+		if (use_index)
+			local_bytes = match_index_range(idx, selected + displ[my_rank], local_size[my_rank], index_buffer, packet_type, array_of_strings, prefix_array, array_of_strings_length, local_string_count);
+		else for (int i = 0; i < local_size[my_rank]; i++)
+			local_bytes += match_packet(local_packets[i].data, local_packets[i].len, packet_type, array_of_strings, prefix_array, array_of_strings_length, local_string_count);
+		local_busy = MPI_Wtime() - local_start;
+
+		free(local_packets);
+		free(local_size);
+		free(displ);
 	}
+	else {
+		/*Start Performance Evaluation */
+		MPI_Barrier(MPI_COMM_WORLD);
+		local_start = MPI_Wtime();
 
+		if (my_rank == 0) { //master: hand out chunks of packets until they are over, then tell every worker to stop
+			int next = 0; //first packet not handed out yet
+			int active_workers = comm_sz - 1;
+			unsigned int *chunk_lens = malloc(sizeof(unsigned int));
+			char *chunk_data = malloc(1);
+			int chunk_capacity = 1; //packets that fit into chunk_lens
+			int chunk_data_capacity = 1; //bytes that fit into chunk_data
+			MPI_Status status;
 
-	Packet *local_packets = malloc(local_size[my_rank]*sizeof(Packet)); //every process allocates the memory needed for storing its share of Packets
-	MPI_Scatterv(a, local_size, displ, MPI_Packet, local_packets, local_size[my_rank], MPI_Packet, 0, MPI_COMM_WORLD);
-	free(a);
+			while (active_workers > 0) {
+				MPI_Recv(NULL, 0, MPI_INT, MPI_ANY_SOURCE, TAG_REQUEST, MPI_COMM_WORLD, &status);
 
+				STAGE_BEGIN(STAGE_DISTRIBUTE); // waiting for requests is left out, that is idle time
+				/* A chunk has at least one packet and stops before DYNAMIC_CHUNK_BYTES of payload */
+				int first = next;
+				unsigned long long chunk_weight = 0;
+				int chunk[2] = {0, 0}; //number of packets, bytes of data
+				while (next < num_packets && (next == first || chunk_weight + weight[next] <= DYNAMIC_CHUNK_BYTES)) {
+					chunk_weight += weight[next];
+					if (!use_index)
+						chunk[1] += a[next].len;
+					next++;
+				}
+				chunk[0] = next - first;
+				if (use_index) //the worker reads the packets itself
+					chunk[1] = first;
+				MPI_Send(chunk, 2, MPI_INT, status.MPI_SOURCE, TAG_CHUNK, MPI_COMM_WORLD);
+				if (chunk[0] == 0) {
+					STAGE_END(STAGE_DISTRIBUTE);
+					active_workers--;
+					continue;
+				}
+				if (use_index) {
+					STAGE_END(STAGE_DISTRIBUTE);
+					continue;
+				}
 
-	/*Start Performance Evaluation */
-	double local_start, local_finish, local_elapsed, elapsed;
-	MPI_Barrier(MPI_COMM_WORLD);
-	local_start = MPI_Wtime();
-  
-	/* Every Process now has its share of packets, it's time to dump the payloads! */
-	char **local_payloads = malloc(local_size[my_rank]*sizeof(char*)); //we allocate memory for the local array of payloads
-
-	for (int i = 0; i < local_size[my_rank]; i++) {
-		char* payload;
-		unsigned int payload_length;
-		if(packet_type == UDP) //udp
-			payload = dump_UDP_packet(local_packets[i].data, &payload_length , local_packets[i].len); // Getting the payload
-		else //tcp
-			payload = dump_TCP_packet(local_packets[i].data, &payload_length , local_packets[i].len); // Getting the payload
-		if(payload != NULL) {  // Save payload into array of payload
-			local_payloads[i] = malloc(payload_length);
-			memcpy(local_payloads[i], payload, payload_length);
-		}
-		else { // If the packet is not valid we just save a " " string inside local array of payloads
-			local_payloads[i] = malloc(1);
-			memcpy(local_payloads[i], " ", 1);
+				if (chunk[0] > chunk_capacity) {
+					chunk_lens = realloc(chunk_lens, chunk[0]*sizeof(unsigned int));
+					chunk_capacity = chunk[0];
+				}
+				if (chunk[1] > chunk_data_capacity) {
+					chunk_data = realloc(chunk_data, chunk[1]);
+					chunk_data_capacity = chunk[1];
+				}
+				int offset = 0;
+				for (int k = first; k < next; k++) { //only the bytes in use of every Packet are sent
+					chunk_lens[k-first] = a[k].len;
+					memcpy(chunk_data + offset, a[k].data, a[k].len);
+					offset += a[k].len;
+				}
+				MPI_Send(chunk_lens, chunk[0], MPI_UNSIGNED, status.MPI_SOURCE, TAG_LENS, MPI_COMM_WORLD);
+				MPI_Send(chunk_data, chunk[1], MPI_CHAR, status.MPI_SOURCE, TAG_DATA, MPI_COMM_WORLD);
+				STAGE_END(STAGE_DISTRIBUTE);
+			}
+			free(chunk_lens);
+			free(chunk_data);
 		}
-	}
+		else { //worker: ask for a chunk, match it, repeat until the master says stop
+			unsigned int *chunk_lens = NULL;
+			char *chunk_data = NULL;
+			int chunk[2];
+			while (1) {
+				STAGE_BEGIN(STAGE_DISTRIBUTE);
+				MPI_Send(NULL, 0, MPI_INT, 0, TAG_REQUEST, MPI_COMM_WORLD);
+				MPI_Recv(chunk, 2, MPI_INT, 0, TAG_CHUNK, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				if (chunk[0] == 0) {
+					STAGE_END(STAGE_DISTRIBUTE);
+					break;
+				}
+				if (use_index) { //chunk[1] is the first entry of the chunk
+					STAGE_END(STAGE_DISTRIBUTE);
+					double busy_start = MPI_Wtime();
+					local_bytes += match_index_range(idx, selected + chunk[1], chunk[0], index_buffer, packet_type, array_of_strings, prefix_array, array_of_strings_length, local_string_count);
+					local_busy += MPI_Wtime() - busy_start;
+					continue;
+				}
+				chunk_lens = realloc(chunk_lens, chunk[0]*sizeof(unsigned int));
+				chunk_data = realloc(chunk_data, chunk[1]);
+				MPI_Recv(chunk_lens, chunk[0], MPI_UNSIGNED, 0, TAG_LENS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				MPI_Recv(chunk_data, chunk[1], MPI_CHAR, 0, TAG_DATA, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				STAGE_END(STAGE_DISTRIBUTE);
 
-	int *local_string_count = calloc(array_of_strings_length, sizeof(int));
-	int *global_string_count = calloc(array_of_strings_length, sizeof(int));
-	int **prefix_array = malloc(array_of_strings_length*sizeof(int*));
-	for (int i = 0; i < array_of_strings_length; i++) {
-		prefix_array[i] = kmp_prefix(array_of_strings[i]);
+				double busy_start = MPI_Wtime();
+				int offset = 0;
+				for (int k = 0; k < chunk[0]; k++) {
+					local_bytes += match_packet(chunk_data + offset, chunk_lens[k], packet_type, array_of_strings, prefix_array, array_of_strings_length, local_string_count);
+					offset += chunk_lens[k];
+				}
+				local_busy += MPI_Wtime() - busy_start;
+			}
+			free(chunk_lens);
+			free(chunk_data);
+		}
 	}
+	free(a);
+	free(weight);
+	free(index_buffer);
+	if (idx != NULL)
+		pcap_index_close(idx);
 
-	/* For each payload, we call the string matching algorithm for every string in S */
-	for (int k = 0; k < local_size[my_rank]; k++)
-		for (int i = 0; i < array_of_strings_length; i++)
-				local_string_count[i] += kmp_matcher(local_payloads[k],array_of_strings[i], prefix_array[i]);
-
+	STAGE_BEGIN(STAGE_REDUCE);
 	MPI_Reduce(local_string_count, global_string_count, array_of_strings_length, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD); //with this call, we get the total values in global_string_count
+	STAGE_END(STAGE_REDUCE);
 	local_finish = MPI_Wtime();
 	local_elapsed = local_finish - local_start;
 
 	MPI_Reduce(&local_elapsed, &elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+	GET_TIME(bench_finish); //rank 0 has read, sent, matched and received everything
+
+	/* Busy time of every rank, so that imbalance is visible and not hidden behind the MPI_MAX */
+	double *busy = NULL;
+	unsigned long long *bytes = NULL;
+	if (my_rank == 0) {
+		busy = malloc(comm_sz*sizeof(double));
+		bytes = malloc(comm_sz*sizeof(unsigned long long));
+	}
+	MPI_Gather(&local_busy, 1, MPI_DOUBLE, busy, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	MPI_Gather(&local_bytes, 1, MPI_UNSIGNED_LONG_LONG, bytes, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
 
 	if (my_rank == 0) {
 		printf("Printing the number of appereances of each string throughout the entire pcap file:\n");
 		for (int i = 0; i < array_of_strings_length; i++)
 			if(global_string_count[i] != 0)
 				printf("%s: %d times!\n", array_of_strings[i], global_string_count[i]);
-			// Now we print performance evaluation
+		// Now we print performance evaluation
+		print_rank_busy_time(busy, bytes, comm_sz, split == SPLIT_DYNAMIC ? 1 : 0);
 		printf("Elapsed time = %f seconds\n", elapsed);
+		print_bench_line(use_index ? (split == SPLIT_DYNAMIC ? "mpi_dumping-index-dynamic" : split == SPLIT_BYTES ? "mpi_dumping-index-bytes" : "mpi_dumping-index-count") :
+			split == SPLIT_DYNAMIC ? "mpi_dumping-dynamic" : split == SPLIT_BYTES ? "mpi_dumping-bytes" : "mpi_dumping-count",
+			comm_sz, 1, num_packets, total_bytes, bench_finish-bench_start);
+		free(busy);
+		free(bytes);
 	}
+#ifdef STAGE_PROFILE
+	char stage_label[64];
+	snprintf(stage_label, sizeof(stage_label), "mpi_dumping rank %d", my_rank);
+	for (int r = 0; r < comm_sz; r++) { //one rank at a time, so that the tables are not mixed up
+		if (r == my_rank) {
+			STAGE_REPORT(stage_label);
+			fflush(stdout);
+		}
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
+#endif
+
+	free(local_string_count);
+	free(global_string_count);
+	for (int i = 0; i < array_of_strings_length; i++) {
+		free(prefix_array[i]);
+	} free(prefix_array);
 
 	MPI_Type_free(&MPI_Packet);
 	MPI_Finalize();
 	return 0;
 }
 
+/* Function use to dump the payload of a packet and count the matches of every string into string_count
+* INPUT:
+*	data, len: the packet
+	packet_type: UDP or TCP
+	array_of_strings, prefix_array, array_of_strings_length: the patterns and their KMP prefix arrays
+	string_count: counters of the calling rank
+
+* OUTPUT
+	length of the payload that has been scanned
+*/
+unsigned int match_packet(char *data, unsigned int len, int packet_type, char **array_of_strings, int **prefix_array, int array_of_strings_length, int *string_count) {
+	char* payload;
+	unsigned int payload_length;
+	STAGE_BEGIN(STAGE_DECODE);
+	if(packet_type == UDP) //udp
+		payload = dump_UDP_packet(data, &payload_length, len); // Getting the payload
+	else //tcp
+		payload = dump_TCP_packet(data, &payload_length, len); // Getting the payload
+	STAGE_END(STAGE_DECODE);
+	if (payload == NULL) // If the packet is not valid there is nothing to match
+		return 0;
+
+	STAGE_BEGIN(STAGE_COPY);
+	char *text = malloc(payload_length+1); // kmp_matcher wants a string
+	memcpy(text, payload, payload_length);
+	text[payload_length] = '\0';
+	STAGE_END(STAGE_COPY);
+	STAGE_BEGIN(STAGE_MATCH);
+	for (int i = 0; i < array_of_strings_length; i++)
+		string_count[i] += kmp_matcher(text, array_of_strings[i], prefix_array[i]);
+	STAGE_END(STAGE_MATCH);
+	free(text);
+	return payload_length;
+}
+
+/* Function use to read with pread the packets of n index entries (the share of a rank or a chunk) and match them
+* INPUT:
+*	idx, entries, n: the index and the entries to read
+	buffer: room for the longest packet
+	the others as in match_packet
+
+* OUTPUT
+	length of the payloads that have been scanned
+*/
+unsigned long long match_index_range(struct pcap_index *idx, struct pcap_index_entry *entries, int n, char *buffer, int packet_type, char **array_of_strings, int **prefix_array, int array_of_strings_length, int *string_count) {
+	unsigned long long bytes = 0;
+	for (int k = 0; k < n; k++) {
+		STAGE_BEGIN(STAGE_READ);
+		int read = pcap_index_read(idx, &entries[k], buffer);
+		STAGE_END(STAGE_READ);
+		if (read)
+			bytes += match_packet(buffer, entries[k].caplen, packet_type, array_of_strings, prefix_array, array_of_strings_length, string_count);
+	}
+	return bytes;
+}
+
 int kmp_matcher (char text[], char pattern[], int *prefix_array) {
 	int text_len = strlen(text);
 	int pattern_len = strlen(pattern);
@@ -0,0 +1,404 @@
+/*	Compilation: mpicc -g -Wall -fopenmp mpi_openmp_hybrid.c -o mpi_openmp_hybrid -lpcap -lz
+	Usage: mpiexec -n <ranks> ./mpi_openmp_hybrid <file.pcap> <strings.txt> thread_number [tcp/udp] [task/data]
+	Suggested layout on multi-socket nodes (Open MPI): one rank per socket, one thread per core
+	mpiexec -n 2 --map-by socket --bind-to socket ./mpi_openmp_hybrid big_udp.pcap strings.txt 8 udp data
+	Rank 0 gives every rank a contiguous range of the packets with the same payload bytes (load_balance.h)
+	<file.pcap> can also be a directory, a glob pattern or @list: rank 0 loads every capture with its own
+	thread (thread_number of them) and the counts are printed together (input_files.h)
+	<file.pcap> can also be gzip-compressed, a BGZF one is decompressed by several threads (gz_capture.h)
+ */
+
+#define _GNU_SOURCE //fopencookie, see gz_capture.h
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pcap.h>
+#include <netinet/ip.h>
+#include <netinet/if_ether.h>
+#include "packet_dumping.h"
+#include "timer.h"
+#include "bench.h"
+#include "input_files.h"
+#include "load_balance.h"
+#include <omp.h>
+
+// PCAP packet struct
+typedef struct {
+	unsigned int len;
+	char data[65535];
+} Packet;
+
+
+#define UDP 0
+#define TCP 1
+
+#define TASK 0 // openmp_task.c like: one task every TASK_BATCH packets
+#define DATA 1 // openmp_data.c like: parallel for over payload x pattern
+
+#define TASK_BATCH 100
+
+/*Knuth-Morris-Pratt String Matching Algorithm's functions.*/
+int kmp_matcher (char text[], char pattern[], int *prefix_array);
+int* kmp_prefix (char pattern[]);
+
+int main (int argc, char *argv[]){
+	int my_rank, comm_sz, provided;
+	/* Only the master thread of every rank makes MPI calls */
+	MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+	/* Building MPI_Packet Datatype */
+	Packet dummy;
+	MPI_Datatype MPI_Packet;
+	int array_of_blocklengths[] = {1, 65535};
+	MPI_Aint array_of_displacements[2];
+	MPI_Aint len_addr, data_addr;
+	array_of_displacements[0] = 0;
+	MPI_Get_address(&dummy.len, &len_addr);
+	MPI_Get_address(&dummy.data, &data_addr);
+	array_of_displacements[1] = data_addr - len_addr;
+	MPI_Datatype array_of_types[] = {MPI_UNSIGNED, MPI_CHAR};
+	MPI_Type_create_struct(2, array_of_blocklengths, array_of_displacements, array_of_types, &MPI_Packet);
+	MPI_Type_commit(&MPI_Packet);
+
+	char *strings_file_path; //for storing path of file <strings.txt>
+	int thread_count;
+	int packet_type = UDP; //default udp
+	int mode = DATA; //default data parallel inside every rank
+
+	if (argc >= 4 && argc <= 6) {
+		strings_file_path = argv[2];
+		thread_count = atoi(argv[3]); //get thread number (per rank) from command-line
+		for (int i = 4; i < argc; i++) { //packet type and intra-rank mode can be given in any order
+			if (strcmp(argv[i], "udp") == 0)
+				packet_type = UDP;
+			else if (strcmp(argv[i], "tcp") == 0)
+				packet_type = TCP;
+			else if (strcmp(argv[i], "task") == 0)
+				mode = TASK;
+			else if (strcmp(argv[i], "data") == 0)
+				mode = DATA;
+			else {
+				if (my_rank == 0)
+					printf("USAGE ./mpi_openmp_hybrid <file.pcap> <strings.txt> thread_number [tcp/udp] [task/data]\n");
+				MPI_Finalize();
+				exit(1);
+			}
+		}
+	}
+	else {
+		if (my_rank == 0)
+			printf("USAGE: ./mpi_openmp_hybrid <file.pcap> <strings.txt> thread_number [tcp/udp] [task/data]\n");
+		MPI_Finalize();
+		exit(1);
+	}
+	if (provided < MPI_THREAD_FUNNELED && my_rank == 0)
+		fprintf(stderr, "warning: MPI library does not provide MPI_THREAD_FUNNELED\n");
+
+	/* Reading strings for the string matching from txt file */
+	char **array_of_strings = malloc(sizeof(char *)); // for storing the patterns for string matching
+	int array_of_strings_length = 1; //keeps track of array's size
+	int count = 0; //actual number of strings
+
+	//open file and check for errors
+	FILE *fp = fopen(strings_file_path,"r");
+	if (fp == NULL) {
+		perror("error opening file: ");
+		exit(1);
+	}
+	char str[100]; //buffer for saving the strings once pulled out by fscanf
+
+	while(fscanf(fp, "%99s", str) != EOF) //we read all the file word by word
+	{
+		if (count == array_of_strings_length) {
+			//it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
+			array_of_strings = (char **)realloc(array_of_strings, (array_of_strings_length*2)*sizeof(char *));
+			array_of_strings_length *= 2;
+		}
+		array_of_strings[count] = malloc(strlen(str)+1); //we have to allocate memory for this string
+		strcpy(array_of_strings[count], str); //copy string into array
+		count++; //actual number of strings have grown by 1
+	}
+	fclose(fp);
+
+	// If array is not full, we reallocate memory
+	if (!(count == array_of_strings_length))
+		array_of_strings = (char **)realloc(array_of_strings, (count*sizeof(char *)));
+	array_of_strings_length = count;
+
+
+	int num_packets, flag = 0; //flag is for errors
+	long long total_bytes = 0; //captured bytes, for the benchmark line of rank 0
+	double bench_start = 0, bench_finish;
+	Packet *a = NULL; //pointer (array) for MPI_Scatterv, it must be common between all processes
+	unsigned int *weight = NULL; //payload bytes of every packet, for the split of rank 0
+	if (my_rank == 0){ //rank 0 is in charge of gathering all Packets
+		char errbuff[PCAP_ERRBUF_SIZE];
+		struct pcap_pkthdr *header;
+		GET_TIME(bench_start); //the span of the benchmark line starts here, see bench.h
+		struct input_files files;
+		struct input_stream *pcap = NULL;
+		struct input_cursor loaded = {NULL, 0}; //a list of captures is loaded a file per thread, see input_load_files
+		if (input_files_expand(argv[1], &files) > 1)
+			loaded = (struct input_cursor){input_load_files(&files, READER_PCAP, thread_count), files.count};
+		else if (files.count > 0)
+			pcap = input_stream_open(&files, READER_PCAP, errbuff);
+		if (pcap == NULL && loaded.captures == NULL) {	//check error in pcap file opening
+			if (files.count == 1)
+				fprintf(stderr, "error reading pcap file: %s\n", errbuff);
+			flag = -1;
+		}
+		else {
+			a = malloc(sizeof(Packet));
+			weight = malloc(sizeof(unsigned int));
+			int size_a = 1; //keeps track of array's size
+			num_packets = 0;  //actual number of packets in array a
+			const unsigned char *data;
+			int i;
+			while ((i = pcap != NULL ? input_next_ex(pcap, &header, &data) : input_loaded_next(&loaded, &header, &data)) >= 0) {
+				if (header->caplen > sizeof(a[num_packets].data)) //bigger than the snaplen of a pcap file, cut as a capture would
+					header->caplen = sizeof(a[num_packets].data);
+				memcpy(a[num_packets].data, data, header->caplen); //we store the packet in the array of packets
+				a[num_packets].len = header->caplen; //we store the len of this packet inside the proper field in the structure
+				total_bytes += header->caplen;
+
+				/* The weight of a packet is the length of the payload the ranks are going to scan */
+				unsigned int payload_length = 0;
+				char *payload;
+				if (packet_type == UDP)
+					payload = dump_UDP_packet(a[num_packets].data, &payload_length, a[num_packets].len);
+				else
+					payload = dump_TCP_packet(a[num_packets].data, &payload_length, a[num_packets].len);
+				weight[num_packets] = (payload != NULL ? payload_length : 0) + PACKET_OVERHEAD_BYTES;
+
+				num_packets++; //actual number of packets has grown by 1
+				if (num_packets == size_a) {
+					a = realloc(a, (size_a*2)*sizeof(Packet)); //it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
+					weight = realloc(weight, (size_a*2)*sizeof(unsigned int));
+					size_a *= 2;
+				}
+			}
+			if (pcap != NULL)
+				input_stream_close(pcap);
+			else
+				input_captures_free(loaded.captures, loaded.count);
+			input_files_free(&files);
+			if (!(size_a == num_packets))
+				a = realloc(a, num_packets*sizeof(Packet)); //we reallocate memory to get even
+		}
+	}
+	/* Using MPI_Bcast to broadcast num packets and flag */
+	MPI_Bcast(&num_packets, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	MPI_Bcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	//we check for error in pcap file opening
+	if (flag == -1) {
+		MPI_Finalize();
+		return 0;
+	}
+
+
+	int *local_size = malloc(comm_sz*sizeof(int)); //array that stores the number of packets that each process must have
+	int *displ = malloc(comm_sz*sizeof(int)); //array of displacement for Scatterv
+
+	// Contiguous ranges of the same payload bytes, as mpi_dumping split=bytes: a rank with the jumbo payloads
+	// gets fewer packets
+	if (my_rank == 0)
+		byte_weighted_split(weight, num_packets, comm_sz, local_size, displ);
+	MPI_Bcast(local_size, comm_sz, MPI_INT, 0, MPI_COMM_WORLD);
+	MPI_Bcast(displ, comm_sz, MPI_INT, 0, MPI_COMM_WORLD);
+	free(weight);
+
+	Packet *local_packets = malloc(local_size[my_rank]*sizeof(Packet)); //every process allocates the memory needed for storing its share of Packets
+	MPI_Scatterv(a, local_size, displ, MPI_Packet, local_packets, local_size[my_rank], MPI_Packet, 0, MPI_COMM_WORLD);
+	free(a);
+
+	int local_count = local_size[my_rank];
+	int *local_string_count = calloc(array_of_strings_length, sizeof(int));
+	int *global_string_count = calloc(array_of_strings_length, sizeof(int));
+	int **prefix_array = malloc(array_of_strings_length*sizeof(int*));
+	for (int i = 0; i < array_of_strings_length; i++) {
+		prefix_array[i] = kmp_prefix(array_of_strings[i]);
+	}
+	char **local_payloads = malloc(local_count*sizeof(char*)); //we allocate memory for the local array of payloads
+
+	/*Start Performance Evaluation */
+	double local_start, local_finish, local_elapsed, elapsed;
+	MPI_Barrier(MPI_COMM_WORLD);
+	local_start = MPI_Wtime();
+
+	if (mode == DATA) {
+		/* Same two loops as openmp_data.c, restricted to the share of packets of this rank */
+		#pragma omp parallel for num_threads(thread_count) schedule(guided)
+		for (int i = 0; i < local_count; i++) {
+			char* payload;
+			unsigned int payload_length;
+			if(packet_type == UDP) //udp
+				payload = dump_UDP_packet(local_packets[i].data, &payload_length, local_packets[i].len); // Getting the payload
+			else //tcp
+				payload = dump_TCP_packet(local_packets[i].data, &payload_length, local_packets[i].len); // Getting the payload
+			if(payload != NULL) {  // Save payload into array of payload
+				local_payloads[i] = malloc(payload_length+1);
+				memcpy(local_payloads[i], payload, payload_length);
+				local_payloads[i][payload_length] = '\0';
+			}
+			else { // If the packet is not valid we just save a " " string inside local array of payloads
+				local_payloads[i] = malloc(2);
+				strcpy(local_payloads[i], " ");
+			}
+		}
+
+		#pragma omp parallel num_threads(thread_count)
+		{
+			int *private_string_count = calloc(array_of_strings_length, sizeof(int)); // Using calloc because we want to initialize every member to 0
+			// For each payload, we call the string matching algorithm for every string in S
+			#pragma omp for schedule(guided) collapse(2)
+			for (int k = 0; k < local_count; k++) //for every payload
+				for (int i = 0; i < array_of_strings_length; i++) //for every string
+					private_string_count[i] += kmp_matcher(local_payloads[k], array_of_strings[i], prefix_array[i]);
+
+			// Merge private string count into the rank string count array
+			for (int i = 0; i < array_of_strings_length; i++) {
+				#pragma omp atomic
+				local_string_count[i] += private_string_count[i];
+			}
+			free(private_string_count);
+		}
+	}
+	else {
+		/* Same producer as openmp_task.c: the single thread spawns a task every TASK_BATCH packets.
+		 * Packets are already in memory, so the task dumps the payloads too. */
+		#pragma omp parallel num_threads(thread_count)
+		{
+			#pragma omp single
+			{
+				for (int first = 0; first < local_count; first += TASK_BATCH) {
+					int last = first + TASK_BATCH < local_count ? first + TASK_BATCH : local_count;
+
+					#pragma omp task firstprivate(first, last) shared(local_string_count, local_packets, local_payloads)
+					{
+						int *private_string_count = calloc(array_of_strings_length, sizeof(int));
+						for (int k = first; k < last; k++) { //for every payload of the batch
+							char* payload;
+							unsigned int payload_length;
+							if(packet_type == UDP) //udp
+								payload = dump_UDP_packet(local_packets[k].data, &payload_length, local_packets[k].len);
+							else //tcp
+								payload = dump_TCP_packet(local_packets[k].data, &payload_length, local_packets[k].len);
+							if(payload != NULL) {
+								local_payloads[k] = malloc(payload_length+1);
+								memcpy(local_payloads[k], payload, payload_length);
+								local_payloads[k][payload_length] = '\0';
+							}
+							else {
+								local_payloads[k] = malloc(2);
+								strcpy(local_payloads[k], " ");
+							}
+							for (int i = 0; i < array_of_strings_length; i++) //for every string
+								private_string_count[i] += kmp_matcher(local_payloads[k], array_of_strings[i], prefix_array[i]);
+						}
+
+						// Merge private string count into the rank string count array
+						for (int i = 0; i < array_of_strings_length; i++) {
+							#pragma omp atomic
+							local_string_count[i] += private_string_count[i];
+						}
+						free(private_string_count);
+					}
+				}
+			} //end of single pragma, implicit barrier waits for every task
+		}
+	}
+
+	/* Back on the master thread: combine the per-rank counts */
+	MPI_Reduce(local_string_count, global_string_count, array_of_strings_length, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD); //with this call, we get the total values in global_string_count
+	local_finish = MPI_Wtime();
+	local_elapsed = local_finish - local_start;
+
+	MPI_Reduce(&local_elapsed, &elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+	GET_TIME(bench_finish); //rank 0 has read, sent, matched and received everything
+
+	if (my_rank == 0) {
+		printf("Printing the number of appereances of each string throughout the entire pcap file:\n");
+		for (int i = 0; i < array_of_strings_length; i++)
+			if(global_string_count[i] != 0)
+				printf("%s: %d times!\n", array_of_strings[i], global_string_count[i]);
+		// Now we print performance evaluation
+		printf("Layout: %d ranks x %d threads (%s)\n", comm_sz, thread_count, mode == DATA ? "data" : "task");
+		printf("Elapsed time = %f seconds\n", elapsed);
+		print_bench_line(mode == DATA ? "mpi_openmp_hybrid-data" : "mpi_openmp_hybrid-task", comm_sz, thread_count, num_packets, total_bytes, bench_finish-bench_start);
+	}
+
+	/* We have to free previously allocated memory */
+	for (int k = 0; k < local_count; k++) {
+		free(local_payloads[k]);
+	} free(local_payloads);
+	free(local_packets);
+	free(local_size);
+	free(displ);
+	free(local_string_count);
+	free(global_string_count);
+
+	for (int i = 0; i < array_of_strings_length; i++) {
+		free(prefix_array[i]);
+	} free(prefix_array);
+
+	for (int i = 0; i < array_of_strings_length; i++) {
+		free(array_of_strings[i]);
+	} free(array_of_strings);
+
+	MPI_Type_free(&MPI_Packet);
+	MPI_Finalize();
+	return 0;
+}
+
+int kmp_matcher (char text[], char pattern[], int *prefix_array) {
+	int text_len = strlen(text);
+	int pattern_len = strlen(pattern);
+	if (text_len < pattern_len) //no point trying to match things
+		return 0;
+	int i = 0;
+	int j = 0;
+	int occurrences = 0; //counter for the number of occurrences of pattern in text
+	while (i < text_len) {
+		if (pattern[j] == text[i]) {
+			j++;
+			i++;
+		}
+		if (j == pattern_len) { //we have a match
+			occurrences++;
+			j = prefix_array[j-1]; //look for next match
+		}
+		else if (i < text_len && pattern[j] != text[i]) {
+			if (j != 0)
+				j = prefix_array[j-1];
+			else
+				i++;
+		}
+	}
+	return occurrences;
+}
+
+int* kmp_prefix (char pattern[]) {
+	int pattern_len = strlen(pattern);
+	int *prefix = malloc(pattern_len*sizeof(int));
+	int j = 0;
+	prefix[0] = 0; //first letter does not have any prefix
+	int i = 1;
+	while (i < pattern_len) {
+		if (pattern[i] == pattern[j]){
+			prefix[i] = j + 1;
+			j++;
+			i++;
+		}
+		else if (j != 0) {
+			j = prefix[j-1];
+		}
+		else {
+			prefix[i] = 0;
+			i++;
+		}
+	}
+	return prefix;
+}
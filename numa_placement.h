@@ -0,0 +1,364 @@
+/*
+* Library that contain the NUMA placement of openmp_data (libnuma, link with -lnuma): every thread of the
+* team is pinned to a CPU chosen by the policy, the payloads a thread decodes are copied into an arena
+* allocated on the node of that thread, and every node gets its own copy of the automata, so that a
+* thread that matches the payloads it decoded reads only memory of its own node.
+* Policies, with the NUMA nodes standing for the sockets:
+*	compact: thread t on the t-th CPU, node after node, the threads share as few nodes as they can
+*	scatter: thread t on node t % nodes, the threads are dealt to the nodes like cards
+*	socket: the threads are split in equal blocks of consecutive threads, one block per node
+* The report tells how many of the loads of the matchers went to another node (node-load-misses over
+* node-loads of perf, when the CPU has them) and how many pages the kernel had to allocate on another
+* node than the one asked for (numastat), so that the policies can be compared along with the throughput.
+*
+* Usage:
+*	struct numa_placement *numa = numa_placement_create(NUMA_SCATTER, thread_count);	// before any team
+*	#pragma omp parallel: numa_pin_thread(numa, omp_get_thread_num());
+*	char *copy = numa_arena_alloc(&numa->arena[omp_get_thread_num()], len);
+*	const struct ac_automaton *ac = numa_replica(numa, plan->groups, g);
+*	numa_placement_print(numa); numa_placement_free(numa);
+*/
+#ifndef _NUMA_PLACEMENT_H_
+#define _NUMA_PLACEMENT_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <numa.h>
+#include "aho_corasick.h"
+#include "huge_pages.h"
+
+#define NUMA_OFF 0
+#define NUMA_COMPACT 1
+#define NUMA_SCATTER 2
+#define NUMA_SOCKET 3
+
+#define NUMA_ARENA_BLOCK (4 << 20)	// bytes the arenas ask to the node at a time
+#define NUMA_CHUNK 64			// payloads per chunk of the static schedule shared by decoding and matching
+
+/* Bump allocator on one node, freed all at once */
+struct numa_arena {
+	int node;
+	char *block;			// block being filled
+	size_t used, size;
+	char **blocks;			// every block, for numa_free
+	size_t *sizes;
+	int count, capacity;
+	int huge;			// ask for transparent huge pages on the blocks (huge_pages.h)
+};
+
+struct numa_placement {
+	int policy;
+	int nodes;			// configured NUMA nodes
+	int threads;
+	int *cpu;			// CPU of every thread, -1 if it could not be pinned
+	int *node;			// node of every thread
+	struct numa_arena *arena;	// one per thread, on the node of the thread
+	struct ac_automaton ***replica;	// replica[node][g]: copy of automaton g on node, NULL until numa_replicate
+	int replica_count;
+	long long node_loads, node_misses;	// perf counters of the matchers, summed
+	int perf_available;
+	unsigned long long numastat_start[2];	// local_node and other_node of all the nodes when the run starts
+};
+
+/* Function use to get the policy named by name
+* OUTPUT
+	NUMA_COMPACT/SCATTER/SOCKET, -1 if the name is unknown
+*/
+int numa_policy_kind(const char *name) {
+	if (strcmp(name, "compact") == 0)
+		return NUMA_COMPACT;
+	if (strcmp(name, "scatter") == 0)
+		return NUMA_SCATTER;
+	if (strcmp(name, "socket") == 0)
+		return NUMA_SOCKET;
+	return -1;
+}
+
+const char *numa_policy_name(int policy) {
+	const char *names[] = {"off", "compact", "scatter", "socket"};
+	return names[policy];
+}
+
+/* Function use to add up local_node and other_node of the numastat of every node */
+static void numa_read_numastat(int nodes, unsigned long long *stat) {
+	stat[0] = stat[1] = 0;
+	for (int n = 0; n < nodes; n++) {
+		char path[128], name[64];
+		unsigned long long value;
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/numastat", n);
+		FILE *f = fopen(path, "r");
+		if (f == NULL)
+			continue;
+		while (fscanf(f, "%63s %llu", name, &value) == 2) {
+			if (strcmp(name, "local_node") == 0)
+				stat[0] += value;
+			else if (strcmp(name, "other_node") == 0)
+				stat[1] += value;
+		}
+		fclose(f);
+	}
+}
+
+/* Function use to choose the CPU of every thread with the policy, among the CPUs the process may use
+* OUTPUT
+	the placement, NULL (with a message) if the system has no NUMA support
+*/
+struct numa_placement *numa_placement_create(int policy, int threads) {
+	if (numa_available() < 0) {
+		fprintf(stderr, "numa: the system has no NUMA support\n");
+		return NULL;
+	}
+	struct numa_placement *p = calloc(1, sizeof(struct numa_placement));
+	p->policy = policy;
+	p->nodes = numa_num_configured_nodes();
+	p->threads = threads;
+	p->cpu = malloc(threads * sizeof(int));
+	p->node = malloc(threads * sizeof(int));
+	p->arena = calloc(threads, sizeof(struct numa_arena));
+
+	// CPUs of every node that the process is allowed to use
+	int cpus = numa_num_configured_cpus();
+	int **node_cpu = malloc(p->nodes * sizeof(int *));
+	int *node_cpus = calloc(p->nodes, sizeof(int));
+	struct bitmask *allowed = numa_allocate_cpumask();
+	numa_sched_getaffinity(0, allowed);
+	for (int n = 0; n < p->nodes; n++) {
+		node_cpu[n] = malloc(cpus * sizeof(int));
+		struct bitmask *mask = numa_allocate_cpumask();
+		if (numa_node_to_cpus(n, mask) == 0)
+			for (int c = 0; c < cpus; c++)
+				if (numa_bitmask_isbitset(mask, c) && numa_bitmask_isbitset(allowed, c))
+					node_cpu[n][node_cpus[n]++] = c;
+		numa_free_cpumask(mask);
+	}
+	numa_free_cpumask(allowed);
+	int *with_cpus = malloc(p->nodes * sizeof(int)); //nodes that have CPUs for us, memory-only nodes are left out
+	int used_nodes = 0;
+	for (int n = 0; n < p->nodes; n++)
+		if (node_cpus[n] > 0)
+			with_cpus[used_nodes++] = n;
+
+	for (int t = 0; t < threads; t++) {
+		int n = 0, k = t;
+		if (policy == NUMA_COMPACT) { //t-th CPU counting node after node
+			int total = 0;
+			for (int u = 0; u < used_nodes; u++)
+				total += node_cpus[with_cpus[u]];
+			k = total > 0 ? t % total : 0;
+			while (n < used_nodes - 1 && k >= node_cpus[with_cpus[n]])
+				k -= node_cpus[with_cpus[n++]];
+		}
+		else if (policy == NUMA_SCATTER) {
+			n = used_nodes > 0 ? t % used_nodes : 0;
+			k = used_nodes > 0 ? t / used_nodes : 0;
+		}
+		else { //socket: block n has the threads [n*threads/used_nodes, (n+1)*threads/used_nodes)
+			n = used_nodes > 0 ? (long)t * used_nodes / threads : 0;
+			k = t - (n * threads + used_nodes - 1) / used_nodes;
+		}
+		if (used_nodes == 0) {
+			p->cpu[t] = -1;
+			p->node[t] = 0;
+			continue;
+		}
+		p->node[t] = with_cpus[n];
+		p->cpu[t] = node_cpu[with_cpus[n]][k % node_cpus[with_cpus[n]]];
+	}
+	for (int t = 0; t < threads; t++)
+		p->arena[t].node = p->node[t];
+	for (int n = 0; n < p->nodes; n++)
+		free(node_cpu[n]);
+	free(node_cpu);
+	free(node_cpus);
+	free(with_cpus);
+	numa_read_numastat(p->nodes, p->numastat_start);
+	return p;
+}
+
+/* Function use to pin the calling thread, thread number thread of the team, to its CPU */
+void numa_pin_thread(struct numa_placement *p, int thread) {
+	if (thread >= p->threads || p->cpu[thread] < 0)
+		return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(p->cpu[thread], &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0)
+		perror("numa: sched_setaffinity");
+	numa_set_preferred(p->node[thread]); //what the thread allocates goes to its node
+}
+
+/* Function use to get len bytes from an arena, on the node of the arena */
+char *numa_arena_alloc(struct numa_arena *a, size_t len) {
+	if (a->block == NULL || a->used + len > a->size) {
+		size_t size = len > NUMA_ARENA_BLOCK ? len : NUMA_ARENA_BLOCK;
+		if (a->count == a->capacity) {
+			a->capacity = a->capacity ? a->capacity * 2 : 16;
+			a->blocks = realloc(a->blocks, a->capacity * sizeof(char *));
+			a->sizes = realloc(a->sizes, a->capacity * sizeof(size_t));
+		}
+		a->block = numa_alloc_onnode(size, a->node);
+		if (a->block == NULL) {
+			fprintf(stderr, "numa: cannot allocate %zu bytes on node %d\n", size, a->node);
+			exit(1);
+		}
+		if (a->huge)
+			huge_advise(a->block, size);
+		a->blocks[a->count] = a->block;
+		a->sizes[a->count++] = size;
+		a->used = 0;
+		a->size = size;
+	}
+	char *m = a->block + a->used;
+	a->used += (len + 15) & ~(size_t)15;
+	return m;
+}
+
+/* Function use to give back every block of an arena */
+void numa_arena_reset(struct numa_arena *a) {
+	for (int k = 0; k < a->count; k++)
+		numa_free(a->blocks[k], a->sizes[k]);
+	a->count = 0;
+	a->block = NULL;
+	a->used = a->size = 0;
+}
+
+static void *numa_copy_onnode(const void *data, size_t bytes, int node) {
+	void *copy = numa_alloc_onnode(bytes > 0 ? bytes : 1, node);
+	if (copy == NULL) {
+		fprintf(stderr, "numa: cannot allocate %zu bytes on node %d\n", bytes, node);
+		exit(1);
+	}
+	memcpy(copy, data, bytes);
+	return copy;
+}
+
+/* Function use to copy every automaton of groups on every node that has threads */
+void numa_replicate(struct numa_placement *p, struct ac_automaton **groups, int count) {
+	p->replica = calloc(p->nodes, sizeof(struct ac_automaton **));
+	p->replica_count = count;
+	for (int t = 0; t < p->threads; t++) {
+		int n = p->node[t];
+		if (p->replica[n] != NULL)
+			continue;
+		p->replica[n] = malloc(count * sizeof(struct ac_automaton *));
+		for (int g = 0; g < count; g++) {
+			const struct ac_automaton *ac = groups[g];
+			struct ac_automaton *r = numa_copy_onnode(ac, sizeof(*ac), n);
+			int outputs = ac->out_start[ac->state_count];
+			r->next = numa_copy_onnode(ac->next, ac_table_bytes(ac->state_count), n);
+			r->out_start = numa_copy_onnode(ac->out_start, (ac->state_count + 1) * sizeof(int), n);
+			r->out_list = numa_copy_onnode(ac->out_list, outputs * sizeof(int), n);
+			r->out_len = numa_copy_onnode(ac->out_len, outputs * sizeof(int), n);
+			p->replica[n][g] = r;
+		}
+	}
+}
+
+/* Function use to get the automata the calling thread should use: the replicas of its node, or groups */
+struct ac_automaton **numa_replica(struct numa_placement *p, struct ac_automaton **groups, int thread) {
+	if (p == NULL || p->replica == NULL || thread >= p->threads)
+		return groups;
+	return p->replica[p->node[thread]];
+}
+
+/* Function use to open, on the calling thread, the counters of the loads that went to any node and of
+ * those that went to another node
+* OUTPUT
+	the group fd, -1 if the CPU does not count them
+*/
+int numa_counters_open(void) {
+	int group = -1;
+	for (int c = 0; c < 2; c++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			((c == 0 ? PERF_COUNT_HW_CACHE_RESULT_ACCESS : PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+		attr.disabled = c == 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		int fd = syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+		if (fd < 0) {
+			if (group >= 0)
+				close(group);
+			return -1;
+		}
+		if (c == 0)
+			group = fd;
+	}
+	ioctl(group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return group;
+}
+
+/* Function use to add the counts of a thread to the placement and close its counters */
+void numa_counters_close(struct numa_placement *p, int group) {
+	unsigned long long values[3];
+	if (group < 0)
+		return;
+	if (read(group, values, sizeof(values)) == sizeof(values)) {
+		#pragma omp atomic
+		p->node_loads += values[1];
+		#pragma omp atomic
+		p->node_misses += values[2];
+		#pragma omp atomic write
+		p->perf_available = 1;
+	}
+	close(group);
+}
+
+/* Function use to print the placement of the threads and what went to other nodes */
+void numa_placement_print(struct numa_placement *p) {
+	printf("NUMA policy %s, %d nodes, CPU/node of every thread:", numa_policy_name(p->policy), p->nodes);
+	for (int t = 0; t < p->threads; t++)
+		printf(" %d/%d", p->cpu[t], p->node[t]);
+	printf("\n");
+	if (p->perf_available)
+		printf("NUMA remote loads of the matchers = %.2f%% (%lld of %lld node loads)\n",
+			p->node_loads > 0 ? 100.0 * p->node_misses / p->node_loads : 0, p->node_misses, p->node_loads);
+	else
+		printf("NUMA remote loads of the matchers: not counted by this CPU (perf node-loads)\n");
+	unsigned long long now[2];
+	numa_read_numastat(p->nodes, now);
+	unsigned long long local = now[0] - p->numastat_start[0], other = now[1] - p->numastat_start[1];
+	printf("NUMA pages allocated on another node = %.2f%% (%llu of %llu, numastat of the whole system)\n",
+		local + other > 0 ? 100.0 * other / (local + other) : 0, other, local + other);
+}
+
+void numa_placement_free(struct numa_placement *p) {
+	for (int t = 0; t < p->threads; t++) {
+		numa_arena_reset(&p->arena[t]);
+		free(p->arena[t].blocks);
+		free(p->arena[t].sizes);
+	}
+	if (p->replica != NULL) {
+		for (int n = 0; n < p->nodes; n++) {
+			if (p->replica[n] == NULL)
+				continue;
+			for (int g = 0; g < p->replica_count; g++) {
+				struct ac_automaton *r = p->replica[n][g];
+				int outputs = r->out_start[r->state_count];
+				numa_free(r->next, ac_table_bytes(r->state_count));
+				numa_free(r->out_list, outputs * sizeof(int) > 0 ? outputs * sizeof(int) : 1);
+				numa_free(r->out_len, outputs * sizeof(int) > 0 ? outputs * sizeof(int) : 1);
+				numa_free(r->out_start, (r->state_count + 1) * sizeof(int));
+				numa_free(r, sizeof(*r));
+			}
+			free(p->replica[n]);
+		}
+		free(p->replica);
+	}
+	free(p->arena);
+	free(p->cpu);
+	free(p->node);
+	free(p);
+}
+
+#endif
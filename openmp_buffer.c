@@ -0,0 +1,208 @@
+/* 	Compilation: gcc -g -Wall -fopenmp openmp_buffer.c -o openmp_buffer
+	Usage: ./openmp_buffer <file> <string.txt> thread_number [chunk_bytes]
+	The whole file (a reassembled stream, a dump, any single large object) is scanned as one buffer:
+	it is cut into chunks overlapping by max_pattern_len-1 bytes and the chunks are matched in parallel
+	<file> can also be a directory, a glob pattern or @list (input_files.h): the files are loaded in
+	parallel, one per thread, and the chunks of all of them are matched by the whole team (a match never
+	spans two files), the counts are printed together; a file that cannot be read is reported and left out
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "chunked_scan.h"
+#define INPUT_FILES_NO_STREAM //only the list of files, no libpcap
+#include "input_files.h"
+#include <omp.h>
+
+/*Knuth-Morris-Pratt String Matching Algorithm's functions.*/
+int* kmp_prefix (char pattern[]);
+
+char *load_file(const char *filepath, long *text_len);
+
+int main(int argc, char *argv[]) {
+	char *filepath;
+	char *strings_file_path;
+	int thread_count;
+	int chunk_bytes = DEFAULT_CHUNK_BYTES;
+
+	if (argc == 4 || argc == 5) {
+		filepath = argv[1]; //get filename from command-line
+		strings_file_path = argv[2];
+		thread_count = atoi(argv[3]); //get thread number from command-line
+		if (argc == 5)
+			chunk_bytes = atoi(argv[4]);
+		if (chunk_bytes <= 0) {
+			printf("USAGE ./openmp_buffer <file> <string.txt> thread_number [chunk_bytes]\n");
+			exit(1);
+		}
+	}
+	else {
+		printf("USAGE: ./openmp_buffer <file> <string.txt> thread_number [chunk_bytes]\n");
+		exit(1);
+	}
+
+	/* Reading strings for the string matching from txt file */
+	char **array_of_strings = malloc(sizeof(char *));
+	int array_of_strings_length = 1; //keeps track of array's size
+	int count = 0; //actual number of strings
+
+	FILE *fp = fopen(strings_file_path, "r");
+	if (fp == NULL) {
+		perror("error opening file: ");
+		exit(1);
+	}
+	char str[100]; //buffer for saving the strings once pulled out by fscanf
+
+	while (fscanf(fp, "%99s", str) != EOF) { //we read all the file word by word
+		if (count == array_of_strings_length) {
+			//it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
+			array_of_strings = (char **)realloc(array_of_strings, (array_of_strings_length*2)*sizeof(char *));
+			array_of_strings_length *= 2;
+		}
+		array_of_strings[count] = malloc(strlen(str)+1);
+		strcpy(array_of_strings[count], str);
+		count++;
+	}
+	fclose(fp);
+	array_of_strings_length = count;
+
+	int **prefix_array = malloc(array_of_strings_length*sizeof(int*));
+	for (int i = 0; i < array_of_strings_length; i++) {
+		prefix_array[i] = kmp_prefix(array_of_strings[i]);
+	}
+	int max_pattern_len = max_string_length(array_of_strings, array_of_strings_length);
+
+	/* Now we load every file as a single buffer, the files in parallel */
+	struct input_files files;
+	if (input_files_expand(filepath, &files) == 0)
+		exit(1);
+	char **texts = malloc(files.count*sizeof(char *));
+	long *text_lens = malloc(files.count*sizeof(long));
+	#pragma omp parallel for num_threads(thread_count) schedule(dynamic)
+	for (int f = 0; f < files.count; f++)
+		texts[f] = load_file(files.paths[f], &text_lens[f]);
+	int loaded = 0;
+	for (int f = 0; f < files.count; f++)
+		loaded += texts[f] != NULL;
+	if (loaded == 0)
+		exit(1);
+
+	/* The chunks of all the files, first_chunk[f] is the first chunk of file f */
+	int *first_chunk = malloc((files.count+1)*sizeof(int));
+	long text_len = 0;
+	first_chunk[0] = 0;
+	for (int f = 0; f < files.count; f++) {
+		first_chunk[f+1] = first_chunk[f] + chunk_count(text_lens[f], chunk_bytes);
+		text_len += text_lens[f];
+	}
+	int chunks = first_chunk[files.count];
+	int *string_count = calloc(array_of_strings_length, sizeof(int));
+
+	double start = omp_get_wtime();
+
+	#pragma omp parallel num_threads(thread_count)
+	{
+		int *private_string_count = calloc(array_of_strings_length, sizeof(int));
+		int f = 0; //file of the last chunk, chunks come in increasing order to every thread
+
+		#pragma omp for schedule(dynamic)
+		for (int c = 0; c < chunks; c++) {
+			while (c >= first_chunk[f+1])
+				f++;
+			match_chunk(texts[f], text_lens[f], c - first_chunk[f], chunk_bytes, array_of_strings, prefix_array, array_of_strings_length, max_pattern_len, private_string_count);
+		}
+
+		// Merge private string count into shared string count array
+		for (int i = 0; i < array_of_strings_length; i++) {
+			#pragma omp atomic
+			string_count[i] += private_string_count[i];
+		}
+		free(private_string_count);
+	}
+
+	double finish = omp_get_wtime();
+
+	printf("Printing the number of appereances of each string throughout the entire file:\n");
+	for (int i = 0; i < array_of_strings_length; i++)
+		if (string_count[i] != 0)
+			printf("%s: %d times!\n", array_of_strings[i], string_count[i]);
+
+	printf("%ld bytes, %d chunks of %d bytes", text_len, chunks, chunk_bytes);
+	if (files.count > 1)
+		printf(", %d files", loaded);
+	printf("\n");
+	printf("Elapsed time = %f seconds\n", finish-start);
+
+	/* We have to free previously allocated memory */
+	for (int f = 0; f < files.count; f++)
+		free(texts[f]);
+	free(texts);
+	free(text_lens);
+	free(first_chunk);
+	input_files_free(&files);
+	free(string_count);
+	for (int i = 0; i < array_of_strings_length; i++) {
+		free(prefix_array[i]);
+	} free(prefix_array);
+	for (int i = 0; i < array_of_strings_length; i++) {
+		free(array_of_strings[i]);
+	} free(array_of_strings);
+
+	return 0;
+}
+
+/* Function use to load a whole file into a buffer
+* OUTPUT
+	the buffer, its length in *text_len; NULL and a length of 0 (no chunks) if the file cannot be read
+*/
+char *load_file(const char *filepath, long *text_len) {
+	*text_len = 0;
+	FILE *fp = fopen(filepath, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "error opening file %s: %s, skipping it\n", filepath, strerror(errno));
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	long len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (len > 0x7fffffff) { //chunk offsets are int
+		fprintf(stderr, "error: %s is larger than 2GB, skipping it\n", filepath);
+		fclose(fp);
+		return NULL;
+	}
+	char *text = malloc(len > 0 ? len : 1);
+	if (fread(text, 1, len, fp) != (size_t)len) {
+		fprintf(stderr, "error reading file %s: %s, skipping it\n", filepath, strerror(errno));
+		fclose(fp);
+		free(text);
+		return NULL;
+	}
+	fclose(fp);
+	*text_len = len;
+	return text;
+}
+
+int* kmp_prefix (char pattern[]) {
+	int pattern_len = strlen(pattern);
+	int *prefix = malloc(pattern_len*sizeof(int));
+	int j = 0;
+	prefix[0] = 0; //first letter does not have any prefix
+	int i = 1;
+	while (i < pattern_len) {
+		if (pattern[i] == pattern[j]){
+			prefix[i] = j + 1;
+			j++;
+			i++;
+		}
+		else if (j != 0) {
+			j = prefix[j-1];
+		}
+		else {
+			prefix[i] = 0;
+			i++;
+		}
+	}
+	return prefix;
+}
@@ -1,7 +1,49 @@
-/* 	Compilation: gcc -g -Wall -fopenmp openmp_data.c -o openmp_data -lpcap
-	Usage: ./openmp_data <file.pcap> <string.txt> thread_number [tcp/udp]
+/* 	Compilation: gcc -g -Wall -fopenmp openmp_data.c -o openmp_data -lpcap -lz -lnuma
+	(add -DSTAGE_PROFILE, and -DSTAGE_PERF for hardware counters, to get the per-stage profile of stage_profile.h)
+	Usage: ./openmp_data <file.pcap> <string.txt>[,<string.txt>...] thread_number [tcp/udp] [guided/steal] [chunk=<bytes>]
+		[engine=kmp/ac] [partition=auto/data/pattern] [cache=<bytes>] [dedup=on/off/<entries>] [resume] [index]
+		[reader=pcap/mmap/uring] [window[=<MB>]] [numa=compact/scatter/socket] [huge] [interleave[=<lanes>]] [ports]
+	guided (default): omp for schedule(guided) over payload x string
+	steal: per-thread deques of byte sized work items with randomized stealing (work_stealing.h)
+	chunk: payloads longer than this are cut into overlapping chunks scanned by the whole team
+	(chunked_scan.h), default DEFAULT_CHUNK_BYTES, chunk=0 disables it
+	engine: kmp (default) runs kmp_matcher once per string, ac scans the payload once with an
+	Aho-Corasick automaton of all the strings (aho_corasick.h)
+	partition (ac only): data splits payloads between threads, pattern splits the strings into
+	sub-automata of at most cache bytes (default the L2 size) and every group of threads sees every
+	payload, auto lets the planner of pattern_partition.h choose; best with OMP_PROC_BIND=close OMP_PLACES=cores
+	dedup (guided schedule, data partition): keep the match vector of up to that many payloads (on:
+	DEFAULT_PAYLOAD_CACHE_ENTRIES) so that a byte-identical payload is not scanned again (payload_cache.h)
+	resume: scan only the records appended since the previous resume run and print the totals of all of
+	them, the state is kept in <file.pcap>.state (incremental_state.h)
+	index: read the packets of the selected protocol in parallel through <file.pcap>.idx, built by the
+	first run and extended when the capture grows (pcap_index.h)
+	<file.pcap> can also be a directory, a glob pattern or @list: the packets of all the captures are
+	matched together and the counts printed in one report (input_files.h), every capture of the list is
+	parsed by its own thread (without window); resume and index need a single capture
+	reader: read path of the captures, pcap_next_ex (default), mmap or io_uring (capture_reader.h)
+	<file.pcap> can also be gzip-compressed, a BGZF one is decompressed by several threads (gz_capture.h)
+	window: streaming mode, the packets are read into two windows of <MB> MB (DEFAULT_WINDOW_MB) and
+	a reader thread fills one while the team decodes and matches the other, so the memory does not grow
+	with the size of the captures (packet_window.h)
+	numa (ac, guided, data partition): pin the threads with the policy, decode every payload into an arena
+	on the node of the thread that is going to match it (the payload loops become schedule(static,
+	NUMA_CHUNK), a big payload is not cut into chunks) and give every node a copy of the automata; the
+	remote loads and the pages allocated off-node are printed (numa_placement.h)
+	huge: packets, payloads and the transition tables of the automata in 2 MB pages (MAP_HUGETLB, else
+	transparent huge pages, else 4 KB pages), THP asked on the windows, the mmap of the capture and the
+	numa arenas too; how the memory has been backed is printed (huge_pages.h)
+	interleave (ac only): every thread scans <lanes> payloads (default AC_DEFAULT_LANES, at most
+	AC_MAX_LANES) in lock-step through the automaton, so that their cache misses overlap (aho_corasick.h);
+	the dedup loop still scans one payload at a time
+	ports (ac only): the strings can be tagged with a protocol and a destination port (word@udp:1900,
+	word@tcp, word@any:53) and every port gets an automaton of its strings and the untagged ones; a
+	packet is scanned only with the automaton of its destination port (port_groups.h)
+	<string.txt> can be several files separated by commas: a string in more than one of them is matched
+	once, and every file gets a report of its own (pattern_sets.h)
  */
 
+#define _GNU_SOURCE //fopencookie, see gz_capture.h
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,142 +52,298 @@
 #include <netinet/if_ether.h>
 #include "timer.h"
 #include "packet_dumping.h"
+#include "packet_decode.h"
+#include "work_stealing.h"
+#include "chunked_scan.h"
+#include "pattern_partition.h"
+#include "bench.h"
+#include "stage_profile.h"
+#include "payload_cache.h"
+#include "incremental_state.h"
+#include "pcap_index.h"
+#include "input_files.h"
+#include "packet_window.h"
+#include "numa_placement.h"
+#include "huge_pages.h"
+#include "port_groups.h"
+#include "pattern_sets.h"
 #include <omp.h>
 
-struct pkt_str {
-	unsigned char *data;
-	unsigned int len;
-};
-
 #define UDP 0
 #define TCP 1
 
+#define GUIDED 0
+#define STEAL 1
+
+#define KMP 0
+#define AC 1
+
+/* In pattern parallel mode the threads sharing a sub-automaton take payloads in batches of this size */
+#define PATTERN_BATCH 64
+
 /*Knuth-Morris-Pratt String Matching Algorithm's functions.*/
 int kmp_matcher (char text[], char pattern[], int *prefix_array);
 int* kmp_prefix (char pattern[]);
 
 int main(int argc, char *argv[]) {
-	pcap_t *pcap;	//pointer to the pcap file
+	struct input_stream *pcap = NULL;	//packets of the pcap files, one after the other
 	char errbuf[PCAP_ERRBUF_SIZE];
 	char *filepath;
 	char *strings_file_path;
 	int thread_count;
 	int packet_type = UDP; //default udp
-
-	if (argc==4 || argc ==5) {
+	int schedule = GUIDED; //default omp guided schedule
+	int chunk_bytes = DEFAULT_CHUNK_BYTES; //payloads longer than this are scanned in parallel chunks
+	int engine = KMP; //default one kmp_matcher call per string
+	int partition = PARTITION_AUTO; //let the planner choose between data and pattern parallel
+	long cache_bytes = 0; //budget of a sub-automaton, 0 for the L2 size
+	int dedup_entries = 0; //size of the payload cache, 0 for no cache
+	int resume = 0; //incremental scan
+	int use_index = 0; //read through the record index
+	int reader = READER_PCAP; //read path
+	long long window_mb = 0; //streaming mode with windows of this many MB, 0 to read everything first
+	int numa_policy = NUMA_OFF; //thread pinning and memory placement
+	int huge = 0; //huge pages for packets, payloads and automata
+	int lanes = 0; //payloads scanned together by the automaton, 0 for one at a time
+	int port_dispatch = 0; //one automaton per destination port
+
+	if (argc >= 4) {
 		filepath = argv[1]; //get filename from command-line
 		strings_file_path = argv[2];
 		thread_count = atoi(argv[3]); //get thread number from command-line
 
-		if(argc == 5) { //get packet type from command-line
-			if(strcmp(argv[4], "udp") == 0)
+		for (int a = 4; a < argc; a++) { //get packet type and schedule from command-line
+			if(strcmp(argv[a], "udp") == 0)
 				packet_type=UDP;
-			else if (strcmp(argv[4], "tcp") == 0)
+			else if (strcmp(argv[a], "tcp") == 0)
 				packet_type=TCP;
+			else if (strcmp(argv[a], "guided") == 0)
+				schedule=GUIDED;
+			else if (strcmp(argv[a], "steal") == 0)
+				schedule=STEAL;
+			else if (strncmp(argv[a], "chunk=", 6) == 0)
+				chunk_bytes = atoi(argv[a] + 6);
+			else if (strcmp(argv[a], "engine=kmp") == 0)
+				engine=KMP;
+			else if (strcmp(argv[a], "engine=ac") == 0)
+				engine=AC;
+			else if (strcmp(argv[a], "partition=auto") == 0)
+				partition=PARTITION_AUTO;
+			else if (strcmp(argv[a], "partition=data") == 0)
+				partition=PARTITION_DATA;
+			else if (strcmp(argv[a], "partition=pattern") == 0)
+				partition=PARTITION_PATTERN;
+			else if (strncmp(argv[a], "cache=", 6) == 0)
+				cache_bytes = atol(argv[a] + 6);
+			else if (strcmp(argv[a], "dedup=on") == 0)
+				dedup_entries = DEFAULT_PAYLOAD_CACHE_ENTRIES;
+			else if (strcmp(argv[a], "dedup=off") == 0)
+				dedup_entries = 0;
+			else if (strncmp(argv[a], "dedup=", 6) == 0)
+				dedup_entries = atoi(argv[a] + 6);
+			else if (strcmp(argv[a], "resume") == 0)
+				resume = 1;
+			else if (strcmp(argv[a], "index") == 0)
+				use_index = 1;
+			else if (strncmp(argv[a], "reader=", 7) == 0 && reader_kind(argv[a] + 7) >= 0)
+				reader = reader_kind(argv[a] + 7);
+			else if (strcmp(argv[a], "window") == 0)
+				window_mb = DEFAULT_WINDOW_MB;
+			else if (strncmp(argv[a], "window=", 7) == 0)
+				window_mb = atoll(argv[a] + 7);
+			else if (strncmp(argv[a], "numa=", 5) == 0 && numa_policy_kind(argv[a] + 5) > 0)
+				numa_policy = numa_policy_kind(argv[a] + 5);
+			else if (strcmp(argv[a], "huge") == 0)
+				huge = 1;
+			else if (strcmp(argv[a], "interleave") == 0)
+				lanes = AC_DEFAULT_LANES;
+			else if (strncmp(argv[a], "interleave=", 11) == 0 && atoi(argv[a] + 11) > 0)
+				lanes = atoi(argv[a] + 11) < AC_MAX_LANES ? atoi(argv[a] + 11) : AC_MAX_LANES;
+			else if (strcmp(argv[a], "ports") == 0)
+				port_dispatch = 1;
 			else {
-				printf("USAGE ./openmp_data <file.pcap> <string.txt> thread_number [tcp/udp]\n");
+				printf("USAGE ./openmp_data <file.pcap> <string.txt>[,<string.txt>...] thread_number [tcp/udp] [guided/steal] [chunk=<bytes>] [engine=kmp/ac] [partition=auto/data/pattern] [cache=<bytes>] [dedup=on/off/<entries>] [resume] [index] [reader=pcap/mmap/uring] [window[=<MB>]] [numa=compact/scatter/socket] [huge] [interleave[=<lanes>]] [ports]\n");
 				exit(1);
 			}
 		}
 	}
 	else {
-		printf("USAGE: ./openmp_data <file.pcap> <string.txt> thread_number [tcp/udp]\n");
+		printf("USAGE: ./openmp_data <file.pcap> <string.txt>[,<string.txt>...] thread_number [tcp/udp] [guided/steal] [chunk=<bytes>] [engine=kmp/ac] [partition=auto/data/pattern] [cache=<bytes>] [dedup=on/off/<entries>] [resume] [index] [reader=pcap/mmap/uring] [window[=<MB>]] [numa=compact/scatter/socket] [huge] [interleave[=<lanes>]] [ports]\n");
 		exit(1);
 	}
 
-	/* Reading strings for the string matching from txt file */
-	char **array_of_strings = malloc(sizeof(char *)); // for storing the patterns for string matching
-	int array_of_strings_length = 1; //keeps track of array's size
-	int count = 0; //actual number of strings
-
-	//open file and check for errors
-	FILE *fp = fopen(strings_file_path,"r");
-	if (fp == NULL) {
-		perror("error opening file: ");
+	if (resume && use_index) {
+		printf("resume and index cannot be used together\n");
 		exit(1);
 	}
-	char str[100]; //buffer for saving the strings once pulled out by fscanf
-
-	while(fscanf(fp, "%s", str) != EOF) //we read all the file word by word
-	{
-
-		array_of_strings[count] = malloc(strlen(str)); //we have to allocate memory for this string
-		if (count < array_of_strings_length) {
-			strcpy(array_of_strings[count], str); //copy string into array
-			count++; //actual number of strings have grown by 1
-		}
-		else { //count == array_of_strings_length
-			//it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
-			array_of_strings = (char **)realloc(array_of_strings, (array_of_strings_length*2)*sizeof(char *));
-			strcpy(array_of_strings[count], str); //copy string into array
-			count++; //actual number of strings have grown by 1
-			array_of_strings_length *= 2;
-		}
+	if (use_index && window_mb > 0) { //the index already reads the packets in parallel, not in file order
+		printf("index and window cannot be used together\n");
+		exit(1);
+	}
+	if (lanes > 0 && engine != AC) { //kmp_matcher has no automaton to interleave
+		printf("interleave needs engine=ac\n");
+		exit(1);
+	}
+	if (port_dispatch && (engine != AC || partition == PARTITION_PATTERN)) { //the automata are split by port, not by size
+		printf("ports needs engine=ac and the data partition\n");
+		exit(1);
+	}
+	if (numa_policy != NUMA_OFF && (engine != AC || schedule != GUIDED || partition == PARTITION_PATTERN)) {
+		//only there the copy loop and the match loop share schedule(runtime), so a payload is matched by the thread that placed it
+		printf("numa needs engine=ac, the guided schedule and the data partition\n");
+		exit(1);
 	}
-	fclose(fp);
 
-	/* If array is not full, we reallocate memory */
-	if (!(count == array_of_strings_length))
-		array_of_strings = (char **)realloc(array_of_strings, (count*sizeof(char *)));
-	array_of_strings_length = count;
+	/* Reading strings for the string matching from the txt files, the strings of several files once each */
+	char **array_of_strings; // for storing the patterns for string matching
+	int array_of_strings_length;
+	struct pattern_sets sets;
+	pattern_sets_load(strings_file_path, &sets, &array_of_strings, &array_of_strings_length);
+
+
+	/* Every thread of the team goes to its CPU before it touches any packet */
+	struct numa_placement *numa = NULL;
+	if (numa_policy != NUMA_OFF) {
+		numa = numa_placement_create(numa_policy, thread_count);
+		if (numa == NULL)
+			exit(1);
+		for (int t = 0; t < thread_count; t++)
+			numa->arena[t].huge = huge;
+		#pragma omp parallel num_threads(thread_count)
+		numa_pin_thread(numa, omp_get_thread_num());
+	}
+	// The payload loops: guided, or static when a payload has to be matched by the thread that decoded it
+	omp_set_schedule(numa != NULL ? omp_sched_static : omp_sched_guided, numa != NULL ? NUMA_CHUNK : 0);
 
+	/* The span of the benchmark line starts here, see bench.h */
+	double bench_start;
+	GET_TIME(bench_start);
 
-	//now we open the pcap file
-	pcap = pcap_open_offline(filepath, errbuf);	//opening the pcap file
-	if (pcap == NULL) {	//check error in pcap file
-		fprintf(stderr, "error reading pcap file: %s\n", errbuf);
+	//now we open the pcap files
+	struct input_files files;
+	if (input_files_expand(filepath, &files) == 0)
+		exit(1);
+	if ((resume || use_index) && files.count > 1) {
+		printf("resume and index need a single pcap file, %s has %d\n", filepath, files.count);
 		exit(1);
 	}
+	int load_parallel = files.count > 1 && window_mb == 0; //every file parsed by its own thread, see input_load_files
+	if (!load_parallel) {
+		pcap = input_stream_open(&files, reader | (huge ? READER_HUGE_PAGES : 0), errbuf);	//opening the pcap files
+		if (pcap == NULL) {	//check error in pcap file
+			fprintf(stderr, "error reading pcap file: %s\n", errbuf);
+			exit(1);
+		}
+	}
+	struct scan_state state; //what the previous runs have already counted
+	if (resume && state_load(filepath, pattern_set_hash(array_of_strings, array_of_strings_length, packet_type), array_of_strings_length, &state))
+		reader_seek(pcap->pcap, state.offset); //only the records appended since then
 
 	struct pcap_pkthdr *header;
 	const unsigned char * data; // data object
-	struct pkt_str *array_of_packets = malloc(sizeof(struct pkt_str));
+	struct packet_record *array_of_packets = malloc(sizeof(struct packet_record));
 	int packet_count = 0; //number of packets into pcap file
 	int array_of_packets_length = 1; //array size
 	int i;
-
-	while((i = pcap_next_ex(pcap,&header,&data)) >=0) {
-		if(packet_count == array_of_packets_length) {
-			//it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
-			array_of_packets = realloc(array_of_packets, (array_of_packets_length*2)*sizeof(struct pkt_str));
-			array_of_packets_length *= 2;
+	long long total_bytes = 0; //captured bytes, for the benchmark line
+	struct pcap_index *idx = NULL;
+	struct huge_arena packet_arena = {0}; //the packets, with huge
+	struct input_capture *loaded = NULL; //the packets of a list of captures, a block per file
+	int loaded_count = files.count;
+	struct huge_arena *payload_arena = calloc(thread_count, sizeof(struct huge_arena)); //the payloads of every thread, with huge
+
+	if (use_index) {
+		// The index tells how many packets of the selected protocol there are and where they are:
+		// the array is allocated once and the threads read their packets with pread
+		idx = pcap_index_open(filepath);
+		if (idx == NULL)
+			exit(1);
+		struct pcap_index_entry *selected;
+		packet_count = pcap_index_select(idx, packet_type == UDP ? IPPROTO_UDP : IPPROTO_TCP, &selected);
+		array_of_packets = realloc(array_of_packets, (packet_count ? packet_count : 1)*sizeof(struct packet_record));
+		array_of_packets_length = packet_count;
+		total_bytes = idx->total_bytes;
+		int read_errors = 0;
+		#pragma omp parallel for num_threads(thread_count) schedule(dynamic, 64) reduction(+:read_errors)
+		for (int k = 0; k < packet_count; k++) {
+			STAGE_BEGIN(STAGE_READ);
+			array_of_packets[k].data = malloc(selected[k].caplen);
+			array_of_packets[k].len = selected[k].caplen;
+			if (!pcap_index_read(idx, &selected[k], array_of_packets[k].data)) {
+				array_of_packets[k].len = 0; //an empty packet has no payload
+				read_errors++;
+			}
+			STAGE_END(STAGE_READ);
+		}
+		if (read_errors > 0)
+			fprintf(stderr, "%d packets could not be read from %s\n", read_errors, filepath);
+	}
+	else if (load_parallel) {
+		STAGE_BEGIN(STAGE_READ);
+		loaded = input_load_files(&files, reader | (huge ? READER_HUGE_PAGES : 0), thread_count);
+		STAGE_END(STAGE_READ);
+		if (loaded == NULL)
+			exit(1);
+		for (int f = 0; f < loaded_count; f++)
+			packet_count += loaded[f].count;
+		array_of_packets = realloc(array_of_packets, (packet_count ? packet_count : 1)*sizeof(struct packet_record));
+		array_of_packets_length = packet_count;
+		// The packets point into the blocks, in the order of the list as the stream would give them
+		for (int f = 0, k = 0; f < loaded_count; f++) {
+			unsigned char *bytes = loaded[f].bytes;
+			for (int p = 0; p < loaded[f].count; p++, k++) {
+				array_of_packets[k].data = bytes;
+				array_of_packets[k].len = loaded[f].len[p];
+				bytes += loaded[f].len[p];
+			}
+			total_bytes += loaded[f].used;
 		}
-		//push packet struct into array of packets
-		array_of_packets[packet_count].data = malloc(header->caplen); //allocate memory to copy packet data
-		memcpy(array_of_packets[packet_count].data, data, header->caplen);
-		array_of_packets[packet_count].len = header->caplen;
-		packet_count++;
-
 	}
-	if (!(packet_count == array_of_packets_length))
-		array_of_packets = realloc (array_of_packets, packet_count*sizeof(struct pkt_str)); //we reallocate memory to get even
+	else if (window_mb == 0) {
+		while(1) {
+			STAGE_BEGIN(STAGE_READ);
+			i = input_next_ex(pcap,&header,&data);
+			STAGE_END(STAGE_READ);
+			if (i < 0) //end of the pcap file
+				break;
+			if(packet_count == array_of_packets_length) {
+				//it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
+				array_of_packets = realloc(array_of_packets, (array_of_packets_length*2)*sizeof(struct packet_record));
+				array_of_packets_length *= 2;
+			}
+			//push packet struct into array of packets
+			STAGE_BEGIN(STAGE_COPY);
+			if (huge)
+				array_of_packets[packet_count].data = (unsigned char *)huge_arena_alloc(&packet_arena, header->caplen);
+			else
+				array_of_packets[packet_count].data = malloc(header->caplen); //allocate memory to copy packet data
+			memcpy(array_of_packets[packet_count].data, data, header->caplen);
+			STAGE_END(STAGE_COPY);
+			array_of_packets[packet_count].len = header->caplen;
+			total_bytes += header->caplen;
+			if (resume && state.offset >= 0) //a truncated last record is not read, the next run starts from it
+				state.offset += PCAP_RECORD_HEADER + header->caplen;
+			packet_count++;
 
-	char *array_of_payloads[packet_count];
+		}
+	}
+	struct window_reader *windows = NULL;
+	if (window_mb > 0) { //the reader thread fills the next window while the team matches this one
+		windows = window_reader_start(pcap, window_mb << 20);
+		for (int k = 0; huge && k < 2; k++) //the pages not touched yet by the reader
+			huge_advise(windows->window[k].bytes, windows->window[k].capacity);
+	}
+	else {
+		if (pcap != NULL)
+			input_stream_close(pcap);
+		input_files_free(&files);
+		if (!(packet_count == array_of_packets_length))
+			array_of_packets = realloc (array_of_packets, packet_count*sizeof(struct packet_record)); //we reallocate memory to get even
+	}
 
 	/* Start the performance evaluation */
 	double start = omp_get_wtime();
 
-	#pragma omp parallel for num_threads(thread_count) schedule(guided) shared(array_of_payloads, array_of_packets, packet_type)
-	for (int i = 0; i < packet_count; i++) {
-		char * data = (char*)array_of_packets[i].data; // Get current packet
-		int packet_len = array_of_packets[i].len; // Get current packet len
-		char* payload;
-		unsigned int payload_length;
-		if(packet_type == UDP) //udp
-			payload = dump_UDP_packet(data, &payload_length, packet_len); // Getting the payload
-		else //tcp
-			payload = dump_TCP_packet(data, &payload_length, packet_len); // Getting the payload
-
-		if(payload != NULL) {  // Save payload into array of payload
-			array_of_payloads[i] = malloc(payload_length);
-			memcpy(array_of_payloads[i], payload, payload_length);
-		}
-		else { // If the packet is not valid we save a " " message into array of payloads
-			array_of_payloads[i] = malloc(1);
-			memcpy(array_of_payloads[i], " ", 1);
-		}
-	}
-
 	int *string_count = calloc(array_of_strings_length, sizeof(int)); // Using calloc because we want to initialize every member to 0
 	int *private_string_count;
 	int **prefix_array = malloc(array_of_strings_length*sizeof(int*));
@@ -154,49 +352,385 @@ int main(int argc, char *argv[]) {
 		prefix_array[i] = kmp_prefix(array_of_strings[i]);
 	}
 
-	#pragma omp parallel num_threads(thread_count) private (private_string_count) shared(string_count)
-	{
-		private_string_count = calloc(array_of_strings_length, sizeof(int)); // Using calloc because we want to initialize every member to 0
-		// For each payload, we call the string matching algorithm for every string in S
-		#pragma omp for schedule(guided) collapse(2)
-		for (int k = 0; k < packet_count; k++) //for every payload
-			for (int i = 0; i < array_of_strings_length; i++) //for every string
-					private_string_count[i] += kmp_matcher(array_of_payloads[k], array_of_strings[i], prefix_array[i]);
+	struct partition_plan *plan = NULL;
+	struct port_groups *ports = NULL; //the automaton of payload k is the one of its destination port
+	if (port_dispatch)
+		ports = port_groups_build(array_of_strings, array_of_strings_length, packet_type == UDP ? IPPROTO_UDP : IPPROTO_TCP);
+	if (engine == AC) {
+		if (ports != NULL)
+			plan = port_groups_plan(ports);
+		else
+			plan = plan_partition(array_of_strings, array_of_strings_length, thread_count, numa != NULL ? PARTITION_DATA : partition, cache_bytes);
+		if (plan->mode == PARTITION_PATTERN || numa != NULL) //the string groups already spread a big payload over the team; with numa it stays on its node
+			chunk_bytes = 0;
+		for (int g = 0; huge && g < plan->group_count; g++) //the tables the matchers jump around in
+			huge_move(&plan->groups[g]->next, ac_table_bytes(plan->groups[g]->state_count));
+		if (numa != NULL)
+			numa_replicate(numa, plan->groups, plan->group_count);
+		for (int n = 0; huge && numa != NULL && n < numa->nodes; n++)
+			for (int g = 0; numa->replica[n] != NULL && g < plan->group_count; g++)
+				huge_advise(numa->replica[n][g]->next, ac_table_bytes(numa->replica[n][g]->state_count));
+	}
 
-		// Merge private string count into shared string count array
-		
+	int pattern_parallel = plan != NULL && plan->mode == PARTITION_PATTERN; //what the planner chose, for the report once the plan is freed
+	int max_pattern_len = max_string_length(ports != NULL ? ports->bare : array_of_strings, array_of_strings_length);
+
+	struct payload_cache *cache = NULL; //repeated payloads get their match vector from here
+	if (dedup_entries > 0 && schedule == GUIDED && (engine == KMP || plan->mode == PARTITION_DATA))
+		cache = payload_cache_create(dedup_entries, array_of_strings_length);
+	else if (dedup_entries > 0)
+		printf("dedup needs the guided schedule and the data partition, ignored\n");
+
+	long long scanned_packets = 0; //packets of all the windows
+	int jumbo_total = 0;
+	int total_steals = 0;
+	struct packet_descriptors descriptors = {0}; //headers of the packets of the window, decode_batch
+	while (1) {
+		struct packet_window *w = NULL;
+		if (windows != NULL) { //the packets of the next window take the place of the previous ones
+			STAGE_BEGIN(STAGE_READ); //only the part of the reading that is not overlapped with the matching
+			w = window_next(windows);
+			STAGE_END(STAGE_READ);
+			if (w == NULL)
+				break;
+			if (w->count > array_of_packets_length) {
+				array_of_packets = realloc(array_of_packets, w->count*sizeof(struct packet_record));
+				array_of_packets_length = w->count;
+			}
+			packet_count = w->count;
+			for (int k = 0; k < packet_count; k++) {
+				array_of_packets[k].data = w->packets[k].data;
+				array_of_packets[k].len = w->packets[k].len;
+			}
+			total_bytes += w->packet_bytes;
+			if (resume && state.offset >= 0) //a truncated last record is not read, the next run starts from it
+				state.offset += w->record_bytes;
+		}
+
+		char **array_of_payloads = malloc((packet_count ? packet_count : 1)*sizeof(char *));
+		unsigned int *array_of_payload_lengths = malloc((packet_count ? packet_count : 1)*sizeof(unsigned int)); // needed to cut work by bytes
+		unsigned short *payload_group = ports != NULL ? malloc((packet_count ? packet_count : 1)*sizeof(unsigned short)) : NULL; // automaton of every payload
+
+		descriptors_reserve(&descriptors, packet_count);
+
+		#pragma omp parallel num_threads(thread_count) shared(array_of_payloads, array_of_packets, packet_type)
+		{
+			// The headers first, DECODE_BATCH packets at a time, into the descriptor table
+			#pragma omp for schedule(static)
+			for (int first = 0; first < packet_count; first += DECODE_BATCH) {
+				STAGE_BEGIN(STAGE_DECODE);
+				decode_batch(&descriptors, first, array_of_packets + first, packet_count - first < DECODE_BATCH ? packet_count - first : DECODE_BATCH);
+				STAGE_END(STAGE_DECODE);
+			}
+
+			#pragma omp for schedule(runtime)
+			for (int i = 0; i < packet_count; i++) {
+				unsigned int payload_length;
+				char *payload = descriptor_payload(&descriptors, i, array_of_packets[i].data, packet_type == UDP ? IPPROTO_UDP : IPPROTO_TCP, &payload_length);
+				if (ports != NULL)
+					payload_group[i] = port_group(ports, descriptors.dst_port[i]);
+
+				STAGE_BEGIN(STAGE_COPY);
+				if(payload != NULL) {  // Save payload into array of payload
+					if (numa != NULL) //on the node of this thread, the one that matches it
+						array_of_payloads[i] = numa_arena_alloc(&numa->arena[omp_get_thread_num()], payload_length+1);
+					else if (huge)
+						array_of_payloads[i] = huge_arena_alloc(&payload_arena[omp_get_thread_num()], payload_length+1);
+					else
+						array_of_payloads[i] = malloc(payload_length+1);
+					memcpy(array_of_payloads[i], payload, payload_length);
+					array_of_payloads[i][payload_length] = '\0'; // kmp_matcher wants a string
+					array_of_payload_lengths[i] = strlen(array_of_payloads[i]); // what kmp_matcher is going to scan
+				}
+				else { // If the packet is not valid we save a " " message into array of payloads
+					if (numa != NULL)
+						array_of_payloads[i] = numa_arena_alloc(&numa->arena[omp_get_thread_num()], 2);
+					else if (huge)
+						array_of_payloads[i] = huge_arena_alloc(&payload_arena[omp_get_thread_num()], 2);
+					else
+						array_of_payloads[i] = malloc(2);
+					strcpy(array_of_payloads[i], " ");
+					array_of_payload_lengths[i] = 1;
+				}
+				STAGE_END(STAGE_COPY);
+			}
+		}
+
+		for (int k = 0; ports != NULL && k < packet_count; k++)
+			port_groups_count(ports, payload_group[k], 1);
+
+		/* Jumbo payloads are left out of the per-payload loops: every chunk of every jumbo payload
+		 * becomes an iteration of its own, so a single big payload is spread over the whole team */
+		int jumbo_chunks = 0; //number of chunks of all the jumbo payloads
+		int *chunk_payload = malloc(sizeof(int)); //payload of every chunk
+		int *chunk_number = malloc(sizeof(int)); //position of every chunk inside its payload
+		unsigned int *loop_lengths = malloc(packet_count*sizeof(unsigned int)); //lengths seen by the work stealing, 0 for jumbo payloads
+		for (int k = 0; k < packet_count; k++) {
+			loop_lengths[k] = array_of_payload_lengths[k];
+			if (chunk_bytes > 0 && array_of_payload_lengths[k] > (unsigned int)chunk_bytes) {
+				int chunks = chunk_count(array_of_payload_lengths[k], chunk_bytes);
+				chunk_payload = realloc(chunk_payload, (jumbo_chunks+chunks)*sizeof(int));
+				chunk_number = realloc(chunk_number, (jumbo_chunks+chunks)*sizeof(int));
+				for (int c = 0; c < chunks; c++) {
+					chunk_payload[jumbo_chunks] = k;
+					chunk_number[jumbo_chunks] = c;
+					jumbo_chunks++;
+				}
+				loop_lengths[k] = 0;
+			}
+		}
+
+		struct work_deque *deques = NULL;
+		if (schedule == STEAL && engine == KMP)
+			deques = build_work_deques(loop_lengths, packet_count, array_of_strings_length, thread_count);
+		else if (schedule == STEAL && plan->mode == PARTITION_DATA) //the automaton does every string in one pass
+			deques = build_work_deques(loop_lengths, packet_count, 1, thread_count);
+
+		#pragma omp parallel num_threads(thread_count) private (private_string_count) shared(string_count)
+		{
+			private_string_count = calloc(array_of_strings_length, sizeof(int)); // Using calloc because we want to initialize every member to 0
+			struct ac_automaton **automata = plan != NULL ? numa_replica(numa, plan->groups, omp_get_thread_num()) : NULL; //the copies of our node
+			int numa_counters = numa != NULL ? numa_counters_open() : -1;
+			struct ac_lanes *scan = plan != NULL ? malloc(plan->group_count*sizeof(struct ac_lanes)) : NULL; //the payloads this thread has in flight with interleave, for every automaton
+			STAGE_BEGIN(STAGE_MATCH); // the barriers of the omp for loops are part of it, that is the imbalance
+			if (engine == AC && plan->mode == PARTITION_PATTERN) {
+				// Thread t works with sub-automaton t % groups, the threads of a group share the payload batches.
+				// With more groups than threads every thread goes through its groups one at a time
+				int my_rank = omp_get_thread_num();
+				int threads = omp_get_num_threads();
+				int groups = plan->group_count;
+				if (groups <= threads) {
+					int g = my_rank % groups;
+					int members = threads / groups + (g < threads % groups ? 1 : 0);
+					int member = my_rank / groups;
+					ac_lanes_init(&scan[g], automata[g], lanes, private_string_count);
+					for (int first = member*PATTERN_BATCH; first < packet_count; first += members*PATTERN_BATCH)
+						for (int k = first; k < first + PATTERN_BATCH && k < packet_count; k++)
+							if (lanes > 0)
+								ac_lanes_push(&scan[g], array_of_payloads[k], array_of_payload_lengths[k]);
+							else
+								ac_match(automata[g], array_of_payloads[k], array_of_payload_lengths[k], private_string_count);
+					ac_lanes_flush(&scan[g]);
+				}
+				else {
+					for (int g = my_rank; g < groups; g += threads) {
+						ac_lanes_init(&scan[g], automata[g], lanes, private_string_count);
+						for (int k = 0; k < packet_count; k++)
+							if (lanes > 0)
+								ac_lanes_push(&scan[g], array_of_payloads[k], array_of_payload_lengths[k]);
+							else
+								ac_match(automata[g], array_of_payloads[k], array_of_payload_lengths[k], private_string_count);
+						ac_lanes_flush(&scan[g]);
+					}
+				}
+			}
+			else if (cache != NULL) {
+				// One payload at a time: a repeated payload costs a hash and a lookup, a new one is matched and stored
+				int *matches = malloc(array_of_strings_length*sizeof(int));
+				#pragma omp for schedule(runtime)
+				for (int k = 0; k < packet_count; k++) {
+					if (loop_lengths[k] != array_of_payload_lengths[k]) //jumbo payloads are matched below
+						continue;
+					int g = payload_group != NULL ? payload_group[k] : 0;
+					unsigned long long hash = payload_hash(array_of_payloads[k], array_of_payload_lengths[k]) ^ (unsigned long long)g * 0x9e3779b97f4a7c15ULL; //the same payload to another port has other matches
+					if (payload_cache_lookup(cache, hash, array_of_payloads[k], array_of_payload_lengths[k], g, private_string_count))
+						continue;
+					memset(matches, 0, array_of_strings_length*sizeof(int));
+					if (engine == AC)
+						ac_match(automata[g], array_of_payloads[k], array_of_payload_lengths[k], matches);
+					else
+						for (int i = 0; i < array_of_strings_length; i++)
+							matches[i] = kmp_matcher(array_of_payloads[k], array_of_strings[i], prefix_array[i]);
+					for (int i = 0; i < array_of_strings_length; i++)
+						private_string_count[i] += matches[i];
+					payload_cache_insert(cache, hash, array_of_payloads[k], array_of_payload_lengths[k], g, matches);
+				}
+				free(matches);
+			}
+			else if (engine == AC && schedule == GUIDED) {
+				// One automaton, one pass over every payload; with interleave the payloads of our iterations
+				// go through the lanes, the last ones are finished after the loop
+				for (int g = 0; g < plan->group_count; g++)
+					ac_lanes_init(&scan[g], automata[g], lanes, private_string_count);
+				#pragma omp for schedule(runtime) nowait
+				for (int k = 0; k < packet_count; k++) {
+					int g = payload_group != NULL ? payload_group[k] : 0;
+					if (loop_lengths[k] != array_of_payload_lengths[k]) //jumbo payloads are matched below
+						continue;
+					if (lanes > 0)
+						ac_lanes_push(&scan[g], array_of_payloads[k], array_of_payload_lengths[k]);
+					else
+						ac_match(automata[g], array_of_payloads[k], array_of_payload_lengths[k], private_string_count);
+				}
+				for (int g = 0; g < plan->group_count; g++)
+					ac_lanes_flush(&scan[g]);
+				#pragma omp barrier
+			}
+			else if (engine == AC) {
+				int my_rank = omp_get_thread_num();
+				unsigned int seed = my_rank + 1;
+				int steals = 0;
+				struct work_item item;
+				for (int g = 0; g < plan->group_count; g++)
+					ac_lanes_init(&scan[g], automata[g], lanes, private_string_count);
+				while (next_work_item(deques, thread_count, my_rank, &seed, &item, &steals)) {
+					int g = payload_group != NULL ? payload_group[item.payload] : 0;
+					if (loop_lengths[item.payload] != array_of_payload_lengths[item.payload]) //jumbo payloads are matched below
+						continue;
+					if (lanes > 0)
+						ac_lanes_push(&scan[g], array_of_payloads[item.payload], array_of_payload_lengths[item.payload]);
+					else
+						ac_match(automata[g], array_of_payloads[item.payload], array_of_payload_lengths[item.payload], private_string_count);
+				}
+				for (int g = 0; g < plan->group_count; g++)
+					ac_lanes_flush(&scan[g]);
+				#pragma omp atomic
+				total_steals += steals;
+			}
+			else if (schedule == GUIDED) {
+				// For each payload, we call the string matching algorithm for every string in S
+				#pragma omp for schedule(guided) collapse(2)
+				for (int k = 0; k < packet_count; k++) //for every payload
+					for (int i = 0; i < array_of_strings_length; i++) //for every string
+						if (loop_lengths[k] == array_of_payload_lengths[k]) //jumbo payloads are matched below
+							private_string_count[i] += kmp_matcher(array_of_payloads[k], array_of_strings[i], prefix_array[i]);
+			}
+			else {
+				// Every thread drains its own deque, then steals until all of them are empty
+				int my_rank = omp_get_thread_num();
+				unsigned int seed = my_rank + 1;
+				int steals = 0;
+				struct work_item item;
+				while (next_work_item(deques, thread_count, my_rank, &seed, &item, &steals))
+					if (loop_lengths[item.payload] == array_of_payload_lengths[item.payload]) //jumbo payloads are matched below
+						for (int i = item.first_string; i < item.last_string; i++)
+							private_string_count[i] += kmp_matcher(array_of_payloads[item.payload], array_of_strings[i], prefix_array[i]);
+				#pragma omp atomic
+				total_steals += steals;
+			}
+
+			// Chunks of the jumbo payloads, the overlap makes sure that no match is lost or counted twice
+			#pragma omp for schedule(dynamic)
+			for (int c = 0; c < jumbo_chunks; c++) {
+				if (engine == KMP)
+					match_chunk(array_of_payloads[chunk_payload[c]], array_of_payload_lengths[chunk_payload[c]], chunk_number[c], chunk_bytes,
+						array_of_strings, prefix_array, array_of_strings_length, max_pattern_len, private_string_count);
+				else {
+					int start, own_len, scan_len;
+					chunk_bounds(array_of_payload_lengths[chunk_payload[c]], chunk_number[c], chunk_bytes, max_pattern_len, &start, &own_len, &scan_len);
+					ac_match_range(automata[payload_group != NULL ? payload_group[chunk_payload[c]] : 0], array_of_payloads[chunk_payload[c]] + start, scan_len, own_len, private_string_count);
+				}
+			}
+			STAGE_END(STAGE_MATCH);
+			if (numa != NULL)
+				numa_counters_close(numa, numa_counters);
+			free(scan);
+
+			// Merge private string count into shared string count array
 		
-		for (int i = 0; i < array_of_strings_length; i++) {
-			#pragma omp atomic  
-			string_count[i] += private_string_count[i];
+			STAGE_BEGIN(STAGE_MERGE);
+			for (int i = 0; i < array_of_strings_length; i++) {
+				#pragma omp atomic  
+				string_count[i] += private_string_count[i];
 			
+			}
+			STAGE_END(STAGE_MERGE);
+			free(private_string_count);
+		}
+
+		scanned_packets += packet_count;
+		jumbo_total += jumbo_chunks;
+		for (int i = 0; i < packet_count && numa == NULL && !huge; i++)
+			free(array_of_payloads[i]);
+		for (int t = 0; t < thread_count; t++) { //the payloads of the window are in the arenas
+			if (numa != NULL)
+				numa_arena_reset(&numa->arena[t]);
+			huge_arena_reset(&payload_arena[t]);
 		}
-		free(private_string_count);
+		free(array_of_payloads);
+		free(array_of_payload_lengths);
+		free(payload_group);
+		free(loop_lengths);
+		free(chunk_payload);
+		free(chunk_number);
+		if (deques != NULL)
+			free_work_deques(deques, thread_count);
+		if (windows == NULL) //everything was in one go
+			break;
+		window_release(windows, w);
+	}
+	if (windows != NULL) {
+		window_reader_stop(windows);
+		input_stream_close(pcap);
+		input_files_free(&files);
+	}
+
+	if (resume) { //totals of the whole capture, saved for the next run
+		for (int i = 0; i < array_of_strings_length; i++) {
+			state.counts[i] += string_count[i];
+			string_count[i] = state.counts[i];
+		}
+		state.packets += scanned_packets;
+		printf("Incremental scan: %lld new packets scanned, %lld in total\n", scanned_packets, state.packets);
+		state_save(filepath, &state);
+		state_free(&state);
 	}
 
 	// Stop the performance evaluation
 	double finish = omp_get_wtime();
+	double bench_finish;
+	GET_TIME(bench_finish);
 
 	// Now we print the output
 
-	printf("Printing the number of appereances of each string throughout the entire pcap file:\n");
-	for (int i = 0; i < array_of_strings_length; i++)
-		if(string_count[i] != 0)
-			printf("%s: %d times!\n", array_of_strings[i], string_count[i]);
+	pattern_sets_print(&sets, array_of_strings, string_count);
 
 	// Now we print performance evaluation
+	if (plan != NULL) {
+		if (ports != NULL)
+			port_groups_print(ports);
+		else
+			print_partition_plan(plan, thread_count);
+		for (int g = 0; huge && g < plan->group_count; g++) { //not malloc'ed any more
+			huge_free(plan->groups[g]->next);
+			plan->groups[g]->next = NULL;
+		}
+		free_partition_plan(plan);
+	}
+	if (schedule == STEAL && !pattern_parallel)
+		printf("Work items stolen = %d\n", total_steals);
+	if (jumbo_total > 0)
+		printf("Jumbo payload chunks = %d\n", jumbo_total);
+	if (idx != NULL)
+		pcap_index_close(idx);
+	if (cache != NULL) {
+		payload_cache_print(cache);
+		payload_cache_free(cache);
+	}
+	if (numa != NULL)
+		numa_placement_print(numa);
+	if (huge)
+		huge_print();
 	printf("Elapsed time = %f seconds\n", finish-start);
+	char variant[96];
+	snprintf(variant, sizeof(variant), "openmp_data-%s-%s%s%s%s%s%s%s%s%s%s%s", schedule == STEAL ? "steal" : "guided", engine == AC ? "ac" : "kmp",
+		pattern_parallel ? "-pattern" : "", cache != NULL ? "-dedup" : "",
+		reader != READER_PCAP ? "-" : "", reader != READER_PCAP ? reader_name(reader) : "", window_mb > 0 ? "-window" : "",
+		numa != NULL ? "-numa-" : "", numa != NULL ? numa_policy_name(numa_policy) : "", huge ? "-huge" : "", lanes > 0 ? "-interleave" : "", ports != NULL ? "-ports" : "");
+	print_bench_line(variant, 1, thread_count, scanned_packets, total_bytes, bench_finish-bench_start);
+	STAGE_REPORT(variant);
 
 	// We have to free previously allocated memory
-	for(int i=0; i<packet_count; i++){
-		free(array_of_payloads[i]);
-	} // free(array_of_payloads) not needed cause it has been allocated in the stack
-
-	for (int i = 0; i < packet_count; i++) {
+	for (int i = 0; i < packet_count && window_mb == 0 && loaded == NULL && (!huge || use_index); i++) { //the packets of the windows are not ours
 			free(array_of_packets[i].data);
 	} free(array_of_packets);
+	huge_arena_reset(&packet_arena);
+	if (loaded != NULL)
+		input_captures_free(loaded, loaded_count);
+	free(payload_arena);
 
 	free(string_count);
+	descriptors_free(&descriptors);
 
 	for (int i = 0; i < array_of_strings_length; i++) {
 		free(prefix_array[i]);
@@ -205,6 +739,11 @@ int main(int argc, char *argv[]) {
 	for (int i = 0; i < array_of_strings_length; i++) {
 		free(array_of_strings[i]);
 	} free(array_of_strings);
+	if (numa != NULL)
+		numa_placement_free(numa);
+	if (ports != NULL)
+		port_groups_free(ports);
+	pattern_sets_free(&sets);
 
 	return 0;
 
@@ -1,7 +1,22 @@
-/* 	Compilation: gcc -g -Wall -fopenmp openmp_task.c -o openmp_task -lpcap
-	Usage: ./openmp_task <file.pcap> <string.txt> thread_number [tcp/udp]
+/* 	Compilation: gcc -g -Wall -fopenmp openmp_task.c -o openmp_task -lpcap -lz
+	(add -DSTAGE_PROFILE, and -DSTAGE_PERF for hardware counters, to get the per-stage profile of stage_profile.h)
+	Usage: ./openmp_task <file.pcap> <string.txt> thread_number [tcp/udp] [dedup=on/off/<entries>] [pipeline[=<decoders>]]
+		[engine=kmp/ac] [interleave[=<lanes>]]
+	dedup: keep the match vector of up to that many payloads (on: DEFAULT_PAYLOAD_CACHE_ENTRIES) so that
+	a byte-identical payload is not scanned again (payload_cache.h)
+	pipeline: instead of one task per batch, a reader thread, <decoders> decoder threads (default one
+	every five threads) and matcher threads pass a fixed pool of batches to each other, and the busy
+	and waiting time of every stage is printed (batch_pipeline.h)
+	engine: kmp (default) runs kmp_matcher once per string, ac scans the payload once with an
+	Aho-Corasick automaton of all the strings (aho_corasick.h)
+	interleave (ac only): the payloads of a batch go through the automaton <lanes> at a time (default
+	AC_DEFAULT_LANES) in lock-step, so that their cache misses overlap; with dedup one at a time
+	<file.pcap> can also be a directory, a glob pattern or @list: the packets of all the captures are
+	matched as one stream and the counts printed together (input_files.h)
+	<file.pcap> can also be gzip-compressed, a BGZF one is decompressed by several threads (gz_capture.h)
  */
 
+#define _GNU_SOURCE //fopencookie, see gz_capture.h
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,19 +25,29 @@
 #include <netinet/if_ether.h>
 #include "timer.h"
 #include "packet_dumping.h"
+#include "packet_decode.h"
+#include "bench.h"
+#include "stage_profile.h"
+#include "payload_cache.h"
+#include "input_files.h"
+#include "batch_pipeline.h"
+#include "aho_corasick.h"
 #include <omp.h>
 
 
 #define UDP 0
 #define TCP 1
 
+#define KMP 0
+#define AC 1
+
 /*Knuth-Morris-Pratt String Matching Algorithm's functions.*/
 int kmp_matcher (char text[], char pattern[], int *prefix_array);
 int* kmp_prefix (char pattern[]);
 
 
 int main(int argc, char *argv[]) {
-	pcap_t *pcap;	//pointer to the pcap file
+	struct input_stream *pcap;	//packets of the pcap files, one after the other
 	const unsigned char *packet;
 	char errbuf[PCAP_ERRBUF_SIZE];
 	struct pcap_pkthdr *header;
@@ -30,25 +55,51 @@ int main(int argc, char *argv[]) {
 	char *strings_file_path; //for storing path of file <strings.txt>
 	int thread_count;
 	int packet_type = UDP; //default udp
+	int dedup_entries = 0; //size of the payload cache, 0 for no cache
+	int decoders = -1; //decoder threads of the pipeline, 0 for the default, -1 for one task per batch
+	int engine = KMP; //default one kmp_matcher call per string
+	int lanes = 0; //payloads scanned together by the automaton, 0 for one at a time
 	
-	if (argc==4|| argc ==5) { 
+	if (argc >= 4) {
 		filepath = argv[1]; //get filename from command-line
 		strings_file_path = argv[2];
 		thread_count = atoi(argv[3]); //get thread number from command-line
 		
-		if(argc == 5) { //get packet type from command-line
-			if(strcmp(argv[4], "udp") == 0)
+		for (int a = 4; a < argc; a++) { //get packet type, payload cache and pipeline from command-line
+			if(strcmp(argv[a], "udp") == 0)
 				packet_type=UDP;
-			else if (strcmp(argv[4], "tcp") == 0)
+			else if (strcmp(argv[a], "tcp") == 0)
 				packet_type=TCP;
+			else if (strcmp(argv[a], "dedup=on") == 0)
+				dedup_entries = DEFAULT_PAYLOAD_CACHE_ENTRIES;
+			else if (strcmp(argv[a], "dedup=off") == 0)
+				dedup_entries = 0;
+			else if (strncmp(argv[a], "dedup=", 6) == 0)
+				dedup_entries = atoi(argv[a] + 6);
+			else if (strcmp(argv[a], "pipeline") == 0)
+				decoders = 0;
+			else if (strncmp(argv[a], "pipeline=", 9) == 0)
+				decoders = atoi(argv[a] + 9);
+			else if (strcmp(argv[a], "engine=kmp") == 0)
+				engine = KMP;
+			else if (strcmp(argv[a], "engine=ac") == 0)
+				engine = AC;
+			else if (strcmp(argv[a], "interleave") == 0)
+				lanes = AC_DEFAULT_LANES;
+			else if (strncmp(argv[a], "interleave=", 11) == 0 && atoi(argv[a] + 11) > 0)
+				lanes = atoi(argv[a] + 11) < AC_MAX_LANES ? atoi(argv[a] + 11) : AC_MAX_LANES;
 			else {
-				printf("USAGE ./openmp_task <file.pcap> <string.txt> thread_number [tcp/udp]\n");
+				printf("USAGE ./openmp_task <file.pcap> <string.txt> thread_number [tcp/udp] [dedup=on/off/<entries>] [pipeline[=<decoders>]] [engine=kmp/ac] [interleave[=<lanes>]]\n");
 				exit(1);
 			}
 		}
 	}
 	else {
-		printf("USAGE: ./openmp_task <file.pcap> <string.txt> [tcp/udp]\n");
+		printf("USAGE: ./openmp_task <file.pcap> <string.txt> thread_number [tcp/udp] [dedup=on/off/<entries>] [pipeline[=<decoders>]] [engine=kmp/ac] [interleave[=<lanes>]]\n");
+		exit(1);
+	}
+	if (lanes > 0 && engine != AC) { //kmp_matcher has no automaton to interleave
+		printf("interleave needs engine=ac\n");
 		exit(1);
 	}
 	
@@ -65,21 +116,16 @@ int main(int argc, char *argv[]) {
 	}
 	char str[100]; //buffer for saving the strings once pulled out by fscanf
 	
-	while( fscanf(fp, "%s", str) != EOF ) //we read all the file word by word
+	while(fscanf(fp, "%99s", str) != EOF) //we read all the file word by word
 	{
-
-		array_of_strings[count] = malloc(strlen(str)); //we have to allocate memory for this string
-		if (count < array_of_strings_length) {
-			strcpy(array_of_strings[count], str); //copy string into array
-			count++; //actual number of strings have grown by 1
-		}
-		else { //count == array_of_strings_length
+		if (count == array_of_strings_length) {
 			//it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
 			array_of_strings = (char **)realloc(array_of_strings, (array_of_strings_length*2)*sizeof(char *));
-			strcpy(array_of_strings[count], str); //copy string into array
-			count++; //actual number of strings have grown by 1
 			array_of_strings_length *= 2;
 		}
+		array_of_strings[count] = malloc(strlen(str)+1); //we have to allocate memory for this string
+		strcpy(array_of_strings[count], str); //copy string into array
+		count++; //actual number of strings have grown by 1
 	}
 	fclose(fp);
 	
@@ -100,9 +146,26 @@ int main(int argc, char *argv[]) {
 		prefix_array[i] = kmp_prefix(array_of_strings[i]);
 	}
 
+	/* One automaton of all the strings, shared by every thread */
+	struct ac_automaton *ac = NULL;
+	if (engine == AC) {
+		int *string_index = malloc(array_of_strings_length*sizeof(int));
+		for (int i = 0; i < array_of_strings_length; i++)
+			string_index[i] = i;
+		ac = ac_build(array_of_strings, string_index, array_of_strings_length);
+		free(string_index);
+	}
+
+
+	/* The span of the benchmark line starts here, see bench.h */
+	double bench_start;
+	GET_TIME(bench_start);
 
-	//now we open the pcap file
-	pcap = pcap_open_offline(filepath, errbuf);	//opening the pcap file
+	//now we open the pcap files
+	struct input_files files;
+	if (input_files_expand(filepath, &files) == 0)
+		exit(1);
+	pcap = input_stream_open(&files, READER_PCAP, errbuf);	//opening the pcap files
 	if (pcap == NULL) {	//check error in pcap file
 		fprintf(stderr, "error reading pcap file: %s\n", errbuf);
 		exit(1);
@@ -117,75 +180,263 @@ int main(int argc, char *argv[]) {
 	int exit_flag = 0;
 	int packet_count=0;
 	int *private_string_count;
-	char * data_copy; //copy of data object
+	struct packet_record records[array_of_payloads_length]; //the packets of a batch, copied out of the capture
+	struct packet_descriptors descriptors = {0}; //their headers, decode_batch
+	descriptors_reserve(&descriptors, array_of_payloads_length);
+	int protocol = packet_type == UDP ? IPPROTO_UDP : IPPROTO_TCP;
 	unsigned int packet_len;
 	int i;
+	long long total_packets = 0, total_bytes = 0; //everything read from the capture, for the benchmark line
+	struct payload_cache *cache = NULL; //repeated payloads get their match vector from here
+	if (dedup_entries > 0)
+		cache = payload_cache_create(dedup_entries, array_of_strings_length);
 	
+	struct pipeline *stages = NULL;
+	if (decoders >= 0)
+		stages = pipeline_create(thread_count, decoders);
+
 	double start = omp_get_wtime();
 	
-	#pragma omp parallel num_threads(thread_count)
-	{
-		#pragma omp single 
+	if (stages != NULL) {
+		#pragma omp parallel num_threads(pipeline_threads(stages))
 		{
-			//Only the thread 0 read the pcap file and create task for the other threads
-			while (exit_flag==0) { //exit only when an exit signal arrive
-				packet_count = 0; //Reinitialize the packet counter
-				
-				//Cycle for a number of packet indicated by array_of_payloads_length or until the end of the pcap file
-				while (packet_count<array_of_payloads_length &&  (i = pcap_next_ex(pcap,&header,&packet)) >=0) {
-					char* payload;
-					data_copy = malloc(header->len); //allocate memory to copy packet data
-					memcpy(data_copy, packet, header->len); 
-					if(packet_type == UDP) //udp
-						payload = dump_UDP_packet(data_copy, &packet_len, header->len); //getting the payload
-					else //tcp
-						payload = dump_TCP_packet(data_copy, &packet_len, header->len); //getting the payload
-						
-					if(payload != NULL) { //we store it in array of payloads
-			
-						array_of_payloads[packet_count] = malloc(packet_len); //we have to allocate memory for storing this payload
-						memcpy(array_of_payloads[packet_count], payload,  packet_len); //copy payload into array
-						count++;
+			// Every thread stays in its stage: it takes a batch from its queue, works on it and hands it on
+			int stage = pipeline_stage(stages, omp_get_thread_num());
+			double busy = 0, wait = 0;
+			long long batches = 0;
+			int *my_count = calloc(array_of_strings_length, sizeof(int));
+			int *matches = malloc(array_of_strings_length*sizeof(int));
+			struct packet_record batch_records[PIPELINE_BATCH_PACKETS]; //the packets of a batch, for decode_batch
+			struct packet_descriptors batch_descriptors = {0};
+			descriptors_reserve(&batch_descriptors, PIPELINE_BATCH_PACKETS);
+			struct batch *b;
+			if (omp_get_num_threads() < pipeline_threads(stages)) { //a stage without threads would wait forever
+				#pragma omp single
+				fprintf(stderr, "the pipeline needs %d threads, only %d available\n", pipeline_threads(stages), omp_get_num_threads());
+				exit(1);
+			}
+			while ((b = batch_queue_pop(&stages->queue[stage], &wait)) != NULL) {
+				double t0 = omp_get_wtime();
+				int end = 0; //the reader has found the end of the captures
+				if (stage == PIPELINE_READ) {
+					b->count = 0;
+					b->used = 0;
+					while (b->count < PIPELINE_BATCH_PACKETS) {
+						STAGE_BEGIN(STAGE_READ);
+						end = input_next_ex(pcap,&header,&packet) < 0;
+						STAGE_END(STAGE_READ);
+						if (end)
+							break;
+						STAGE_BEGIN(STAGE_COPY);
+						batch_add_packet(b, packet, header->caplen);
+						STAGE_END(STAGE_COPY);
+						total_packets++;
+						total_bytes += header->caplen;
 					}
-					else { // If the packet is not valid we save a " " message into array of payloads
-						array_of_payloads[packet_count] = malloc(1);
-						memcpy(array_of_payloads[packet_count], " ", 1);
+					batches += b->count > 0; //the last batch of the reader can be empty
+					if (b->count > 0)
+						batch_queue_push(&stages->queue[PIPELINE_DECODE], b);
+					if (end) //the other stages finish what is left
+						batch_queue_close(&stages->queue[PIPELINE_DECODE]);
+				}
+				else if (stage == PIPELINE_DECODE) {
+					STAGE_BEGIN(STAGE_DECODE);
+					for (int k = 0; k < b->count; k++) {
+						batch_records[k].data = b->bytes + b->offset[k];
+						batch_records[k].len = b->caplen[k];
 					}
-					packet_count++;
-														
+					decode_batch(&batch_descriptors, 0, batch_records, b->count);
+					STAGE_END(STAGE_DECODE);
+					b->payload_used = 0;
+					for (int k = 0; k < b->count; k++) {
+						unsigned int payload_len = 0;
+						char *payload = descriptor_payload(&batch_descriptors, k, batch_records[k].data, protocol, &payload_len);
+						STAGE_BEGIN(STAGE_COPY);
+						batch_set_payload(b, k, payload, payload_len);
+						STAGE_END(STAGE_COPY);
+					}
+					batches++;
+					batch_queue_push(&stages->queue[PIPELINE_MATCH], b);
+				}
+				else {
+					STAGE_BEGIN(STAGE_MATCH);
+					struct ac_lanes scan; //the payloads of the batch in flight with interleave
+					if (lanes > 0)
+						ac_lanes_init(&scan, ac, lanes, my_count);
+					for (int k = 0; k < b->count; k++) {
+						char *payload = b->payload_bytes + b->payload_offset[k];
+						unsigned int len = strlen(payload); //what kmp_matcher scans
+						unsigned long long hash = 0;
+						if (cache != NULL) {
+							hash = payload_hash(payload, len);
+							if (payload_cache_lookup(cache, hash, payload, len, 0, my_count))
+								continue;
+						}
+						else if (lanes > 0) {
+							ac_lanes_push(&scan, payload, len);
+							continue;
+						}
+						if (engine == AC) {
+							memset(matches, 0, array_of_strings_length*sizeof(int));
+							ac_match(ac, payload, len, matches);
+						}
+						else
+							for (int i = 0; i < array_of_strings_length; i++)
+								matches[i] = kmp_matcher(payload, array_of_strings[i], prefix_array[i]);
+						for (int i = 0; i < array_of_strings_length; i++)
+							my_count[i] += matches[i];
+						if (cache != NULL)
+							payload_cache_insert(cache, hash, payload, len, 0, matches);
+					}
+					if (lanes > 0) //before the batch goes back to the pool
+						ac_lanes_flush(&scan);
+					STAGE_END(STAGE_MATCH);
+					batches++;
+					batch_queue_push(&stages->queue[PIPELINE_READ], b); //back to the pool
 				}
+				busy += omp_get_wtime() - t0; //b belongs to the next stage now
+				if (end)
+					break;
+			}
+			if (stage == PIPELINE_DECODE)
+				pipeline_decoder_done(stages);
+			pipeline_account(stages, stage, batches, busy, wait);
+
+			STAGE_BEGIN(STAGE_MERGE);
+			for (int i = 0; i < array_of_strings_length && stage == PIPELINE_MATCH; i++) {
+				#pragma omp atomic
+				string_count[i] += my_count[i];
+			}
+			STAGE_END(STAGE_MERGE);
+			free(my_count);
+			free(matches);
+			descriptors_free(&batch_descriptors);
+		}
+	}
+	else {
+		#pragma omp parallel num_threads(thread_count)
+		{
+			#pragma omp single 
+			{
+				//Only the thread 0 read the pcap file and create task for the other threads
+				while (exit_flag==0) { //exit only when an exit signal arrive
+					packet_count = 0; //Reinitialize the packet counter
+				
+					//Cycle for a number of packet indicated by array_of_payloads_length or until the end of the pcap file
+					while (packet_count<array_of_payloads_length) {
+						STAGE_BEGIN(STAGE_READ);
+						i = input_next_ex(pcap,&header,&packet);
+						STAGE_END(STAGE_READ);
+						if (i < 0) //end of the pcap file
+							break;
+
+						total_packets++;
+						total_bytes += header->caplen;
+						STAGE_BEGIN(STAGE_COPY);
+						records[packet_count].data = malloc(header->caplen); //allocate memory to copy packet data
+						memcpy(records[packet_count].data, packet, header->caplen);
+						records[packet_count].len = header->caplen;
+						STAGE_END(STAGE_COPY);
+						packet_count++;
+					}
+
+					// The headers of the whole batch at once, then the payloads are copied out of the packets
+					STAGE_BEGIN(STAGE_DECODE);
+					decode_batch(&descriptors, 0, records, packet_count);
+					STAGE_END(STAGE_DECODE);
+					for (int k = 0; k < packet_count; k++) {
+						char *payload = descriptor_payload(&descriptors, k, records[k].data, protocol, &packet_len);
+						if(payload != NULL) { //we store it in array of payloads
+							STAGE_BEGIN(STAGE_COPY);
+							array_of_payloads[k] = malloc(packet_len+1); //we have to allocate memory for storing this payload
+							memcpy(array_of_payloads[k], payload,  packet_len); //copy payload into array
+							array_of_payloads[k][packet_len] = '\0'; // kmp_matcher wants a string
+							STAGE_END(STAGE_COPY);
+							count++;
+						}
+						else { // If the packet is not valid we save a " " message into array of payloads
+							array_of_payloads[k] = malloc(2);
+							memcpy(array_of_payloads[k], " ", 2);
+						}
+						free(records[k].data);
+					}
 
 				
-				#pragma omp task firstprivate(array_of_payloads, packet_count) private(private_string_count) shared(string_count, array_of_strings_length, array_of_strings)
-				{
-					// Using calloc because we want to initialize every member to 0
-				 	private_string_count = calloc(array_of_strings_length, sizeof(int)); 
+					#pragma omp task firstprivate(array_of_payloads, packet_count) private(private_string_count) shared(string_count, array_of_strings_length, array_of_strings, cache, ac)
+					{
+						// Using calloc because we want to initialize every member to 0
+					 	private_string_count = calloc(array_of_strings_length, sizeof(int)); 
 				 	
-				 	for (int k = 0; k < packet_count; k++) //for every payload
-						for (int i =0 ; i < array_of_strings_length; i++) //for every string 
-							private_string_count[i] += kmp_matcher(array_of_payloads[k],array_of_strings[i], prefix_array[i]);
+					 	STAGE_BEGIN(STAGE_MATCH);
+					 	if (cache == NULL && lanes > 0) {
+							// The payloads of the batch go through the automaton a few at a time, in lock-step
+							struct ac_lanes scan;
+							ac_lanes_init(&scan, ac, lanes, private_string_count);
+							for (int k = 0; k < packet_count; k++)
+								ac_lanes_push(&scan, array_of_payloads[k], strlen(array_of_payloads[k]));
+							ac_lanes_flush(&scan);
+						}
+						else if (cache == NULL && engine == AC) {
+							for (int k = 0; k < packet_count; k++) //for every payload, all the strings at once
+								ac_match(ac, array_of_payloads[k], strlen(array_of_payloads[k]), private_string_count);
+						}
+					 	else if (cache == NULL) {
+						 	for (int k = 0; k < packet_count; k++) //for every payload
+								for (int i =0 ; i < array_of_strings_length; i++) //for every string 
+									private_string_count[i] += kmp_matcher(array_of_payloads[k],array_of_strings[i], prefix_array[i]);
+						}
+						else {
+							// A repeated payload costs a hash and a lookup, a new one is matched and stored
+							int *matches = malloc(array_of_strings_length*sizeof(int));
+							for (int k = 0; k < packet_count; k++) {
+								unsigned int len = strlen(array_of_payloads[k]); //what kmp_matcher scans
+								unsigned long long hash = payload_hash(array_of_payloads[k], len);
+								if (payload_cache_lookup(cache, hash, array_of_payloads[k], len, 0, private_string_count))
+									continue;
+								if (engine == AC) {
+									memset(matches, 0, array_of_strings_length*sizeof(int));
+									ac_match(ac, array_of_payloads[k], len, matches);
+								}
+								else
+									for (int i = 0; i < array_of_strings_length; i++)
+										matches[i] = kmp_matcher(array_of_payloads[k],array_of_strings[i], prefix_array[i]);
+								for (int i = 0; i < array_of_strings_length; i++)
+									private_string_count[i] += matches[i];
+								payload_cache_insert(cache, hash, array_of_payloads[k], len, 0, matches);
+							}
+							free(matches);
+						}
+						STAGE_END(STAGE_MATCH);
 								
 	
-				 	// Merge private string count into shared string count array
-					
+					 	// Merge private string count into shared string count array
 					
-					for (int i = 0; i < array_of_strings_length; i++) {
-						#pragma omp atomic
-						string_count[i]+=private_string_count[i];
-					}
+						STAGE_BEGIN(STAGE_MERGE);
+						for (int i = 0; i < array_of_strings_length; i++) {
+							#pragma omp atomic
+							string_count[i]+=private_string_count[i];
+						}
+						STAGE_END(STAGE_MERGE);
 			 	
-				 	free(private_string_count);
-				}
+					 	free(private_string_count);
+					 	for (int k = 0; k < packet_count; k++)
+					 		free(array_of_payloads[k]);
+					}
 				
-				//if we read less packet than array_of_payloads_length means thath the pcap file is ended
-				if (packet_count<array_of_payloads_length)
-					exit_flag = 1;
+					//if we read less packet than array_of_payloads_length means thath the pcap file is ended
+					if (packet_count<array_of_payloads_length)
+						exit_flag = 1;
 					
-			} //end of while cicle
-		} //end of single pragma
-	} //end of parallel pragma
+				} //end of while cicle
+			} //end of single pragma
+		} //end of parallel pragma
+	}
 	
 	double finish = omp_get_wtime();
+	double bench_finish;
+	GET_TIME(bench_finish);
+	input_stream_close(pcap);
+	input_files_free(&files);
 	
 	/* Now we print the output */
 	printf("Printing the number of appereances of each string throughout the entire pcap file:\n");
@@ -194,7 +445,21 @@ int main(int argc, char *argv[]) {
 			printf("%s: %d times!\n", array_of_strings[i], string_count[i]);
 		
 	// Now we print performance evaluation 
+	if (cache != NULL) {
+		payload_cache_print(cache);
+		payload_cache_free(cache);
+	}
+	int bench_threads = stages != NULL ? pipeline_threads(stages) : thread_count; //the pipeline has at least a reader, a decoder and a matcher
+	if (stages != NULL) {
+		pipeline_print(stages, finish-start);
+		pipeline_free(stages);
+	}
 	printf("Elapsed time = %f seconds\n", finish-start);
+	char variant[64];
+	snprintf(variant, sizeof(variant), "openmp_task%s%s%s%s", stages != NULL ? "-pipeline" : "", engine == AC ? "-ac" : "",
+		cache != NULL ? "-dedup" : "", lanes > 0 ? "-interleave" : "");
+	print_bench_line(variant, 1, bench_threads, total_packets, total_bytes, bench_finish-bench_start);
+	STAGE_REPORT(variant);
 	
 	
 	/* We have to free previously allocated memory */
@@ -207,6 +472,9 @@ int main(int argc, char *argv[]) {
 	} free(array_of_strings);
 	
 	free(string_count);
+	descriptors_free(&descriptors);
+	if (ac != NULL)
+		ac_free(ac);
 
 	return 0;
 }
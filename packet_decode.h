@@ -0,0 +1,116 @@
+/*
+* Library that contain the batch decoder of the headers: decode_batch takes n packets and fills a
+* struct-of-arrays descriptor table (payload offset and length, protocol, ports, flow hash) in one
+* loop. The length checks of dump_UDP_packet/dump_TCP_packet become comparisons whose results are
+* and-ed together, and a header that is not in the packet is read from a block of zeros instead, so
+* the only branches left are the ones the compiler turns into conditional moves.
+* The payloads are the ones of packet_dumping.h: Ethernet, IPv4 with options, the 8 bytes of UDP or
+* the data offset of TCP, and everything captured after them (fragments are not reassembled).
+*
+* Usage:
+*	struct packet_descriptors d = {0}; descriptors_reserve(&d, packet_count);
+*	decode_batch(&d, first, records + first, n);	// records first .. first+n-1, any thread
+*	payload = descriptor_payload(&d, k, records[k].data, IPPROTO_UDP, &len);	// NULL: no UDP payload
+*	descriptors_free(&d);
+*/
+#ifndef _PACKET_DECODE_H_
+#define _PACKET_DECODE_H_
+
+#include <stdlib.h>
+#include <netinet/in.h>
+#include "flow_hash.h"
+
+#define DECODE_BATCH 64		// packets the loops of the tools give to decode_batch at a time
+#define DECODE_ETHERNET 14
+#define DECODE_IP_MIN 20
+#define DECODE_UDP 8
+#define DECODE_TCP_MIN 20
+
+/* A captured packet, the input of decode_batch */
+struct packet_record {
+	unsigned char *data;
+	unsigned int len;
+};
+
+/* Descriptor table, entry k is packet k */
+struct packet_descriptors {
+	int capacity;
+	unsigned int *payload_offset;	// from the start of the packet
+	unsigned int *payload_len;
+	unsigned char *protocol;	// IPPROTO_UDP or IPPROTO_TCP, 0 when there is no payload to match
+	unsigned short *src_port, *dst_port;
+	unsigned int *flow;		// flow_hash of the packet, ports 0 without a UDP/TCP header
+};
+
+static const unsigned char decode_zeros[64];	// the headers of a packet too short to have them
+
+/* Function use to make room for count descriptors, the ones already there are lost */
+void descriptors_reserve(struct packet_descriptors *d, int count) {
+	if (count <= d->capacity)
+		return;
+	d->capacity = count;
+	d->payload_offset = realloc(d->payload_offset, count*sizeof(unsigned int));
+	d->payload_len = realloc(d->payload_len, count*sizeof(unsigned int));
+	d->protocol = realloc(d->protocol, count);
+	d->src_port = realloc(d->src_port, count*sizeof(unsigned short));
+	d->dst_port = realloc(d->dst_port, count*sizeof(unsigned short));
+	d->flow = realloc(d->flow, count*sizeof(unsigned int));
+}
+
+/* Function use to decode the headers of n packets
+* INPUT:
+*	d: the table, with room for first + n descriptors
+	first: descriptor of records[0]
+	records: the packets
+	n: how many of them
+*/
+void decode_batch(struct packet_descriptors *d, int first, const struct packet_record *records, int n) {
+	for (int k = 0; k < n; k++) {
+		const unsigned char *packet = records[k].data;
+		unsigned int caplen = records[k].len;
+		int has_ip = caplen >= DECODE_ETHERNET + DECODE_IP_MIN;
+		const unsigned char *ip = has_ip ? packet + DECODE_ETHERNET : decode_zeros;
+		unsigned int ip_len = (ip[0] & 0x0f) * 4;
+		unsigned int protocol = ip[9];
+		int is_tcp = protocol == IPPROTO_TCP;
+		unsigned int l4_start = DECODE_ETHERNET + ip_len;
+		unsigned int l4_min = is_tcp ? DECODE_TCP_MIN : DECODE_UDP;
+		int ok = has_ip & (ip_len >= DECODE_IP_MIN) & (is_tcp | (protocol == IPPROTO_UDP)) & (caplen >= l4_start + l4_min);
+		const unsigned char *l4 = ok ? packet + l4_start : decode_zeros;
+		unsigned int l4_len = is_tcp ? (l4[12] >> 4) * 4 : DECODE_UDP; //byte 12 is in the header only for tcp
+		ok &= (l4_len >= l4_min) & (caplen >= l4_start + l4_len);
+		unsigned int sport = l4[0] << 8 | l4[1], dport = l4[2] << 8 | l4[3];
+
+		int e = first + k;
+		d->payload_offset[e] = ok ? l4_start + l4_len : caplen;
+		d->payload_len[e] = ok ? caplen - l4_start - l4_len : 0;
+		d->protocol[e] = ok ? protocol : 0;
+		d->src_port[e] = sport;
+		d->dst_port[e] = dport;
+		const struct ip *addresses = (const struct ip *)ip;
+		d->flow[e] = flow_hash_fields(addresses->ip_src.s_addr, addresses->ip_dst.s_addr, sport, dport, protocol) & -has_ip;
+	}
+}
+
+/* Function use to get the payload of descriptor k if the packet is of the protocol
+* OUTPUT
+	the payload inside data, as dump_UDP_packet/dump_TCP_packet return it; NULL for another protocol or
+	a packet too short to have the headers
+*/
+static inline char *descriptor_payload(const struct packet_descriptors *d, int k, unsigned char *data, unsigned int protocol, unsigned int *payload_length) {
+	if (d->protocol[k] != protocol)
+		return NULL;
+	*payload_length = d->payload_len[k];
+	return (char *)data + d->payload_offset[k];
+}
+
+void descriptors_free(struct packet_descriptors *d) {
+	free(d->payload_offset);
+	free(d->payload_len);
+	free(d->protocol);
+	free(d->src_port);
+	free(d->dst_port);
+	free(d->flow);
+}
+
+#endif
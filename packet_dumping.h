@@ -87,7 +87,6 @@ void too_short(const char *truncated_hdr) {
 char* dump_UDP_packet(char *packet, unsigned int * payload_lenght, unsigned int capture_len) {
 
 	struct ip *ip; //from netinet/ip.h
-	struct udp_header *udp_h;
 	unsigned int IP_header_length;
 
 
@@ -127,11 +126,8 @@ char* dump_UDP_packet(char *packet, unsigned int * payload_lenght, unsigned int
 		return NULL;
 	}
 	
-	//get the header
-	udp_h = (struct udp_header *) (packet + IP_header_length + sizeof(struct ether_header));
-	
-	packet += sizeof(udp_h); //Move the packet pointer after the header
-	capture_len -= sizeof(udp_h); //Decrease the capture len yet to be read
+	packet += sizeof(struct UDP_hdr); //Move the packet pointer after the header (8 bytes, not the size of a pointer)
+	capture_len -= sizeof(struct UDP_hdr); //Decrease the capture len yet to be read
 	
 	(*payload_lenght) = capture_len; // Now capture_len is equal to the payload len. We can use it in the calling function
 	
@@ -158,6 +154,11 @@ char* dump_TCP_packet(char *packet, unsigned int * payload_lenght, unsigned int
 	u_int size_ip;
 	u_int size_tcp;
 
+	if (capture_len < SIZE_ETHERNET + 20) { //the lengths below would wrap around
+		//too_short("IP header");
+		return NULL;
+	}
+
 	packet += SIZE_ETHERNET; //move packet pointer adding the ethernet size to get the ip pointer
 	capture_len -= SIZE_ETHERNET; //decrease the capture len yet to be read
 
@@ -167,13 +168,17 @@ char* dump_TCP_packet(char *packet, unsigned int * payload_lenght, unsigned int
 		//too_short("Invalid IP header length: %u bytes\n", size_ip);
 		return NULL;
 	}
+	if (ip->ip_p != IPPROTO_TCP || capture_len < size_ip + 20) { //a packet of another protocol has no tcp header
+		//problem_pkt("non-TCP packet");
+		return NULL;
+	}
 	
 	packet += size_ip; //move packet pointer adding the ethernet size to get the tcp pointer
 	capture_len -= size_ip; //decrease the capture len yet to be read
 	
 	tcp = (struct sniff_tcp*)(packet);
 	size_tcp = TH_OFF(tcp)*4;
-	if (size_tcp < 20) {
+	if (size_tcp < 20 || capture_len < size_tcp) {
 		//too_short("Invalid TCP header length: %u bytes\n", size_tcp);
 		return NULL;
 	}
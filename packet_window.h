@@ -0,0 +1,174 @@
+/*
+* Library that contain the bounded-memory reading of the offline tools: the packets are copied into two
+* windows of window_bytes bytes each, a reader thread fills one while the team matches the packets of
+* the other, and a window is filled again only once it has been released. The memory used by the
+* packets is 2 * window_bytes whatever the size of the captures (a single packet larger than a window
+* gets a window of its size).
+*
+* Usage:
+*	struct window_reader *wr = window_reader_start(in, window_bytes);
+*	struct packet_window *w;
+*	while ((w = window_next(wr)) != NULL) { ... w->packets[0 .. w->count) ...; window_release(wr, w); }
+*	window_reader_stop(wr);
+*/
+#ifndef _PACKET_WINDOW_H_
+#define _PACKET_WINDOW_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "input_files.h"
+#include "incremental_state.h"	//PCAP_RECORD_HEADER
+
+#define WINDOW_MIN_BYTES (1 << 20)
+#define DEFAULT_WINDOW_MB 64
+
+struct window_packet {
+	unsigned char *data;	// inside the bytes of the window
+	unsigned int len;
+};
+
+struct packet_window {
+	unsigned char *bytes;	// the packets, one after the other
+	size_t used, capacity;
+	struct window_packet *packets;
+	int count, slots;
+	long long packet_bytes;	// captured bytes of the packets
+	long long record_bytes;	// bytes of their pcap records, headers included
+	int full;		// filled by the reader and not released yet
+	int last;		// no packets after this window
+};
+
+struct window_reader {
+	struct input_stream *in;
+	struct packet_window window[2];
+	int next;		// window the team gets next
+	int stop, done;
+	pthread_t reader;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/* Body of the reader thread: fill the windows in turn, waiting for the team to release each of them */
+void *window_reader_main(void *arg) {
+	struct window_reader *wr = arg;
+	struct pcap_pkthdr *header;
+	const unsigned char *data;
+	int pending = 0; //a packet already read that did not fit in the previous window
+	int end = 0;
+	for (int k = 0; !end; k = 1 - k) {
+		struct packet_window *w = &wr->window[k];
+		pthread_mutex_lock(&wr->lock);
+		while (w->full && !wr->stop)
+			pthread_cond_wait(&wr->cond, &wr->lock);
+		int stop = wr->stop;
+		pthread_mutex_unlock(&wr->lock);
+		if (stop)
+			break;
+
+		w->used = 0;
+		w->count = 0;
+		w->packet_bytes = w->record_bytes = 0;
+		while (1) {
+			if (!pending && input_next_ex(wr->in, &header, &data) < 0) {
+				end = 1;
+				break;
+			}
+			pending = 1; //data stays valid until the next input_next_ex
+			if (w->used + header->caplen > w->capacity) {
+				if (w->count > 0) //it goes to the next window
+					break;
+				w->capacity = header->caplen; //a packet larger than a window, the window is empty
+				w->bytes = realloc(w->bytes, w->capacity);
+			}
+			if (w->count == w->slots) {
+				w->slots = w->slots ? w->slots * 2 : 1024;
+				w->packets = realloc(w->packets, w->slots * sizeof(struct window_packet));
+			}
+			memcpy(w->bytes + w->used, data, header->caplen);
+			w->packets[w->count].data = w->bytes + w->used;
+			w->packets[w->count].len = header->caplen;
+			w->count++;
+			w->used += header->caplen;
+			w->packet_bytes += header->caplen;
+			w->record_bytes += PCAP_RECORD_HEADER + header->caplen;
+			pending = 0;
+		}
+
+		pthread_mutex_lock(&wr->lock);
+		w->full = 1;
+		w->last = end;
+		pthread_cond_broadcast(&wr->cond);
+		pthread_mutex_unlock(&wr->lock);
+	}
+	return NULL;
+}
+
+/* Function use to start reading the stream into windows of window_bytes bytes (at least WINDOW_MIN_BYTES)
+* OUTPUT
+	the reader, the first window is being filled when it returns
+*/
+struct window_reader *window_reader_start(struct input_stream *in, long long window_bytes) {
+	struct window_reader *wr = calloc(1, sizeof(struct window_reader));
+	wr->in = in;
+	if (window_bytes < WINDOW_MIN_BYTES)
+		window_bytes = WINDOW_MIN_BYTES;
+	for (int k = 0; k < 2; k++) {
+		wr->window[k].capacity = window_bytes;
+		wr->window[k].bytes = malloc(window_bytes); //pages are touched only when the packets are copied
+	}
+	pthread_mutex_init(&wr->lock, NULL);
+	pthread_cond_init(&wr->cond, NULL);
+	if (pthread_create(&wr->reader, NULL, window_reader_main, wr) != 0) {
+		perror("error starting the window reader: ");
+		exit(1);
+	}
+	return wr;
+}
+
+/* Function use to give a window back to the reader, its packets must not be used after this */
+void window_release(struct window_reader *wr, struct packet_window *w) {
+	pthread_mutex_lock(&wr->lock);
+	w->full = 0;
+	wr->next = 1 - wr->next;
+	pthread_cond_broadcast(&wr->cond);
+	pthread_mutex_unlock(&wr->lock);
+}
+
+/* Function use to get the next window, waiting for the reader to fill it
+* OUTPUT
+	the window, to be given back with window_release; NULL after the last one
+*/
+struct packet_window *window_next(struct window_reader *wr) {
+	if (wr->done)
+		return NULL;
+	struct packet_window *w = &wr->window[wr->next];
+	pthread_mutex_lock(&wr->lock);
+	while (!w->full)
+		pthread_cond_wait(&wr->cond, &wr->lock);
+	pthread_mutex_unlock(&wr->lock);
+	wr->done = w->last;
+	if (w->count == 0) { //the captures ended right after the previous window
+		window_release(wr, w);
+		return NULL;
+	}
+	return w;
+}
+
+void window_reader_stop(struct window_reader *wr) {
+	pthread_mutex_lock(&wr->lock);
+	wr->stop = 1;
+	pthread_cond_broadcast(&wr->cond);
+	pthread_mutex_unlock(&wr->lock);
+	pthread_join(wr->reader, NULL);
+	for (int k = 0; k < 2; k++) {
+		free(wr->window[k].bytes);
+		free(wr->window[k].packets);
+	}
+	pthread_mutex_destroy(&wr->lock);
+	pthread_cond_destroy(&wr->cond);
+	free(wr);
+}
+
+#endif
@@ -0,0 +1,117 @@
+/*
+* Library that contain the planner choosing between data parallel matching (one automaton,
+* payloads split between threads) and pattern parallel matching (the strings split into
+* cache sized sub-automata, every group of threads sees every payload)
+*/
+#ifndef _PATTERN_PARTITION_H_
+#define _PATTERN_PARTITION_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "aho_corasick.h"
+
+#define PARTITION_AUTO 0
+#define PARTITION_DATA 1
+#define PARTITION_PATTERN 2
+
+/* Used when the L2 size can not be read from the system */
+#define DEFAULT_CACHE_BYTES (1024*1024)
+
+struct partition_plan {
+	int mode;			// PARTITION_DATA or PARTITION_PATTERN
+	int group_count;		// number of sub-automata, 1 in PARTITION_DATA
+	struct ac_automaton **groups;	// the sub-automata
+	long total_bytes;		// size of the automaton of all the strings
+	long cache_bytes;		// budget of every sub-automaton
+};
+
+/* Function use to get the per core cache budget of a sub-automaton (the L2 size) */
+long cache_budget_bytes(void) {
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	return l2 > 0 ? l2 : DEFAULT_CACHE_BYTES;
+}
+
+static char **sort_strings_base; //qsort has no context argument
+static int compare_string_index(const void *a, const void *b) {
+	return strcmp(sort_strings_base[*(const int *)a], sort_strings_base[*(const int *)b]);
+}
+
+/* Function use to plan the matching and build the automata
+* INPUT:
+*	array_of_strings, array_of_strings_length: all the strings
+	thread_count: number of threads of the matching team
+	requested: PARTITION_AUTO to let the planner decide, otherwise the mode to use
+	cache_bytes: budget of a sub-automaton, <= 0 for cache_budget_bytes()
+
+* OUTPUT
+	the plan, to be released with free_partition_plan
+
+* Strings are sorted so that a group is a contiguous slice sharing as many prefixes as possible,
+* then cut greedily when the trie of the slice would exceed the budget.
+* Without strings the plan is always PARTITION_DATA.
+* PARTITION_AUTO picks PARTITION_PATTERN when the whole automaton does not fit the budget and
+* there are at least two threads: one thread alone would scan every payload once per group
+* without any thread sharing the work, which only pays off with very large tables.
+*/
+struct partition_plan* plan_partition(char **array_of_strings, int array_of_strings_length, int thread_count, int requested, long cache_bytes) {
+	struct partition_plan *plan = malloc(sizeof(struct partition_plan));
+	plan->cache_bytes = cache_bytes > 0 ? cache_bytes : cache_budget_bytes();
+
+	int *sorted = malloc((array_of_strings_length > 0 ? array_of_strings_length : 1)*sizeof(int));
+	for (int i = 0; i < array_of_strings_length; i++)
+		sorted[i] = i;
+	sort_strings_base = array_of_strings;
+	qsort(sorted, array_of_strings_length, sizeof(int), compare_string_index);
+	plan->total_bytes = ac_table_bytes(ac_trie_states(array_of_strings, sorted, array_of_strings_length));
+
+	plan->mode = requested;
+	if (requested == PARTITION_AUTO)
+		plan->mode = (plan->total_bytes > plan->cache_bytes && thread_count > 1) ? PARTITION_PATTERN : PARTITION_DATA;
+	if (array_of_strings_length == 0) //no strings to split: one empty automaton, pattern mode would have no group at all
+		plan->mode = PARTITION_DATA;
+
+	plan->group_count = 0;
+	plan->groups = malloc(sizeof(struct ac_automaton *));
+	if (plan->mode == PARTITION_DATA) {
+		plan->groups[plan->group_count++] = ac_build(array_of_strings, sorted, array_of_strings_length);
+	}
+	else {
+		int first = 0;
+		while (first < array_of_strings_length) {
+			int last = first + 1; //at least one string per group
+			long states = 1 + strlen(array_of_strings[sorted[first]]);
+			while (last < array_of_strings_length) {
+				// same count as ac_trie_states, one string at a time
+				long added = ac_trie_states(array_of_strings, sorted + last - 1, 2) - (1 + strlen(array_of_strings[sorted[last-1]]));
+				if (ac_table_bytes(states + added) > plan->cache_bytes)
+					break;
+				states += added;
+				last++;
+			}
+			plan->groups = realloc(plan->groups, (plan->group_count+1)*sizeof(struct ac_automaton *));
+			plan->groups[plan->group_count++] = ac_build(array_of_strings, sorted + first, last - first);
+			first = last;
+		}
+	}
+	free(sorted);
+	return plan;
+}
+
+/* Function use to print the plan chosen */
+void print_partition_plan(const struct partition_plan *plan, int thread_count) {
+	printf("Automaton: %ld KB, cache budget %ld KB -> %s parallel, %d sub-automata on %d threads\n",
+		plan->total_bytes/1024, plan->cache_bytes/1024,
+		plan->mode == PARTITION_DATA ? "data" : "pattern", plan->group_count, thread_count);
+}
+
+/* Function use to release the plan and its automata */
+void free_partition_plan(struct partition_plan *plan) {
+	for (int g = 0; g < plan->group_count; g++)
+		ac_free(plan->groups[g]);
+	free(plan->groups);
+	free(plan);
+}
+
+#endif
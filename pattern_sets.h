@@ -0,0 +1,181 @@
+/*
+* Library that contain the pattern sets of the offline tools: the strings argument can be a list of
+* strings files separated by commas (team_a.txt,team_b.txt,...), one set per file. A string in several
+* files is matched once, as one string of the automaton, and carries a bitmap of the sets it belongs
+* to; at the end every set gets its own report, in the order of its file, out of a single read and
+* scan of the captures. With a single file nothing changes: its strings are kept as they are,
+* duplicates included, and the report is the usual one.
+*
+* Usage:
+*	struct pattern_sets sets; pattern_sets_load(argv[2], &sets, &array_of_strings, &array_of_strings_length);
+*	... string_count[i] for every string of array_of_strings ...
+*	pattern_sets_print(&sets, array_of_strings, string_count); pattern_sets_free(&sets);
+*/
+#ifndef _PATTERN_SETS_H_
+#define _PATTERN_SETS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PATTERN_SETS 64	// bits of the bitmap of a string
+
+struct pattern_sets {
+	int count;			// files
+	int strings;			// strings of array_of_strings
+	char **names;			// path of every file
+	int *set_length;		// distinct strings of every file (with a single file every line, as before)
+	int **set_strings;		// number in array_of_strings of every string of every file, in file order
+	unsigned long long *bitmap;	// sets of every string of array_of_strings, bit s for file s
+};
+
+/* Function use to find a string among the ones already loaded, with an open addressing table of
+ * their numbers (-1 for a free slot) */
+static int pattern_sets_find(char **strings, int *table, int table_size, const char *s, int *slot) {
+	unsigned long long h = 14695981039346656037ULL; //FNV-1a
+	for (const unsigned char *c = (const unsigned char *)s; *c != '\0'; c++)
+		h = (h ^ *c) * 1099511628211ULL;
+	*slot = h & (table_size - 1);
+	while (table[*slot] != -1) {
+		if (strcmp(strings[table[*slot]], s) == 0)
+			return table[*slot];
+		*slot = (*slot + 1) & (table_size - 1);
+	}
+	return -1;
+}
+
+/* Function use to load the strings of one or more files
+* INPUT:
+*	spec: a strings file, or several separated by commas
+	sets: filled with the sets, to be freed with pattern_sets_free
+	array_of_strings, array_of_strings_length: set to the strings to match, each one once when there
+	are several files; the strings are freed by the tool as before
+* OUTPUT
+	number of sets; exit if a file cannot be read
+*/
+int pattern_sets_load(const char *spec, struct pattern_sets *sets, char ***array_of_strings, int *array_of_strings_length) {
+	memset(sets, 0, sizeof(*sets));
+	char *list = strdup(spec);
+	for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+		if (sets->count == MAX_PATTERN_SETS) {
+			fprintf(stderr, "error: more than %d strings files\n", MAX_PATTERN_SETS);
+			exit(1);
+		}
+		sets->names = realloc(sets->names, (sets->count+1)*sizeof(char *));
+		sets->names[sets->count++] = strdup(name);
+	}
+	free(list);
+	if (sets->count == 0) {
+		fprintf(stderr, "error: no strings file in %s\n", spec);
+		exit(1);
+	}
+
+	char **strings = malloc(sizeof(char *));
+	sets->bitmap = malloc(sizeof(unsigned long long));
+	int capacity = 1; //keeps track of array's size
+	int count = 0; //actual number of strings
+	int table_size = 1024, *table = malloc(table_size*sizeof(int)); //numbers of the strings, several files only
+	memset(table, -1, table_size*sizeof(int));
+	sets->set_length = calloc(sets->count, sizeof(int));
+	sets->set_strings = calloc(sets->count, sizeof(int *));
+	for (int s = 0; s < sets->count; s++) {
+		//open file and check for errors
+		FILE *fp = fopen(sets->names[s], "r");
+		if (fp == NULL) {
+			fprintf(stderr, "error opening file %s: ", sets->names[s]);
+			perror("");
+			exit(1);
+		}
+		char str[100]; //buffer for saving the strings once pulled out by fscanf
+		int set_capacity = 0;
+		while (fscanf(fp, "%99s", str) != EOF) { //we read all the file word by word
+			int slot, number = -1;
+			if (sets->count > 1)
+				number = pattern_sets_find(strings, table, table_size, str, &slot);
+			if (number < 0) { //a new string
+				if (count == capacity) {
+					//it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
+					strings = realloc(strings, (capacity*2)*sizeof(char *));
+					sets->bitmap = realloc(sets->bitmap, (capacity*2)*sizeof(unsigned long long));
+					capacity *= 2;
+				}
+				number = count++;
+				strings[number] = strdup(str);
+				sets->bitmap[number] = 0;
+				if (sets->count > 1) {
+					table[slot] = number;
+					if (2*count > table_size) { //kept at most half full
+						table_size *= 2;
+						table = realloc(table, table_size*sizeof(int));
+						memset(table, -1, table_size*sizeof(int));
+						for (int i = 0; i < count; i++) {
+							pattern_sets_find(strings, table, table_size, strings[i], &slot);
+							table[slot] = i;
+						}
+					}
+				}
+			}
+			if (sets->bitmap[number] >> s & 1) //already in this set, twice in its file
+				continue;
+			sets->bitmap[number] |= 1ULL << s;
+			if (sets->set_length[s] == set_capacity) {
+				set_capacity = set_capacity ? set_capacity*2 : 64;
+				sets->set_strings[s] = realloc(sets->set_strings[s], set_capacity*sizeof(int));
+			}
+			sets->set_strings[s][sets->set_length[s]++] = number;
+		}
+		fclose(fp);
+	}
+	free(table);
+
+	sets->strings = count;
+	*array_of_strings = strings;
+	*array_of_strings_length = count;
+	return sets->count;
+}
+
+/* Function use to print the counts of the strings, one report per set when there are several files */
+void pattern_sets_print(const struct pattern_sets *sets, char **array_of_strings, const int *string_count) {
+	printf("Printing the number of appereances of each string throughout the entire pcap file:\n");
+	if (sets->count == 1) {
+		for (int i = 0; i < sets->set_length[0]; i++)
+			if (string_count[i] != 0)
+				printf("%s: %d times!\n", array_of_strings[i], string_count[i]);
+		return;
+	}
+	int listed = 0, shared = 0;
+	int found[MAX_PATTERN_SETS] = {0}; //distinct strings of every set with a match
+	long long matches[MAX_PATTERN_SETS] = {0};
+	for (int s = 0; s < sets->count; s++)
+		listed += sets->set_length[s];
+	for (int i = 0; i < sets->strings; i++) { //the matches of a string go to every set of its bitmap
+		shared += (sets->bitmap[i] & (sets->bitmap[i] - 1)) != 0; //more than one bit
+		for (int s = 0; s < sets->count && string_count[i] != 0; s++)
+			if (sets->bitmap[i] >> s & 1) {
+				found[s]++;
+				matches[s] += string_count[i];
+			}
+	}
+	printf("Pattern sets: %d files, %d strings, %d matched once for all of them, %d in more than one set\n", sets->count, listed, sets->strings, shared);
+	for (int s = 0; s < sets->count; s++) {
+		printf("Set %d (%s): %d strings found, %lld matches\n", s + 1, sets->names[s], found[s], matches[s]);
+		for (int k = 0; k < sets->set_length[s]; k++) {
+			int i = sets->set_strings[s][k];
+			if (string_count[i] != 0)
+				printf("%s: %d times!\n", array_of_strings[i], string_count[i]);
+		}
+	}
+}
+
+void pattern_sets_free(struct pattern_sets *sets) {
+	for (int s = 0; s < sets->count; s++) {
+		free(sets->names[s]);
+		free(sets->set_strings[s]);
+	}
+	free(sets->names);
+	free(sets->set_length);
+	free(sets->set_strings);
+	free(sets->bitmap);
+}
+
+#endif
@@ -0,0 +1,237 @@
+/*
+* Library that contain the payload deduplication cache: captures carry many byte-identical payloads
+* (SSDP NOTIFY/LOCATION announcements for example), so the match vector of a payload is kept under
+* a fast hash of its bytes and a repeated payload costs one hash and one lookup instead of a scan.
+* The cache is bounded and set associative (PAYLOAD_CACHE_WAYS entries per set, round robin eviction),
+* its sets are guarded by striped omp locks so the workers can look up and insert concurrently.
+* An entry keeps a copy of the payload, a hit needs the same bytes and not only the same hash, and
+* only the strings with matches (string, matches pairs), so its size does not grow with the strings.
+* Payloads longer than PAYLOAD_CACHE_MAX_LEN are never cached: the repeated ones are small, and the
+* copies of entries payloads stay bounded.
+*
+* Usage:
+*	struct payload_cache *cache = payload_cache_create(entries, strings_count);
+*	unsigned long long h = payload_hash(payload, len);
+*	if (!payload_cache_lookup(cache, h, payload, len, group, string_count)) {	// on a hit the matches are added to string_count
+*		... match into matches, add matches to string_count ...
+*		payload_cache_insert(cache, h, payload, len, group, matches);
+*	}
+*/
+#ifndef _PAYLOAD_CACHE_H_
+#define _PAYLOAD_CACHE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#define PAYLOAD_CACHE_WAYS 4
+#define PAYLOAD_CACHE_STRIPES 64	// locks, every one guards the sets with the same low bits
+#define DEFAULT_PAYLOAD_CACHE_ENTRIES 65536
+#define PAYLOAD_CACHE_MAX_LEN 1500	// longer payloads are matched every time
+
+/* wyhash style mixing: 64x64->128 multiply, folded */
+#define WY_P0 0xa0761d6478bd642fULL
+#define WY_P1 0xe7037ed1a0b428dbULL
+#define WY_P2 0x8ebc6af09c88c6e3ULL
+#define WY_P3 0x589965cc75374cc3ULL
+
+static inline unsigned long long wy_mum(unsigned long long a, unsigned long long b) {
+	__uint128_t r = (__uint128_t)a * b;
+	return (unsigned long long)(r >> 64) ^ (unsigned long long)r;
+}
+
+static inline unsigned long long wy_read8(const unsigned char *p) {
+	unsigned long long v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline unsigned long long wy_read4(const unsigned char *p) {
+	unsigned int v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+/* Function use to hash the bytes of a payload, about one multiply every 16 bytes */
+unsigned long long payload_hash(const char *data, unsigned int len) {
+	const unsigned char *p = (const unsigned char *)data;
+	unsigned long long seed = wy_mum(WY_P0, WY_P1), a, b;
+	if (len <= 16) {
+		if (len >= 4) {
+			a = wy_read4(p) << 32 | wy_read4(p + ((len >> 3) << 2));
+			b = wy_read4(p + len - 4) << 32 | wy_read4(p + len - 4 - ((len >> 3) << 2));
+		}
+		else if (len > 0) {
+			a = (unsigned long long)p[0] << 16 | (unsigned long long)p[len >> 1] << 8 | p[len - 1];
+			b = 0;
+		}
+		else
+			a = b = 0;
+	}
+	else {
+		unsigned int i = len;
+		if (i > 48) { //three independent lanes
+			unsigned long long see1 = seed, see2 = seed;
+			do {
+				seed = wy_mum(wy_read8(p) ^ WY_P1, wy_read8(p + 8) ^ seed);
+				see1 = wy_mum(wy_read8(p + 16) ^ WY_P2, wy_read8(p + 24) ^ see1);
+				see2 = wy_mum(wy_read8(p + 32) ^ WY_P3, wy_read8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wy_mum(wy_read8(p) ^ WY_P1, wy_read8(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = wy_read8(p + i - 16);
+		b = wy_read8(p + i - 8);
+	}
+	return wy_mum(WY_P1 ^ len, wy_mum(a ^ WY_P1, b ^ seed));
+}
+
+struct payload_cache_entry {
+	unsigned long long hash;
+	unsigned int len;
+	int group;		// automaton the payload has been matched with, the same bytes have other matches in another one
+	int valid;
+	int match_count;	// strings with matches
+	int *pairs;		// string, matches for every one of them, then the bytes of the payload (one allocation)
+	char *bytes;
+};
+
+/* A lock and the counters of the lookups it has guarded, padded so that stripes do not share a cache line */
+struct payload_cache_stripe {
+	omp_lock_t lock;
+	long long hits;
+	long long lookups;
+	char pad[64];
+};
+
+struct payload_cache {
+	int sets;			// power of two
+	int strings_count;
+	struct payload_cache_entry *entries;	// sets x PAYLOAD_CACHE_WAYS
+	unsigned char *next_victim;	// round robin eviction, one per set
+	struct payload_cache_stripe stripe[PAYLOAD_CACHE_STRIPES];
+};
+
+/* Function use to create a cache of at least entries payloads, rounded up to whole sets of a power of two */
+struct payload_cache *payload_cache_create(int entries, int strings_count) {
+	struct payload_cache *c = calloc(1, sizeof(struct payload_cache));
+	c->sets = 1;
+	while (c->sets * PAYLOAD_CACHE_WAYS < entries)
+		c->sets *= 2;
+	c->strings_count = strings_count;
+	c->entries = calloc((size_t)c->sets * PAYLOAD_CACHE_WAYS, sizeof(struct payload_cache_entry));
+	c->next_victim = calloc(c->sets, 1);
+	for (int s = 0; s < PAYLOAD_CACHE_STRIPES; s++)
+		omp_init_lock(&c->stripe[s].lock);
+	return c;
+}
+
+static inline int payload_cache_same(const struct payload_cache_entry *e, unsigned long long hash, const char *payload, unsigned int len, int group) {
+	return e->valid && e->hash == hash && e->len == len && e->group == group && memcmp(e->bytes, payload, len) == 0;
+}
+
+/* Function use to add the matches of the payload to string_count, if it is in the cache
+* INPUT:
+*	hash: payload_hash of the payload
+	payload, len: its bytes
+	group: the automaton it is matched with, 0 if there is only one
+* OUTPUT
+	1 on a hit, 0 on a miss (string_count untouched)
+*/
+int payload_cache_lookup(struct payload_cache *c, unsigned long long hash, const char *payload, unsigned int len, int group, int *string_count) {
+	if (len > PAYLOAD_CACHE_MAX_LEN)
+		return 0;
+	int set = hash & (c->sets - 1);
+	struct payload_cache_stripe *stripe = &c->stripe[set & (PAYLOAD_CACHE_STRIPES - 1)];
+	struct payload_cache_entry *e = &c->entries[set * PAYLOAD_CACHE_WAYS];
+	int hit = 0;
+	omp_set_lock(&stripe->lock);
+	stripe->lookups++;
+	for (int w = 0; w < PAYLOAD_CACHE_WAYS; w++)
+		if (payload_cache_same(&e[w], hash, payload, len, group)) {
+			for (int m = 0; m < e[w].match_count; m++)
+				string_count[e[w].pairs[2*m]] += e[w].pairs[2*m+1];
+			stripe->hits++;
+			hit = 1;
+			break;
+		}
+	omp_unset_lock(&stripe->lock);
+	return hit;
+}
+
+/* Function use to store the matches of the payload (matches has strings_count counters), evicting the oldest entry of its set */
+void payload_cache_insert(struct payload_cache *c, unsigned long long hash, const char *payload, unsigned int len, int group, const int *matches) {
+	if (len > PAYLOAD_CACHE_MAX_LEN)
+		return;
+	int match_count = 0;
+	for (int i = 0; i < c->strings_count; i++)
+		match_count += matches[i] != 0;
+	int *pairs = malloc(2*match_count*sizeof(int) + len + 1); //copied outside the lock
+	for (int i = 0, m = 0; i < c->strings_count; i++)
+		if (matches[i] != 0) {
+			pairs[2*m] = i;
+			pairs[2*m+1] = matches[i];
+			m++;
+		}
+	char *bytes = (char *)(pairs + 2*match_count);
+	memcpy(bytes, payload, len);
+
+	int set = hash & (c->sets - 1);
+	struct payload_cache_stripe *stripe = &c->stripe[set & (PAYLOAD_CACHE_STRIPES - 1)];
+	struct payload_cache_entry *e = &c->entries[set * PAYLOAD_CACHE_WAYS];
+	omp_set_lock(&stripe->lock);
+	int way = -1;
+	for (int w = 0; w < PAYLOAD_CACHE_WAYS; w++)
+		if (payload_cache_same(&e[w], hash, payload, len, group)) { //another worker got here first
+			omp_unset_lock(&stripe->lock);
+			free(pairs);
+			return;
+		}
+		else if (!e[w].valid && way < 0)
+			way = w;
+	if (way < 0) {
+		way = c->next_victim[set];
+		c->next_victim[set] = (way + 1) % PAYLOAD_CACHE_WAYS;
+	}
+	int *evicted = e[way].valid ? e[way].pairs : NULL;
+	e[way].hash = hash;
+	e[way].len = len;
+	e[way].group = group;
+	e[way].valid = 1;
+	e[way].match_count = match_count;
+	e[way].pairs = pairs;
+	e[way].bytes = bytes;
+	omp_unset_lock(&stripe->lock);
+	free(evicted);
+}
+
+/* Function use to print the hit rate of the cache */
+void payload_cache_print(struct payload_cache *c) {
+	long long hits = 0, lookups = 0;
+	for (int s = 0; s < PAYLOAD_CACHE_STRIPES; s++) {
+		hits += c->stripe[s].hits;
+		lookups += c->stripe[s].lookups;
+	}
+	printf("Payload cache: %lld hits out of %lld lookups (%.2f%%), %d entries\n", hits, lookups,
+		lookups > 0 ? 100.0 * hits / lookups : 0, c->sets * PAYLOAD_CACHE_WAYS);
+}
+
+void payload_cache_free(struct payload_cache *c) {
+	for (int s = 0; s < PAYLOAD_CACHE_STRIPES; s++)
+		omp_destroy_lock(&c->stripe[s].lock);
+	for (int k = 0; k < c->sets * PAYLOAD_CACHE_WAYS; k++)
+		if (c->entries[k].valid)
+			free(c->entries[k].pairs);
+	free(c->entries);
+	free(c->next_victim);
+	free(c);
+}
+
+#endif
@@ -0,0 +1,293 @@
+/* 	Compilation: gcc -g -Wall -O2 pcap_generator.c -o pcap_generator -lm
+	Usage: ./pcap_generator -o <out.pcap> [-n records] [-B max_bytes] [-d size_distribution] [-t tcp_fraction]
+		[-f flows] [-F fragment_fraction] [-p strings.txt] [-m matches_per_KB] [-s seed]
+	-n counts the records, fragments included; without -n and -B the file has 1000 records, with -B alone
+	it is cut only by size.
+	size_distribution: fixed:N, uniform:MIN:MAX, exp:MEAN or bimodal:SMALL:LARGE:P_LARGE (payload bytes)
+	Example: ./pcap_generator -o mega_udp.pcap -n 50167 -d bimodal:120:1400:0.2 -f 64 -p strings.txt -m 2 -s 1
+	The same options and seed always write the same file, byte for byte.
+	Payloads are filled with digits and punctuation, so the only letters in them are the planted strings.
+	The occurrences of every string in the payloads (before fragmentation) are printed on stderr,
+	on an unfragmented capture they are what the matchers must report.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+#include "aho_corasick.h"
+
+#define ETHER_LEN 14
+#define IP_LEN 20
+#define UDP_LEN 8
+#define TCP_LEN 20
+#define MTU 1500
+#define SNAPLEN 65535
+#define MAX_PAYLOAD (SNAPLEN - ETHER_LEN - IP_LEN - TCP_LEN)	// the biggest frame still fits the snaplen
+
+#define FIXED 0
+#define UNIFORM 1
+#define EXPONENTIAL 2
+#define BIMODAL 3
+
+/* Random generator (splitmix64): tiny, fast and the same on every platform */
+static uint64_t rng_state;
+uint64_t next_random(void) {
+	uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* Uniform double in [0, 1) */
+double next_uniform(void) {
+	return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Filler of the payloads: no letters, so no string can be matched by accident */
+static const char filler[] = "0123456789 -_.,:;/=+#@!?()[]{}<>";
+
+struct size_distribution {
+	int kind;
+	double a, b, c;
+};
+
+int payload_size(const struct size_distribution *d) {
+	double size;
+	switch (d->kind) {
+	case FIXED: size = d->a; break;
+	case UNIFORM: size = d->a + next_uniform() * (d->b - d->a + 1); break;
+	case EXPONENTIAL: size = -d->a * log(1.0 - next_uniform()); break;
+	default: size = next_uniform() < d->c ? d->b : d->a;
+	}
+	if (size < 0)
+		size = 0;
+	if (size > MAX_PAYLOAD)
+		size = MAX_PAYLOAD;
+	return (int)size;
+}
+
+/* Write a little endian 16/32 bit value, the pcap headers use the host order of the writer */
+void put16(unsigned char *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+void put32(unsigned char *p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; }
+/* Network byte order, for the packet headers */
+void put16be(unsigned char *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+void put32be(unsigned char *p, uint32_t v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+
+uint16_t ip_checksum(const unsigned char *ip) {
+	uint32_t sum = 0;
+	for (int i = 0; i < IP_LEN; i += 2)
+		sum += (ip[i] << 8) | ip[i+1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+/* Every record gets a timestamp 10us after the previous one, from a fixed epoch */
+static uint64_t timestamp_us = 1600000000ULL * 1000000ULL;
+static unsigned long long records_written = 0, bytes_written = 0;
+
+void write_record(FILE *out, const unsigned char *frame, int len) {
+	unsigned char rec[16];
+	put32(rec, timestamp_us / 1000000);
+	put32(rec + 4, timestamp_us % 1000000);
+	put32(rec + 8, len);
+	put32(rec + 12, len);
+	fwrite(rec, 1, 16, out);
+	fwrite(frame, 1, len, out);
+	timestamp_us += 10;
+	records_written++;
+	bytes_written += 16 + len;
+}
+
+int main(int argc, char *argv[]) {
+	const char *output_path = NULL;
+	const char *strings_file_path = NULL;
+	long long packet_count = -1; //records, -1: no limit
+	unsigned long long max_bytes = 0; //0: no limit
+	struct size_distribution dist = {BIMODAL, 120, 1400, 0.2};
+	double tcp_fraction = 0, fragment_fraction = 0, matches_per_kb = 0;
+	int flow_count = 16;
+	int opt;
+
+	rng_state = 1;
+	while ((opt = getopt(argc, argv, "o:n:B:d:t:f:F:p:m:s:")) != -1) {
+		switch (opt) {
+		case 'o': output_path = optarg; break;
+		case 'n': packet_count = atoll(optarg); break;
+		case 'B': max_bytes = strtoull(optarg, NULL, 10); break;
+		case 't': tcp_fraction = atof(optarg); break;
+		case 'f': flow_count = atoi(optarg); break;
+		case 'F': fragment_fraction = atof(optarg); break;
+		case 'p': strings_file_path = optarg; break;
+		case 'm': matches_per_kb = atof(optarg); break;
+		case 's': rng_state = strtoull(optarg, NULL, 10); break;
+		case 'd':
+			if (sscanf(optarg, "fixed:%lf", &dist.a) == 1)
+				dist.kind = FIXED;
+			else if (sscanf(optarg, "uniform:%lf:%lf", &dist.a, &dist.b) == 2)
+				dist.kind = UNIFORM;
+			else if (sscanf(optarg, "exp:%lf", &dist.a) == 1)
+				dist.kind = EXPONENTIAL;
+			else if (sscanf(optarg, "bimodal:%lf:%lf:%lf", &dist.a, &dist.b, &dist.c) == 3)
+				dist.kind = BIMODAL;
+			else {
+				printf("unknown size distribution %s\n", optarg);
+				exit(1);
+			}
+			break;
+		default:
+			output_path = NULL;
+		}
+	}
+	if (output_path == NULL || flow_count < 1 || (matches_per_kb > 0 && strings_file_path == NULL)) {
+		printf("USAGE: ./pcap_generator -o <out.pcap> [-n records] [-B max_bytes] [-d size_distribution] [-t tcp_fraction] [-f flows] [-F fragment_fraction] [-p strings.txt] [-m matches_per_KB] [-s seed]\n");
+		exit(1);
+	}
+	if (packet_count < 0 && max_bytes == 0) //no limit at all
+		packet_count = 1000;
+
+	/* Reading the strings to plant */
+	char **array_of_strings = malloc(sizeof(char *));
+	int array_of_strings_length = 0;
+	if (strings_file_path != NULL) {
+		FILE *fp = fopen(strings_file_path, "r");
+		if (fp == NULL) {
+			perror("error opening file: ");
+			exit(1);
+		}
+		char str[100];
+		while (fscanf(fp, "%99s", str) != EOF) {
+			array_of_strings = realloc(array_of_strings, (array_of_strings_length+1)*sizeof(char *));
+			array_of_strings[array_of_strings_length++] = strdup(str);
+		}
+		fclose(fp);
+	}
+	int *planted = calloc(array_of_strings_length > 0 ? array_of_strings_length : 1, sizeof(int));
+	int *string_index = malloc((array_of_strings_length > 0 ? array_of_strings_length : 1)*sizeof(int));
+	for (int s = 0; s < array_of_strings_length; s++)
+		string_index[s] = s;
+	struct ac_automaton *ac = ac_build(array_of_strings, string_index, array_of_strings_length); //to count what has been planted
+
+	/* Flows: addresses, ports and protocol are fixed per flow, TCP flows keep their sequence number */
+	uint32_t *flow_seq = calloc(flow_count, sizeof(uint32_t));
+	unsigned char *flow_tcp = malloc(flow_count);
+	for (int f = 0; f < flow_count; f++)
+		flow_tcp[f] = next_uniform() < tcp_fraction;
+
+	FILE *out = fopen(output_path, "wb");
+	if (out == NULL) {
+		perror("error opening output file: ");
+		exit(1);
+	}
+	unsigned char global_header[24];
+	put32(global_header, 0xa1b2c3d4);
+	put16(global_header + 4, 2);
+	put16(global_header + 6, 4);
+	put32(global_header + 8, 0);
+	put32(global_header + 12, 0);
+	put32(global_header + 16, SNAPLEN);
+	put32(global_header + 20, 1); //ethernet
+	fwrite(global_header, 1, 24, out);
+	bytes_written = 24;
+
+	unsigned char *datagram = malloc(IP_LEN + TCP_LEN + MAX_PAYLOAD); //IP datagram before fragmentation
+	unsigned char *frame = malloc(SNAPLEN);
+	uint16_t ip_id = 0;
+	long long datagrams = 0;
+
+	while ((packet_count < 0 || (long long)records_written < packet_count) && (max_bytes == 0 || bytes_written < max_bytes)) {
+		int f = next_random() % flow_count;
+		int tcp = flow_tcp[f];
+		int transport_len = tcp ? TCP_LEN : UDP_LEN;
+		int len = payload_size(&dist);
+		unsigned char *payload = datagram + IP_LEN + transport_len;
+
+		for (int i = 0; i < len; i++)
+			payload[i] = filler[next_random() % (sizeof(filler) - 1)];
+
+		/* Plant the strings: floor(density) per KB plus one more with the fractional probability */
+		if (array_of_strings_length > 0 && len > 0) {
+			double expected = matches_per_kb * len / 1024.0;
+			int plants = (int)expected + (next_uniform() < expected - (int)expected);
+			for (int p = 0; p < plants; p++) {
+				int s = next_random() % array_of_strings_length;
+				int slen = strlen(array_of_strings[s]);
+				if (slen > len)
+					continue;
+				memcpy(payload + next_random() % (len - slen + 1), array_of_strings[s], slen);
+			}
+		}
+		/* Count what is actually there: later plants can overwrite earlier ones, strings can contain each other */
+		if (array_of_strings_length > 0)
+			ac_match(ac, (const char *)payload, len, planted);
+
+		/* Transport header */
+		unsigned char *th = datagram + IP_LEN;
+		memset(th, 0, transport_len);
+		put16be(th, 1024 + f % 50000); //source port
+		put16be(th + 2, tcp ? 80 : 1900); //destination port
+		if (tcp) {
+			put32be(th + 4, flow_seq[f]);
+			th[12] = (TCP_LEN / 4) << 4;
+			th[13] = 0x18; //PSH ACK
+			put16be(th + 14, 65535);
+			flow_seq[f] += len;
+		}
+		else
+			put16be(th + 4, UDP_LEN + len);
+
+		/* IP datagram, cut into MTU sized fragments if it has been chosen to be fragmented */
+		int ip_payload_len = transport_len + len;
+		int fragment = ip_payload_len > MTU - IP_LEN && next_uniform() < fragment_fraction;
+		int fragment_size = (MTU - IP_LEN) & ~7;
+		if (fragment && packet_count >= 0 && (long long)records_written + (ip_payload_len + fragment_size - 1) / fragment_size > packet_count)
+			fragment = 0; //the fragments would go past -n, the last datagram is sent whole
+		int max_fragment = fragment ? fragment_size : ip_payload_len;
+		ip_id++;
+		for (int offset = 0; offset < ip_payload_len || offset == 0; offset += max_fragment) {
+			int piece = ip_payload_len - offset < max_fragment ? ip_payload_len - offset : max_fragment;
+			int more = offset + piece < ip_payload_len;
+
+			memset(frame, 0, ETHER_LEN);
+			frame[5] = 1; //destination 00:00:00:00:00:01
+			frame[11] = 2; //source 00:00:00:00:00:02
+			put16be(frame + 12, 0x0800); //IPv4
+			unsigned char *ip = frame + ETHER_LEN;
+			memset(ip, 0, IP_LEN);
+			ip[0] = 0x45;
+			put16be(ip + 2, IP_LEN + piece);
+			put16be(ip + 4, ip_id);
+			put16be(ip + 6, (more ? 0x2000 : 0) | (offset / 8));
+			ip[8] = 64;
+			ip[9] = tcp ? 6 : 17;
+			put32be(ip + 12, 0x0a000000 | (f & 0xffff)); //10.0.x.y
+			put32be(ip + 16, 0x0a010000 | ((f >> 16) & 0xffff)); //10.1.x.y
+			put16be(ip + 10, ip_checksum(ip));
+			memcpy(ip + IP_LEN, datagram + IP_LEN + offset, piece);
+			write_record(out, frame, ETHER_LEN + IP_LEN + piece);
+			if (!more)
+				break;
+		}
+		datagrams++;
+	}
+	fclose(out);
+
+	fprintf(stderr, "%s: %llu records, %lld datagrams, %llu bytes\n", output_path, records_written, datagrams, bytes_written);
+	for (int s = 0; s < array_of_strings_length; s++) {
+		if (planted[s] != 0)
+			fprintf(stderr, "%s: %d times!\n", array_of_strings[s], planted[s]);
+		free(array_of_strings[s]);
+	}
+	free(array_of_strings);
+	free(planted);
+	free(string_index);
+	ac_free(ac);
+	free(flow_seq);
+	free(flow_tcp);
+	free(datagram);
+	free(frame);
+	return 0;
+}
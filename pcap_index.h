@@ -0,0 +1,232 @@
+/*
+* Library that contain the record index of a capture: <file.pcap>.idx keeps, for every record, where its
+* bytes start, how many they are, the IP protocol and the flow hash (flow_hash.h). It is built with one
+* sequential pass the first time and reused afterwards, extended if the capture has grown since.
+* With the index a run knows how many packets there are and how big they are before reading any of
+* them, so the work can be split at once, every thread or rank can pread its own range of records,
+* and the records of the protocols that are not selected are never read.
+* Only classic pcap files with ethernet link type are supported.
+*
+* Usage:
+*	struct pcap_index *idx = pcap_index_open(filepath);
+*	struct pcap_index_entry *sel; long long n = pcap_index_select(idx, IPPROTO_UDP, &sel);
+*	pcap_index_read(idx, &sel[k], buffer);		// from any thread, buffer of sel[k].caplen bytes
+*	pcap_index_close(idx);
+*/
+#ifndef _PCAP_INDEX_H_
+#define _PCAP_INDEX_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "flow_hash.h"
+
+#define PCAP_INDEX_MAGIC "PCAPIDX1"
+#define PCAP_INDEX_HEAD_BYTES 128	// bytes of every record read to get protocol and flow
+#define PCAP_INDEX_ANY_PROTO 0xff	// not an IPv4 packet, or unknown link type
+
+/* One record of the capture, 24 bytes */
+struct pcap_index_entry {
+	unsigned long long offset;	// first byte of the packet data, after the record header
+	unsigned int caplen;
+	unsigned int flow_hash;
+	unsigned char proto;		// IP protocol (IPPROTO_UDP, IPPROTO_TCP, ...) or PCAP_INDEX_ANY_PROTO
+	unsigned char pad[7];
+};
+
+struct pcap_index_header {
+	char magic[8];
+	unsigned long long dev, ino;	// identity of the capture
+	unsigned long long indexed_bytes;	// the records of the first indexed_bytes bytes are in the index
+	unsigned long long count;		// number of entries
+};
+
+struct pcap_index {
+	struct pcap_index_entry *entries;
+	long long count;
+	unsigned long long total_bytes;	// sum of caplen of all the records
+	int fd;				// the capture, for pread
+	struct pcap_index_entry *selected;	// last pcap_index_select
+};
+
+static unsigned int pcap_index_swap32(unsigned int v, int swapped) {
+	return swapped ? __builtin_bswap32(v) : v;
+}
+
+/* Function use to add to the index the records that start at offset or later, until the end of the
+ * capture or a truncated record
+* OUTPUT
+	offset of the first byte not indexed, -1 if the file is not a classic ethernet pcap
+*/
+long long pcap_index_scan(const char *pcap_path, long long offset, struct pcap_index *idx, long long *capacity) {
+	FILE *f = fopen(pcap_path, "rb");
+	if (f == NULL)
+		return -1;
+	unsigned int global[6];
+	if (fread(global, 4, 6, f) != 6) {
+		fclose(f);
+		return -1;
+	}
+	int swapped;
+	if (global[0] == 0xa1b2c3d4 || global[0] == 0xa1b23c4d)
+		swapped = 0;
+	else if (global[0] == 0xd4c3b2a1 || global[0] == 0x4d3cb2a1)
+		swapped = 1;
+	else { //pcapng or not a capture
+		fclose(f);
+		return -1;
+	}
+	int ethernet = pcap_index_swap32(global[5], swapped) == 1;
+	if (offset < 24)
+		offset = 24;
+	setvbuf(f, NULL, _IOFBF, 1 << 20);
+	fseeko(f, offset, SEEK_SET);
+
+	unsigned int record[4]; //seconds, micro/nanoseconds, caplen, len
+	unsigned char head[PCAP_INDEX_HEAD_BYTES];
+	struct stat st;
+	fstat(fileno(f), &st);
+	while (fread(record, 4, 4, f) == 4) {
+		unsigned int caplen = pcap_index_swap32(record[2], swapped);
+		if (offset + 16 + caplen > st.st_size) //truncated, tcpdump is still writing it
+			break;
+		unsigned int n = caplen < PCAP_INDEX_HEAD_BYTES ? caplen : PCAP_INDEX_HEAD_BYTES;
+		if (fread(head, 1, n, f) != n)
+			break;
+		if (*capacity == idx->count) {
+			*capacity = *capacity ? *capacity * 2 : 1024;
+			idx->entries = realloc(idx->entries, *capacity * sizeof(struct pcap_index_entry));
+		}
+		struct pcap_index_entry *e = &idx->entries[idx->count++];
+		memset(e, 0, sizeof(*e));
+		e->offset = offset + 16;
+		e->caplen = caplen;
+		e->proto = PCAP_INDEX_ANY_PROTO;
+		if (ethernet && n >= sizeof(struct ether_header) + sizeof(struct ip) && head[12] == 0x08 && head[13] == 0x00) {
+			e->proto = ((const struct ip *)(head + sizeof(struct ether_header)))->ip_p;
+			e->flow_hash = flow_hash(head, n);
+		}
+		offset += 16 + caplen;
+		if (n < caplen)
+			fseeko(f, offset, SEEK_SET);
+	}
+	fclose(f);
+	return offset;
+}
+
+/* Function use to check that the first and the last record of a saved index are still where the index
+ * says, so that a capture rewritten in place (same inode) is indexed again */
+int pcap_index_spot_check(int fd, const struct pcap_index_entry *entries, long long count) {
+	long long check[2] = {0, count - 1};
+	for (int c = 0; c < 2 && count > 0; c++) {
+		unsigned int record[4];
+		if (pread(fd, record, sizeof(record), entries[check[c]].offset - 16) != sizeof(record))
+			return 0;
+		if (record[2] != entries[check[c]].caplen && __builtin_bswap32(record[2]) != entries[check[c]].caplen)
+			return 0;
+	}
+	return 1;
+}
+
+/* Function use to open the index of a capture, building it or extending it when needed
+* OUTPUT
+	the index, with the capture open for pcap_index_read; NULL if the capture is not a classic ethernet pcap
+*/
+struct pcap_index *pcap_index_open(const char *pcap_path) {
+	struct stat st;
+	int fd = open(pcap_path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		perror("error opening the capture to index: ");
+		return NULL;
+	}
+	struct pcap_index *idx = calloc(1, sizeof(struct pcap_index));
+	idx->fd = fd;
+	long long capacity = 0;
+	long long indexed = 0;
+
+	char idx_path[4096];
+	snprintf(idx_path, sizeof(idx_path), "%s.idx", pcap_path);
+	FILE *f = fopen(idx_path, "rb");
+	struct pcap_index_header h;
+	if (f != NULL && fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, PCAP_INDEX_MAGIC, 8) == 0 &&
+			h.dev == (unsigned long long)st.st_dev && h.ino == (unsigned long long)st.st_ino && h.indexed_bytes <= (unsigned long long)st.st_size) {
+		idx->entries = malloc((h.count ? h.count : 1) * sizeof(struct pcap_index_entry));
+		if (fread(idx->entries, sizeof(struct pcap_index_entry), h.count, f) == h.count &&
+				pcap_index_spot_check(fd, idx->entries, h.count)) {
+			idx->count = capacity = h.count;
+			indexed = h.indexed_bytes;
+		}
+	}
+	if (f != NULL)
+		fclose(f);
+
+	long long end = indexed;
+	if (indexed < st.st_size) { //first time, or the capture has grown
+		if (indexed == 0)
+			idx->count = 0;
+		long long before = idx->count;
+		end = pcap_index_scan(pcap_path, indexed, idx, &capacity);
+		if (end < 0) {
+			fprintf(stderr, "%s is not a classic pcap file, it cannot be indexed\n", pcap_path);
+			close(fd);
+			free(idx->entries);
+			free(idx);
+			return NULL;
+		}
+		// through a temporary file of our own, so that the other processes reading or extending the
+		// index (the ranks of mpi_dumping) always find a whole one
+		char tmp_path[4200];
+		snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", idx_path, (int)getpid()); //.tmp: left out of the directories of captures
+		f = fopen(tmp_path, "wb");
+		if (f != NULL) {
+			memcpy(h.magic, PCAP_INDEX_MAGIC, 8);
+			h.dev = st.st_dev;
+			h.ino = st.st_ino;
+			h.indexed_bytes = end;
+			h.count = idx->count;
+			int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+			ok &= fwrite(idx->entries, sizeof(struct pcap_index_entry), idx->count, f) == (size_t)idx->count;
+			if (fclose(f) != 0 || !ok || rename(tmp_path, idx_path) != 0) {
+				perror("error writing the index: ");
+				remove(tmp_path);
+			}
+		}
+		if (indexed == 0 || idx->count > before)
+			printf("Index: %lld records, %s %s\n", idx->count, indexed == 0 ? "built" : "extended", idx_path);
+	}
+	for (long long k = 0; k < idx->count; k++)
+		idx->total_bytes += idx->entries[k].caplen;
+	return idx;
+}
+
+/* Function use to get the records of an IP protocol (records whose protocol is unknown are kept too)
+* OUTPUT
+	number of records in *selected, which stays valid until pcap_index_close
+*/
+long long pcap_index_select(struct pcap_index *idx, int proto, struct pcap_index_entry **selected) {
+	free(idx->selected);
+	idx->selected = malloc((idx->count ? idx->count : 1) * sizeof(struct pcap_index_entry));
+	long long n = 0;
+	for (long long k = 0; k < idx->count; k++)
+		if (idx->entries[k].proto == proto || idx->entries[k].proto == PCAP_INDEX_ANY_PROTO)
+			idx->selected[n++] = idx->entries[k];
+	*selected = idx->selected;
+	return n;
+}
+
+/* Function use to read the packet of a record into buffer, safe to call from many threads at once */
+int pcap_index_read(struct pcap_index *idx, const struct pcap_index_entry *e, void *buffer) {
+	return pread(idx->fd, buffer, e->caplen, e->offset) == (ssize_t)e->caplen;
+}
+
+void pcap_index_close(struct pcap_index *idx) {
+	close(idx->fd);
+	free(idx->entries);
+	free(idx->selected);
+	free(idx);
+}
+
+#endif
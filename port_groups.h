@@ -0,0 +1,198 @@
+/*
+* Library that contain the port groups of the strings: as the rules of Snort, a string can be tagged
+* with the protocol and the destination port of the packets it is looked for in, and the strings are
+* compiled into one automaton per port. A packet is scanned only with the automaton of its destination
+* port (uh_dport/th_dport), which has the strings of that port and the untagged ones; the packets to
+* the other ports get the automaton of the untagged strings only.
+* Tags, at the end of a line of strings.txt:
+*	word@udp:1900	udp packets to port 1900
+*	word@tcp	every tcp packet
+*	word@any:53	packets to port 53, udp or tcp
+* A string whose protocol is not the one the tool matches is left out of every automaton; a suffix
+* that is not a tag ("user@host") is part of the string.
+*
+* Usage:
+*	struct port_groups *pg = port_groups_build(array_of_strings, n, IPPROTO_UDP);
+*	struct partition_plan *plan = port_groups_plan(pg);	// automaton g is plan->groups[g]
+*	g = port_group(pg, dst_port); ac_match(plan->groups[g], ...);
+*	port_groups_count(pg, g, 1); ... port_groups_print(pg); port_groups_free(pg);
+*/
+#ifndef _PORT_GROUPS_H_
+#define _PORT_GROUPS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "aho_corasick.h"
+#include "pattern_partition.h"
+
+#define PORT_ANY -1		// every port of the protocol
+#define PORT_NONE -2		// another protocol, never matched
+
+struct port_groups {
+	int protocol;			// IPPROTO_UDP or IPPROTO_TCP, the packets the tool matches
+	int string_count;
+	char **bare;			// the strings without their tag, what the automata look for
+	int *port;			// of every string, PORT_ANY or PORT_NONE
+	int count;			// groups, group 0 is the one of the ports without strings of their own
+	int *group_port;		// port of every group, PORT_ANY for group 0
+	int *group_strings;		// strings in the automaton of every group
+	long long *group_packets;	// packets given to every group
+	unsigned short group_of_port[65536];
+	struct ac_automaton **automata;	// owned by the plan of port_groups_plan once it is made
+};
+
+/* Function use to split a string from its tag
+* OUTPUT
+	the port of the string (PORT_ANY, PORT_NONE or a port), *len is the length of the string without the tag
+*/
+static int port_tag(const char *s, int protocol, size_t *len) {
+	const char *at = strrchr(s, '@');
+	*len = strlen(s);
+	if (at == NULL)
+		return PORT_ANY;
+	int tag_protocol;
+	const char *rest;
+	if (strncmp(at + 1, "udp", 3) == 0)
+		tag_protocol = IPPROTO_UDP;
+	else if (strncmp(at + 1, "tcp", 3) == 0)
+		tag_protocol = IPPROTO_TCP;
+	else if (strncmp(at + 1, "any", 3) == 0)
+		tag_protocol = 0;
+	else
+		return PORT_ANY;
+	rest = at + 4;
+	int port = PORT_ANY;
+	if (*rest == ':') {
+		char *end;
+		long p = strtol(rest + 1, &end, 10);
+		if (end == rest + 1 || *end != '\0' || p < 0 || p > 65535)
+			return PORT_ANY; //not a tag
+		port = p;
+	}
+	else if (*rest != '\0')
+		return PORT_ANY;
+	*len = at - s;
+	return tag_protocol == 0 || tag_protocol == protocol ? port : PORT_NONE;
+}
+
+static int compare_port(const void *a, const void *b) {
+	return *(const int *)a - *(const int *)b;
+}
+
+/* Function use to read the tags of the strings and build the automaton of every port group
+* INPUT:
+*	array_of_strings, array_of_strings_length: all the strings, with their tags
+	protocol: IPPROTO_UDP or IPPROTO_TCP
+
+* OUTPUT
+	the groups, matches are reported with the number the string has in array_of_strings
+*/
+struct port_groups *port_groups_build(char **array_of_strings, int array_of_strings_length, int protocol) {
+	struct port_groups *pg = calloc(1, sizeof(struct port_groups));
+	int n = array_of_strings_length;
+	pg->protocol = protocol;
+	pg->string_count = n;
+	pg->bare = malloc((n > 0 ? n : 1)*sizeof(char *));
+	pg->port = malloc((n > 0 ? n : 1)*sizeof(int));
+	int *ports = malloc((n > 0 ? n : 1)*sizeof(int)); //the distinct ports with strings of their own
+	int port_count = 0;
+	for (int i = 0; i < n; i++) {
+		size_t len;
+		pg->port[i] = port_tag(array_of_strings[i], protocol, &len);
+		pg->bare[i] = strndup(array_of_strings[i], len);
+		if (pg->port[i] >= 0)
+			ports[port_count++] = pg->port[i];
+	}
+	qsort(ports, port_count, sizeof(int), compare_port);
+	pg->count = 1;
+	for (int k = 0; k < port_count; k++)
+		if (k == 0 || ports[k] != ports[k-1])
+			ports[pg->count++ - 1] = ports[k]; //distinct ports in place
+	pg->group_port = malloc(pg->count*sizeof(int));
+	pg->group_port[0] = PORT_ANY;
+	memcpy(pg->group_port + 1, ports, (pg->count - 1)*sizeof(int));
+	free(ports);
+
+	pg->group_strings = calloc(pg->count, sizeof(int));
+	pg->group_packets = calloc(pg->count, sizeof(long long));
+	pg->automata = malloc(pg->count*sizeof(struct ac_automaton *));
+	int *string_index = malloc((n > 0 ? n : 1)*sizeof(int));
+	for (int g = 0; g < pg->count; g++) {
+		int m = 0;
+		for (int i = 0; i < n; i++)
+			if (pg->port[i] == PORT_ANY || (g > 0 && pg->port[i] == pg->group_port[g]))
+				string_index[m++] = i;
+		pg->group_strings[g] = m;
+		pg->automata[g] = ac_build(pg->bare, string_index, m);
+		if (g > 0)
+			pg->group_of_port[pg->group_port[g]] = g;
+	}
+	free(string_index);
+	return pg;
+}
+
+/* Function use to get a data parallel plan whose automata are the ones of the groups, so that the
+ * matching loops of the plans can be used; the plan frees them */
+struct partition_plan *port_groups_plan(struct port_groups *pg) {
+	struct partition_plan *plan = malloc(sizeof(struct partition_plan));
+	plan->mode = PARTITION_DATA;
+	plan->group_count = pg->count;
+	plan->groups = pg->automata;
+	plan->total_bytes = 0;
+	for (int g = 0; g < pg->count; g++)
+		plan->total_bytes += ac_table_bytes(pg->automata[g]->state_count);
+	plan->cache_bytes = 0;
+	pg->automata = NULL;
+	return plan;
+}
+
+/* Function use to get the group of the packets to a destination port */
+static inline int port_group(const struct port_groups *pg, unsigned short dst_port) {
+	return pg->group_of_port[dst_port];
+}
+
+/* Function use to add packets to the report of a group, from one thread at a time */
+void port_groups_count(struct port_groups *pg, int group, long long packets) {
+	pg->group_packets[group] += packets;
+}
+
+/* Function use to print the groups and the part of the strings every packet has been scanned with */
+void port_groups_print(const struct port_groups *pg) {
+	int matched = 0, tagged = 0; //strings of the protocol, and those with a port
+	long long packets = 0, scanned = 0; //packets, and string x packet pairs of their automata
+	for (int i = 0; i < pg->string_count; i++) {
+		matched += pg->port[i] != PORT_NONE;
+		tagged += pg->port[i] >= 0;
+	}
+	printf("Port groups: %d automata, %d of %d strings with a port, %d of another protocol\n",
+		pg->count, tagged, pg->string_count, pg->string_count - matched);
+	printf("Port\tstrings\tpackets\n");
+	for (int g = 0; g < pg->count; g++) {
+		if (g == 0)
+			printf("other\t%d\t%lld\n", pg->group_strings[g], pg->group_packets[g]);
+		else
+			printf("%d\t%d\t%lld\n", pg->group_port[g], pg->group_strings[g], pg->group_packets[g]);
+		packets += pg->group_packets[g];
+		scanned += pg->group_packets[g] * pg->group_strings[g];
+	}
+	if (packets > 0 && matched > 0)
+		printf("Every packet has been scanned with %.1f%% of the strings on average\n", 100.0 * scanned / ((double)packets * matched));
+}
+
+void port_groups_free(struct port_groups *pg) {
+	for (int i = 0; i < pg->string_count; i++)
+		free(pg->bare[i]);
+	free(pg->bare);
+	free(pg->port);
+	free(pg->group_port);
+	free(pg->group_strings);
+	free(pg->group_packets);
+	for (int g = 0; pg->automata != NULL && g < pg->count; g++) //NULL once the plan has them
+		ac_free(pg->automata[g]);
+	free(pg->automata);
+	free(pg);
+}
+
+#endif
@@ -0,0 +1,31 @@
+#!/bin/bash
+# Scaling curve of openmp_data from 1 to N threads, guided schedule against work stealing
+#	Usage: ./scaling_openmp.sh [file.pcap] [strings.txt] [max_threads] [repeats] [tcp/udp]
+#	Defaults: very_big_udp.pcap strings.txt $(nproc) 3 udp
+#	Output (CSV on stdout): threads,schedule,best_seconds,speedup
+#	openmp_data must be compiled in the current directory
+
+pcap_file=${1:-very_big_udp.pcap}
+strings_file=${2:-strings.txt}
+max_threads=${3:-$(nproc)}
+repeats=${4:-3}
+type=${5:-udp}
+
+echo "threads,schedule,best_seconds,speedup"
+for schedule in guided steal; do
+	base=""
+	for ((threads = 1; threads <= max_threads; threads++)); do
+		best=""
+		for ((r = 0; r < repeats; r++)); do
+			t=$(OMP_PROC_BIND=close OMP_PLACES=cores ./openmp_data "$pcap_file" "$strings_file" "$threads" "$type" "$schedule" \
+				| grep "Elapsed time" | awk '{print $4}')
+			if [ -z "$best" ] || awk -v a="$t" -v b="$best" 'BEGIN { exit !(a < b) }'; then
+				best=$t
+			fi
+		done
+		if [ -z "$base" ]; then
+			base=$best
+		fi
+		echo "$threads,$schedule,$best,$(awk -v a="$base" -v b="$best" 'BEGIN { printf "%.2f", a / b }')"
+	done
+done
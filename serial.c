@@ -1,8 +1,16 @@
 
-/* 	Compilation: gcc -g serial.c -o serial -lpcap
-	Usage: ./serial <file.pcap> <string.txt> [udp/tcp]
+/* 	Compilation: gcc -g -pthread serial.c -o serial -lpcap -lz
+	(add -DSTAGE_PROFILE, and -DSTAGE_PERF for hardware counters, to get the per-stage profile of stage_profile.h)
+	Usage: ./serial <file.pcap> <string.txt> [udp/tcp] [resume] [reader=pcap/mmap/uring]
+	resume: scan only the records appended since the previous resume run and print the totals
+	of all of them, the state is kept in <file.pcap>.state (incremental_state.h)
+	<file.pcap> can also be a directory, a glob pattern or @list: the counts of all the captures are
+	printed together (input_files.h), resume needs a single capture
+	<file.pcap> can also be gzip-compressed, a BGZF one is decompressed by several threads (gz_capture.h)
+	reader: read path of the captures, pcap_next_ex (default), mmap or io_uring (capture_reader.h)
  */
 
+#define _GNU_SOURCE //fopencookie, see gz_capture.h
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +19,10 @@
 #include <netinet/if_ether.h>
 #include "timer.h"
 #include "packet_dumping.h"
+#include "bench.h"
+#include "stage_profile.h"
+#include "incremental_state.h"
+#include "input_files.h"
 
 
 #define UDP 0
@@ -22,31 +34,43 @@ int* kmp_prefix (char pattern[]);
 
 	
 int main(int argc, char *argv[]) {
-	pcap_t *pcap;	//pointer to the pcap file
+	struct input_stream *pcap;	//packets of the pcap files, one after the other
 	char errbuf[PCAP_ERRBUF_SIZE];
 	struct pcap_pkthdr *header;
 	char *filepath;
 	char *strings_file_path;
 
 	int packet_type = UDP; //default udp
+	int resume = 0; //incremental scan
+	int reader = READER_PCAP; //read path
 	
-	if (argc==3 || argc ==4) { 
+	if (argc>=3 && argc<=6) { 
 		filepath = argv[1]; //get filename from command-line
 		strings_file_path = argv[2];
 		
-		if(argc == 4) { //get packet type from command-line
+		if(argc >= 4) { //get packet type from command-line
 			if(strcmp(argv[3], "udp") == 0)
 				packet_type=UDP;
 			else if (strcmp(argv[3], "tcp") == 0)
 				packet_type=TCP;
 			else {
-				printf("USAGE ./serial <file.pcap> <string.txt> [tcp/udp]\n");
+				printf("USAGE ./serial <file.pcap> <string.txt> [tcp/udp] [resume] [reader=pcap/mmap/uring]\n");
+				exit(1);
+			}
+		}
+		for (int a = 4; a < argc; a++) {
+			if(strcmp(argv[a], "resume") == 0)
+				resume = 1;
+			else if (strncmp(argv[a], "reader=", 7) == 0 && reader_kind(argv[a] + 7) >= 0)
+				reader = reader_kind(argv[a] + 7);
+			else {
+				printf("USAGE ./serial <file.pcap> <string.txt> [tcp/udp] [resume] [reader=pcap/mmap/uring]\n");
 				exit(1);
 			}
 		}
 	}
 	else {
-		printf("USAGE: ./serial <file.pcap> <string.txt> [tcp/udp]\n");
+		printf("USAGE: ./serial <file.pcap> <string.txt> [tcp/udp] [resume] [reader=pcap/mmap/uring]\n");
 		exit(1);
 	}
 	
@@ -63,21 +87,16 @@ int main(int argc, char *argv[]) {
 	}
 	char str[100]; //buffer when we save the strings in the file
 	
-	while(fscanf(fp, "%s", str) != EOF) //we read all the file word by word
+	while(fscanf(fp, "%99s", str) != EOF) //we read all the file word by word
 	{
-
-		array_of_strings[count] = malloc(strlen(str)+1); //we have to allocate memory for storing this payload
-		if (count < array_of_strings_length) {
-			memcpy(array_of_strings[count], str, strlen(str)); //copy string into array
-			count++;
-		}
-		else { //count == array_of_strings_length
+		if (count == array_of_strings_length) {
 			//it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
 			array_of_strings = (char **)realloc(array_of_strings, (array_of_strings_length*2)*sizeof(char *));
-			memcpy(array_of_strings[count], str, strlen(str)); //copy string into array
-			count++;
 			array_of_strings_length *= 2;
 		}
+		array_of_strings[count] = malloc(strlen(str)+1); //we have to allocate memory for storing this payload
+		memcpy(array_of_strings[count], str, strlen(str)+1); //copy string into array
+		count++; //actual number of strings have grown by 1
 	}
 	fclose(fp);
 	
@@ -87,12 +106,26 @@ int main(int argc, char *argv[]) {
 	array_of_strings_length = count;
 	
 
-	//now we open the pcap file
-	pcap = pcap_open_offline(filepath, errbuf);	//opening the pcap file
+	/* The span of the benchmark line starts here, see bench.h */
+	double bench_start;
+	GET_TIME(bench_start);
+
+	//now we open the pcap files
+	struct input_files files;
+	if (input_files_expand(filepath, &files) == 0)
+		exit(1);
+	if (resume && files.count > 1) {
+		printf("resume needs a single pcap file, %s has %d\n", filepath, files.count);
+		exit(1);
+	}
+	pcap = input_stream_open(&files, reader, errbuf);	//opening the pcap files
 	if (pcap == NULL) {	//check error in pcap file
 		fprintf(stderr, "error reading pcap file: %s\n", errbuf);
 		exit(1);
 	}
+	struct scan_state state; //what the previous runs have already counted
+	if (resume && state_load(filepath, pattern_set_hash(array_of_strings, array_of_strings_length, packet_type), array_of_strings_length, &state))
+		reader_seek(pcap->pcap, state.offset); //only the records appended since then
 	
 
 	count = 0; //actual number of payloads
@@ -104,6 +137,7 @@ int main(int argc, char *argv[]) {
 	int i;
 	char* data_copy; //copy of data object
 	unsigned int payload_lenght;
+	long long total_packets = 0, total_bytes = 0; //everything read from the capture, for the benchmark line
 	/* Loop extracting packets as long as we have something to read, storing them inside array_of_payloads */
 	
 	/* Start the performance evaluation */
@@ -112,33 +146,50 @@ int main(int argc, char *argv[]) {
 	
 	
 	//Start reading pcap file
-	while ((i = pcap_next_ex(pcap, &header, &data)) >= 0) {
+	while (1) {
+		STAGE_BEGIN(STAGE_READ);
+		i = input_next_ex(pcap, &header, &data);
+		STAGE_END(STAGE_READ);
+		if (i < 0) //end of the pcap file
+			break;
+
 		char* payload;
-		data_copy = malloc(header->len); //allocate memory to copy packet data
-		memcpy(data_copy, data, header->len); 
+		total_packets++;
+		total_bytes += header->caplen;
+		if (resume && state.offset >= 0) //a truncated last record is not read, the next run starts from it
+			state.offset += PCAP_RECORD_HEADER + header->caplen;
+		STAGE_BEGIN(STAGE_COPY);
+		data_copy = malloc(header->caplen); //allocate memory to copy packet data
+		memcpy(data_copy, data, header->caplen); 
+		STAGE_END(STAGE_COPY);
+
+		STAGE_BEGIN(STAGE_DECODE);
 		if(packet_type == UDP) //udp
-			payload = dump_UDP_packet(data_copy, &payload_lenght, header->len); //getting the payload
+			payload = dump_UDP_packet(data_copy, &payload_lenght, header->caplen); //getting the payload
 		else //tcp
-			payload = dump_TCP_packet(data_copy, &payload_lenght, header->len); //getting the payload
+			payload = dump_TCP_packet(data_copy, &payload_lenght, header->caplen); //getting the payload
+		STAGE_END(STAGE_DECODE);
 			
 		if(payload != NULL) { //we store it in array of payloads
-			array_of_payloads[count] = malloc(payload_lenght); //we have to allocate memory for storing this payload
-			if (count < array_of_payloads_length) {
-				memcpy(array_of_payloads[count], payload, payload_lenght);
-				count++;
-			}
-			else { //count == array_of_payloads_length
+			STAGE_BEGIN(STAGE_COPY);
+			if (count == array_of_payloads_length) {
 				//it looks like we exceeded maximum capacity of array, so we use a realloc to reallocate memory
 				array_of_payloads = (char **)realloc(array_of_payloads, (array_of_payloads_length*2)*sizeof(char *)); 
-				memcpy(array_of_payloads[count], payload, payload_lenght);
-				count++;
 				array_of_payloads_length *= 2;
 			}
+			array_of_payloads[count] = malloc(payload_lenght+1); //we have to allocate memory for storing this payload
+			memcpy(array_of_payloads[count], payload, payload_lenght);
+			array_of_payloads[count][payload_lenght] = '\0'; // kmp_matcher wants a string
+			count++;
+			STAGE_END(STAGE_COPY);
 		}
 		else {
 			//printf("The packet reading has not been completed succesfully!\n");
 		}
+		free(data_copy);
 	}
+	input_stream_close(pcap);
+	input_files_free(&files);
 	
 	/* If array is not full, we reallocate memory */
 	if (!(count == array_of_payloads_length))
@@ -150,9 +201,22 @@ int main(int argc, char *argv[]) {
 	for (int i = 0; i < array_of_strings_length; i++) {
 		prefix_array[i] = kmp_prefix(array_of_strings[i]);
 	}
+	STAGE_BEGIN(STAGE_MATCH);
 	for (int k = 0; k < count; k++)
 		for (int i = 0; i < array_of_strings_length; i++) 
 				string_count[i] += kmp_matcher(array_of_payloads[k],array_of_strings[i], prefix_array[i]);
+	STAGE_END(STAGE_MATCH);
+
+	if (resume) { //totals of the whole capture, saved for the next run
+		for (int i = 0; i < array_of_strings_length; i++) {
+			state.counts[i] += string_count[i];
+			string_count[i] = state.counts[i];
+		}
+		state.packets += total_packets;
+		printf("Incremental scan: %lld new packets scanned, %lld in total\n", total_packets, state.packets);
+		state_save(filepath, &state);
+		state_free(&state);
+	}
 				
 	
 	/* Stop the performance evaluation */		
@@ -167,6 +231,8 @@ int main(int argc, char *argv[]) {
 		
 	/* Now we print performance evaluation */
 	printf("Elapsed time = %f seconds\n", finish-start);
+	print_bench_line(reader == READER_MMAP ? "serial-mmap" : reader == READER_URING ? "serial-uring" : "serial", 1, 1, total_packets, total_bytes, finish-bench_start);
+	STAGE_REPORT("serial");
 
 	/* We have to free previously allocated memory */
 	for (int k = 0; k < count; k++) {
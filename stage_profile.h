@@ -0,0 +1,222 @@
+/*
+* Library that contain the per-stage timers of the hot path (read, decode, copy, match, merge,
+* distribute, reduce), recorded per thread.
+* Compile with -DSTAGE_PROFILE to turn them on: without it every macro is empty and costs nothing.
+* Compile with -DSTAGE_PROFILE -DSTAGE_PERF to read cycles, instructions, LLC misses and branch misses
+* of every stage too (perf_event_open, counts only the calling thread; needs perf_event_paranoid <= 2).
+* Set STAGE_PROFILE_OUT=<file.csv> to append the per-thread numbers to a file.
+*
+* Usage:
+*	STAGE_BEGIN(STAGE_MATCH);
+*	... code of the stage ...
+*	STAGE_END(STAGE_MATCH);
+*	...
+*	STAGE_REPORT("openmp_data");
+*/
+#ifndef _STAGE_PROFILE_H_
+#define _STAGE_PROFILE_H_
+
+#define STAGE_READ 0		// pcap_next_ex
+#define STAGE_DECODE 1		// dump_UDP_packet / dump_TCP_packet
+#define STAGE_COPY 2		// memcpy of packets and payloads
+#define STAGE_MATCH 3		// kmp_matcher / ac_match
+#define STAGE_MERGE 4		// private string count into the shared one
+#define STAGE_DISTRIBUTE 5	// MPI_Scatterv and the chunks of the dynamic mode
+#define STAGE_REDUCE 6		// MPI_Reduce of the counts
+#define STAGE_COUNT 7
+
+#ifdef STAGE_PROFILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef STAGE_PERF
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#define MAX_PROFILE_THREADS 256
+#define PERF_COUNTERS 4	// cycles, instructions, LLC misses, branch misses
+
+static const char *stage_names[STAGE_COUNT] = {"read", "decode", "copy", "match", "merge", "distribute", "reduce"};
+static const char *perf_names[PERF_COUNTERS] = {"cycles", "instructions", "llc_misses", "branch_misses"};
+
+struct stage_slot {
+	double seconds;
+	long long calls;
+	long long counters[PERF_COUNTERS];
+};
+
+/* One line of slots per thread, padded so that threads never write the same cache line */
+struct thread_stages {
+	struct stage_slot stage[STAGE_COUNT];
+	char pad[64];
+};
+
+static struct thread_stages stage_table[MAX_PROFILE_THREADS];
+
+/* Start of a stage, kept on the stack of the thread running it */
+struct stage_mark {
+	struct timespec start;
+	long long counters[PERF_COUNTERS];
+};
+
+static int stage_thread(void) {
+#ifdef _OPENMP
+	int t = omp_get_thread_num();
+	return t < MAX_PROFILE_THREADS ? t : MAX_PROFILE_THREADS - 1;
+#else
+	return 0;
+#endif
+}
+
+#ifdef STAGE_PERF
+static __thread int perf_group_fd = -2; // -2 not opened yet, -1 not available
+static int perf_warned = 0;
+
+/* Open the counters of the calling thread, as a group so that one read gets all of them */
+static void perf_open_thread(void) {
+	static const unsigned long long configs[PERF_COUNTERS][2] = {
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	};
+	perf_group_fd = -1;
+	for (int c = 0; c < PERF_COUNTERS; c++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = configs[c][0];
+		attr.config = configs[c][1];
+		attr.disabled = c == 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		int fd = syscall(SYS_perf_event_open, &attr, 0, -1, c == 0 ? -1 : perf_group_fd, 0);
+		if (fd < 0) {
+			if (c > 0)
+				close(perf_group_fd);
+			perf_group_fd = -1;
+#ifdef _OPENMP
+			#pragma omp critical (perf_warning)
+#endif
+			if (!perf_warned) {
+				perror("stage profile: perf_event_open, hardware counters disabled");
+				perf_warned = 1;
+			}
+			return;
+		}
+		if (c == 0)
+			perf_group_fd = fd;
+	}
+	ioctl(perf_group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void perf_read_thread(long long *counters) {
+	if (perf_group_fd == -2)
+		perf_open_thread();
+	unsigned long long values[1 + PERF_COUNTERS];
+	if (perf_group_fd < 0 || read(perf_group_fd, values, sizeof(values)) != sizeof(values)) {
+		memset(counters, 0, PERF_COUNTERS*sizeof(long long));
+		return;
+	}
+	for (int c = 0; c < PERF_COUNTERS; c++)
+		counters[c] = values[1 + c];
+}
+#endif
+
+static inline void stage_begin(struct stage_mark *m) {
+#ifdef STAGE_PERF
+	perf_read_thread(m->counters);
+#endif
+	clock_gettime(CLOCK_MONOTONIC, &m->start);
+}
+
+static inline void stage_end(int stage, struct stage_mark *m) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	struct stage_slot *slot = &stage_table[stage_thread()].stage[stage];
+	slot->seconds += (now.tv_sec - m->start.tv_sec) + (now.tv_nsec - m->start.tv_nsec) / 1e9;
+	slot->calls++;
+#ifdef STAGE_PERF
+	long long counters[PERF_COUNTERS];
+	perf_read_thread(counters);
+	for (int c = 0; c < PERF_COUNTERS; c++)
+		slot->counters[c] += counters[c] - m->counters[c];
+#endif
+}
+
+/* Function use to print the summary table and append the per-thread numbers to $STAGE_PROFILE_OUT
+* INPUT:
+*	label: name of the run (binary, rank), first column of the dump
+*/
+static void stage_report(const char *label) {
+	printf("Stage profile (%s):\n", label);
+	printf("%-10s %12s %14s %14s %6s %14s %14s\n", "stage", "calls", "seconds", "max thread (s)", "IPC", "llc_misses", "branch_misses");
+	for (int s = 0; s < STAGE_COUNT; s++) {
+		struct stage_slot total;
+		memset(&total, 0, sizeof(total));
+		double max_thread = 0;
+		for (int t = 0; t < MAX_PROFILE_THREADS; t++) {
+			struct stage_slot *slot = &stage_table[t].stage[s];
+			total.seconds += slot->seconds;
+			total.calls += slot->calls;
+			for (int c = 0; c < PERF_COUNTERS; c++)
+				total.counters[c] += slot->counters[c];
+			if (slot->seconds > max_thread)
+				max_thread = slot->seconds;
+		}
+		if (total.calls == 0)
+			continue;
+		double ipc = total.counters[0] > 0 ? (double)total.counters[1] / total.counters[0] : 0;
+		printf("%-10s %12lld %14.6f %14.6f %6.2f %14lld %14lld\n", stage_names[s], total.calls, total.seconds, max_thread,
+			ipc, total.counters[2], total.counters[3]);
+	}
+
+	const char *path = getenv("STAGE_PROFILE_OUT");
+	if (path == NULL)
+		return;
+	FILE *out = fopen(path, "a");
+	if (out == NULL) {
+		perror("stage profile: error opening STAGE_PROFILE_OUT");
+		return;
+	}
+	if (ftell(out) == 0) {
+		fprintf(out, "label,thread,stage,calls,seconds");
+		for (int c = 0; c < PERF_COUNTERS; c++)
+			fprintf(out, ",%s", perf_names[c]);
+		fprintf(out, "\n");
+	}
+	for (int t = 0; t < MAX_PROFILE_THREADS; t++)
+		for (int s = 0; s < STAGE_COUNT; s++) {
+			struct stage_slot *slot = &stage_table[t].stage[s];
+			if (slot->calls == 0)
+				continue;
+			fprintf(out, "%s,%d,%s,%lld,%.9f", label, t, stage_names[s], slot->calls, slot->seconds);
+			for (int c = 0; c < PERF_COUNTERS; c++)
+				fprintf(out, ",%lld", slot->counters[c]);
+			fprintf(out, "\n");
+		}
+	fclose(out);
+}
+
+#define STAGE_BEGIN(stage) struct stage_mark stage_mark_##stage; stage_begin(&stage_mark_##stage)
+#define STAGE_END(stage) stage_end(stage, &stage_mark_##stage)
+#define STAGE_REPORT(label) stage_report(label)
+
+#else
+
+#define STAGE_BEGIN(stage)
+#define STAGE_END(stage)
+#define STAGE_REPORT(label)
+
+#endif
+
+#endif
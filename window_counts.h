@@ -0,0 +1,251 @@
+/*
+* Library that contain the time-windowed counts of the live sniffer: every worker thread owns a ring of
+* WINDOW_SLOTS one-second buckets of per-string counts, indexed by the capture second of the packets.
+* A reporter thread reads the rings without locks and prints (or appends to a CSV file) the counts of
+* every second and of every minute, while capture and matching go on.
+* A bucket is reused when a new second lands on its slot; a sequence number, odd while the bucket is
+* being reset, lets the reader throw away what it read during a reset and read it again.
+* The capture loop tells the reporter about every batch of packets from its first packet until the
+* batch has been counted: a second is reported only when no such batch started at or before it, so
+* the counts of a batch never land in a window that has already been printed. A window that is
+* reported anyway, because a batch has been pending for too long, is marked partial.
+*
+* Usage:
+*	struct window_ring *rings = window_rings_alloc(threads, strings_count);
+*	window_add(&rings[omp_get_thread_num()], header.ts.tv_sec, string, matches);	// owner thread only
+*	struct window_reporter *r = window_reporter_start(rings, threads, strings, strings_count, NULL);
+*	window_batch_begin(r, first_packet.ts.tv_sec); ... window_add(...) ... window_batch_end(r, first_packet.ts.tv_sec);
+*	...
+*	window_reporter_stop(r);
+*/
+#ifndef _WINDOW_COUNTS_H_
+#define _WINDOW_COUNTS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define WINDOW_SLOTS 128	// seconds kept by every ring, more than a minute plus the delay
+#define WINDOW_DELAY 2		// a second is reported this many seconds after it ends, if no batch holds packets of it
+#define WINDOW_WAIT (WINDOW_SLOTS/2)	// seconds a window waits for its batches at most, then it is reported partial
+#define WINDOW_MINUTE 60
+
+struct window_bucket {
+	long long seq;		// odd while the owner resets the bucket
+	long long second;	// capture second counted by the bucket, -1 if unused
+	int *counts;		// one counter per string
+};
+
+/* Ring of a worker, padded so that two workers never write the same cache line */
+struct window_ring {
+	struct window_bucket bucket[WINDOW_SLOTS];
+	int strings_count;
+	char pad[64];
+};
+
+struct window_ring *window_rings_alloc(int threads, int strings_count) {
+	struct window_ring *rings = calloc(threads, sizeof(struct window_ring));
+	for (int t = 0; t < threads; t++) {
+		rings[t].strings_count = strings_count;
+		for (int s = 0; s < WINDOW_SLOTS; s++) {
+			rings[t].bucket[s].second = -1;
+			rings[t].bucket[s].counts = calloc(strings_count, sizeof(int));
+		}
+	}
+	return rings;
+}
+
+void window_rings_free(struct window_ring *rings, int threads) {
+	for (int t = 0; t < threads; t++)
+		for (int s = 0; s < WINDOW_SLOTS; s++)
+			free(rings[t].bucket[s].counts);
+	free(rings);
+}
+
+/* Function use to add n matches of string to the second of the ring, only the thread that owns ring may call it */
+static inline void window_add(struct window_ring *ring, long long second, int string, int n) {
+	struct window_bucket *b = &ring->bucket[second % WINDOW_SLOTS];
+	if (b->second != second) {
+		if (b->second > second) //too old, its slot already belongs to a newer second
+			return;
+		__atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		for (int i = 0; i < ring->strings_count; i++)
+			__atomic_store_n(&b->counts[i], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&b->second, second, __ATOMIC_RELAXED);
+		__atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&b->counts[string], b->counts[string] + n, __ATOMIC_RELAXED);
+}
+
+/* Function use to add to out the counts of a second of every ring, without stopping the owners
+* OUTPUT
+	0 if some ring has already reused the slot of second (the window is gone), 1 otherwise
+*/
+int window_read(struct window_ring *rings, int threads, long long second, int *out) {
+	int strings_count = rings[0].strings_count;
+	int *copy = malloc(strings_count*sizeof(int));
+	int complete = 1;
+	for (int t = 0; t < threads; t++) {
+		struct window_bucket *b = &rings[t].bucket[second % WINDOW_SLOTS];
+		long long seq, bucket_second;
+		while (1) {
+			seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+			if (seq & 1) //the owner is resetting it
+				continue;
+			bucket_second = __atomic_load_n(&b->second, __ATOMIC_RELAXED);
+			if (bucket_second == second)
+				for (int i = 0; i < strings_count; i++)
+					copy[i] = __atomic_load_n(&b->counts[i], __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&b->seq, __ATOMIC_RELAXED) == seq)
+				break;
+		}
+		if (bucket_second == second)
+			for (int i = 0; i < strings_count; i++)
+				out[i] += copy[i];
+		else if (bucket_second > second)
+			complete = 0;
+		// bucket_second < second: nothing captured in that second by this worker
+	}
+	free(copy);
+	return complete;
+}
+
+struct window_reporter {
+	pthread_t thread;
+	struct window_ring *rings;
+	int threads;
+	char **strings;
+	int strings_count;
+	FILE *out;		// CSV file, NULL to print on stdout
+	int pending[WINDOW_SLOTS];	// batches not counted yet, by the second of their first packet
+	volatile int stop;
+};
+
+/* Function use to tell the reporter that a batch whose first packet is of second has started, r can be NULL */
+static inline void window_batch_begin(struct window_reporter *r, long long second) {
+	if (r != NULL)
+		__atomic_add_fetch(&r->pending[second % WINDOW_SLOTS], 1, __ATOMIC_RELEASE);
+}
+
+/* Function use to tell the reporter that the matches of a batch have all been added, r can be NULL */
+static inline void window_batch_end(struct window_reporter *r, long long second) {
+	if (r != NULL)
+		__atomic_sub_fetch(&r->pending[second % WINDOW_SLOTS], 1, __ATOMIC_RELEASE);
+}
+
+/* Function use to know if a batch started in second or in the WINDOW_WAIT seconds before it is still pending */
+static int window_pending(struct window_reporter *r, long long second) {
+	for (long long s = second - WINDOW_WAIT + 1; s <= second; s++)
+		if (s >= 0 && __atomic_load_n(&r->pending[s % WINDOW_SLOTS], __ATOMIC_ACQUIRE) > 0)
+			return 1;
+	return 0;
+}
+
+/* Function use to print (or append to the CSV file) the counts of a window that starts at first and lasts width seconds */
+void window_print(struct window_reporter *r, long long first, int width, const int *counts, int complete) {
+	if (r->out != NULL) {
+		for (int i = 0; i < r->strings_count; i++)
+			if (counts[i] != 0)
+				fprintf(r->out, "%lld,%d,%s,%d\n", first, width, r->strings[i], counts[i]);
+		fflush(r->out);
+		return;
+	}
+	char when[32];
+	time_t t = first;
+	struct tm tm;
+	strftime(when, sizeof(when), "%H:%M:%S", localtime_r(&t, &tm));
+	printf("Window %s +%ds%s:", when, width, complete ? "" : " (partial)");
+	int any = 0;
+	for (int i = 0; i < r->strings_count; i++)
+		if (counts[i] != 0) {
+			printf(" %s=%d", r->strings[i], counts[i]);
+			any = 1;
+		}
+	printf(any ? "\n" : " no matches\n");
+	fflush(stdout);
+}
+
+/* Body of the reporter thread: once per second it reports the seconds that ended WINDOW_DELAY seconds ago
+ * and whose batches have all been counted, and every minute boundary the whole minute. When it is
+ * stopped, the capture is over and every batch counted, so it reports the seconds up to the last one */
+void *window_reporter_main(void *arg) {
+	struct window_reporter *r = arg;
+	int *second_counts = malloc(r->strings_count*sizeof(int));
+	int *minute_counts = calloc(r->strings_count, sizeof(int));
+	int minute_complete = 1;
+	long long next = time(NULL) - WINDOW_DELAY; //next second to report
+	while (1) {
+		int stopping = r->stop;
+		if (!stopping) {
+			struct timespec nap = {0, 200000000}; //short naps, so that stop is seen quickly
+			nanosleep(&nap, NULL);
+		}
+		long long now = time(NULL);
+		long long last = stopping ? now + 1 : now - WINDOW_DELAY; //report the seconds before it
+		while (next < last) {
+			int waiting = window_pending(r, next);
+			if (waiting && next > now - WINDOW_WAIT)
+				break; //a batch with packets of next has not been counted yet
+			memset(second_counts, 0, r->strings_count*sizeof(int));
+			int complete = window_read(r->rings, r->threads, next, second_counts) && !waiting;
+			window_print(r, next, 1, second_counts, complete);
+			for (int i = 0; i < r->strings_count; i++)
+				minute_counts[i] += second_counts[i];
+			minute_complete &= complete;
+			next++;
+			if (next % WINDOW_MINUTE == 0) {
+				window_print(r, next - WINDOW_MINUTE, WINDOW_MINUTE, minute_counts, minute_complete);
+				memset(minute_counts, 0, r->strings_count*sizeof(int));
+				minute_complete = 1;
+			}
+		}
+		if (stopping)
+			break;
+	}
+	free(second_counts);
+	free(minute_counts);
+	return NULL;
+}
+
+/* Function use to start the reporter thread
+* INPUT:
+*	rings, threads: the rings of the workers
+	strings, strings_count: the strings, for the names in the report
+	csv_path: file the windows are appended to as second,width,string,count; NULL to print them
+* OUTPUT
+	the reporter, to be given to window_reporter_stop
+*/
+struct window_reporter *window_reporter_start(struct window_ring *rings, int threads, char **strings, int strings_count, const char *csv_path) {
+	struct window_reporter *r = calloc(1, sizeof(struct window_reporter));
+	r->rings = rings;
+	r->threads = threads;
+	r->strings = strings;
+	r->strings_count = strings_count;
+	if (csv_path != NULL) {
+		r->out = fopen(csv_path, "a");
+		if (r->out == NULL) {
+			perror("error opening window file: ");
+			exit(1);
+		}
+	}
+	if (pthread_create(&r->thread, NULL, window_reporter_main, r) != 0) {
+		perror("error starting the window reporter: ");
+		exit(1);
+	}
+	return r;
+}
+
+/* Function use to stop the reporter once every batch has been counted, the seconds not reported yet are reported first */
+void window_reporter_stop(struct window_reporter *r) {
+	r->stop = 1;
+	pthread_join(r->thread, NULL);
+	if (r->out != NULL)
+		fclose(r->out);
+	free(r);
+}
+
+#endif
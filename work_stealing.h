@@ -0,0 +1,142 @@
+/*
+* Library that contain a work stealing scheduler for the matching loops:
+* every thread owns a deque of byte sized work items, it pops from the tail of its own
+* deque and, when it is empty, steals from the head of a randomly chosen victim
+*/
+#ifndef _WORK_STEALING_H_
+#define _WORK_STEALING_H_
+
+#include <omp.h>
+
+/* Work items are cut so that every thread gets about ITEMS_PER_THREAD of them:
+ * enough to balance, not so many that the locks show up */
+#define ITEMS_PER_THREAD 16
+
+/* A slice of the matching work: one payload against the strings [first_string, last_string) */
+struct work_item {
+	int payload;
+	int first_string;
+	int last_string;
+};
+
+/* Deque owned by a thread, the lock is taken by the owner and by thieves alike */
+struct work_deque {
+	struct work_item *items;
+	int head;	// next item a thief steals
+	int tail;	// one past the next item the owner pops
+	omp_lock_t lock;
+	char pad[64];	// keep deques of different threads on different cache lines
+};
+
+/* Function use to cut the matching work into byte sized items and deal them to the deques
+* INPUT:
+*	payload_length: length of every payload
+	payload_count: number of payloads
+	strings_count: number of strings every payload is matched against
+	thread_count: number of deques to fill
+
+* OUTPUT
+	array of thread_count deques, to be released with free_work_deques
+
+* The cost of a payload is (length + 1) * number of strings: payloads above the average item cost
+* are cut by string range, so a payload 100x bigger than the others ends up in about 100 items.
+* Items are dealt as contiguous blocks of equal cost, which keeps neighbouring payloads on the same thread.
+*/
+struct work_deque* build_work_deques(const unsigned int *payload_length, int payload_count, int strings_count, int thread_count) {
+	struct work_deque *deques = malloc(thread_count*sizeof(struct work_deque));
+	unsigned long long total_cost = 0;
+	for (int k = 0; k < payload_count; k++)
+		total_cost += (unsigned long long)(payload_length[k] + 1) * strings_count;
+
+	unsigned long long item_cost = total_cost / ((unsigned long long)thread_count * ITEMS_PER_THREAD) + 1;
+	for (int t = 0; t < thread_count; t++) {
+		deques[t].items = NULL;
+		deques[t].head = 0;
+		deques[t].tail = 0;
+		omp_init_lock(&deques[t].lock);
+	}
+
+	/* Cut and deal, thread t takes the items until the cumulative cost reaches (t+1)/thread_count.
+	 * The first pass only counts the items of every deque, the second one stores them */
+	for (int pass = 0; pass < 2; pass++) {
+		if (pass == 1)
+			for (int t = 0; t < thread_count; t++) {
+				deques[t].items = malloc((deques[t].tail > 0 ? deques[t].tail : 1)*sizeof(struct work_item));
+				deques[t].tail = 0;
+			}
+		unsigned long long cumulative = 0;
+		int t = 0;
+		for (int k = 0; k < payload_count && strings_count > 0; k++) {
+			unsigned long long cost = (unsigned long long)(payload_length[k] + 1) * strings_count;
+			unsigned long long pieces = (cost + item_cost - 1) / item_cost;
+			if (pieces > (unsigned long long)strings_count)
+				pieces = strings_count;
+			for (int p = 0; p < (int)pieces; p++) {
+				struct work_item item;
+				item.payload = k;
+				item.first_string = (int)(strings_count * p / pieces);
+				item.last_string = (int)(strings_count * (p+1) / pieces);
+				unsigned long long cost_of_item = (unsigned long long)(payload_length[k] + 1) * (item.last_string - item.first_string);
+				while (t < thread_count-1 && cumulative + cost_of_item/2 >= total_cost * (t+1) / thread_count)
+					t++;
+				if (pass == 1)
+					deques[t].items[deques[t].tail] = item;
+				deques[t].tail++;
+				cumulative += cost_of_item;
+			}
+		}
+	}
+	return deques;
+}
+
+/* Function use to get the next item of thread me: its own tail first, then a steal from random victims
+* INPUT:
+*	deques: the deques built by build_work_deques
+	thread_count: number of deques, the one given to build_work_deques: the runtime can give fewer
+	threads than that, the deques nobody owns are then emptied by the thieves
+	me: thread number of the caller
+	seed: private seed of the caller for rand_r
+	item: filled with the item found
+	steals: incremented when the item has been stolen
+
+* OUTPUT
+	1 if an item has been found, 0 if every deque is empty (no item is ever added, so the work is over)
+*/
+int next_work_item(struct work_deque *deques, int thread_count, int me, unsigned int *seed, struct work_item *item, int *steals) {
+	struct work_deque *own = &deques[me];
+	omp_set_lock(&own->lock);
+	if (own->tail > own->head) {
+		*item = own->items[--own->tail];
+		omp_unset_lock(&own->lock);
+		return 1;
+	}
+	omp_unset_lock(&own->lock);
+
+	/* Own deque is empty: start from a random victim and visit every other deque once */
+	int start = rand_r(seed) % thread_count;
+	for (int v = 0; v < thread_count; v++) {
+		struct work_deque *victim = &deques[(start + v) % thread_count];
+		if (victim == own || victim->tail <= victim->head) // racy peek, the lock below decides
+			continue;
+		omp_set_lock(&victim->lock);
+		if (victim->tail > victim->head) {
+			*item = victim->items[victim->head++];
+			omp_unset_lock(&victim->lock);
+			(*steals)++;
+			return 1;
+		}
+		omp_unset_lock(&victim->lock);
+	}
+	return 0;
+}
+
+/* Function use to release the deques built by build_work_deques */
+void free_work_deques(struct work_deque *deques, int thread_count) {
+	for (int t = 0; t < thread_count; t++) {
+		omp_destroy_lock(&deques[t].lock);
+		free(deques[t].items);
+	}
+	free(deques);
+}
+
+#endif